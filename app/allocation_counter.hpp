@@ -0,0 +1,55 @@
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// The number of memory allocations made by the program (through the global
+// operator new), used by the tests to check that an operation does not
+// allocate.
+// All of the replaceable forms without alignment are replaced, so that
+// each block is freed by the same allocator that allocated it. They are
+// not inlined, as GCC would otherwise see malloc paired with delete (and
+// new with free) at the call sites and warn (-Wmismatched-new-delete).
+// Since the replacements are definitions, this header must be included in
+// only one translation unit of a program.
+static std::atomic<long long> allocation_count(0);
+
+[[gnu::noinline]] void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    ++allocation_count;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+[[gnu::noinline]] void* operator new(std::size_t size) {
+    if (void* p = operator new(size, std::nothrow)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+[[gnu::noinline]] void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#endif  // ALLOCATION_COUNTER_HPP
@@ -0,0 +1,524 @@
+// Benchmark suite for the queues, the thread pool and Julia set rendering.
+// Usage: benchmark [--quick] [--output FILE]
+// The results are written as JSON to FILE (or to standard output), so that
+// they can be compared between releases. Build in Release mode (e.g.,
+// "cmake -S . -B tmp -D CMAKE_BUILD_TYPE=Release") for meaningful numbers.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <ra/image_file.hpp>
+#include <ra/julia_set.hpp>
+#include <ra/julia_set_mixed.hpp>
+#include <ra/julia_set_perturbation.hpp>
+#include <ra/julia_tile_cache.hpp>
+#include <ra/mpmc_queue.hpp>
+#include <ra/queue.hpp>
+#include <ra/thread_pool.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef RA_BUILD_TYPE
+#define RA_BUILD_TYPE "unknown"
+#endif
+
+using clock_type = std::chrono::steady_clock;
+
+// One benchmark result: a name, the parameters of the run, and the
+// measured metrics.
+struct result {
+    std::string name;
+    std::map<std::string, std::string> params;
+    std::map<std::string, double> metrics;
+};
+
+// Returns the elapsed time since start in nanoseconds.
+double elapsed_ns(clock_type::time_point start) {
+    return std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+}
+
+// Returns the p-th percentile (0 <= p <= 1) of the sorted values.
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()))];
+}
+
+// Measures the throughput of a queue with the given numbers of producers
+// and consumers, and the latency from push to pop.
+template <class Queue>
+result queue_benchmark(const std::string& queue_name, int producers, int consumers, int items_per_producer) {
+    Queue q(1024);
+    std::vector<std::vector<double>> latencies(consumers);
+    std::vector<std::thread> threads;
+
+    auto start = clock_type::now();
+    for (int i = 0; i < consumers; ++i) {
+        threads.emplace_back([&q, &latencies, i]() {
+            std::int64_t stamp;
+            latencies[i].reserve(1 << 16);
+            while (q.pop(stamp) == Queue::status::success) {
+                double latency = std::chrono::duration<double, std::nano>(
+                                     clock_type::now().time_since_epoch()).count() - stamp;
+                latencies[i].push_back(latency);
+            }
+        });
+    }
+    std::vector<std::thread> producer_threads;
+    for (int i = 0; i < producers; ++i) {
+        producer_threads.emplace_back([&q, items_per_producer]() {
+            for (int j = 0; j < items_per_producer; ++j) {
+                q.push(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           clock_type::now().time_since_epoch()).count());
+            }
+        });
+    }
+    for (auto& t : producer_threads) {
+        t.join();
+    }
+    q.close();
+    for (auto& t : threads) {
+        t.join();
+    }
+    double total_ns = elapsed_ns(start);
+
+    std::vector<double> all;
+    for (auto& l : latencies) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    double items = double(producers) * items_per_producer;
+    result r{"queue", {}, {}};
+    r.params["queue"] = queue_name;
+    r.params["producers"] = std::to_string(producers);
+    r.params["consumers"] = std::to_string(consumers);
+    r.metrics["items"] = items;
+    r.metrics["ops_per_second"] = items / (total_ns * 1e-9);
+    r.metrics["latency_p50_ns"] = percentile(all, 0.50);
+    r.metrics["latency_p90_ns"] = percentile(all, 0.90);
+    r.metrics["latency_p99_ns"] = percentile(all, 0.99);
+    r.metrics["latency_p999_ns"] = percentile(all, 0.999);
+    r.metrics["latency_max_ns"] = all.empty() ? 0 : all.back();
+    return r;
+}
+
+// Measures the per-task overhead of the thread pool for empty tasks and
+// for tiny tasks (a single atomic increment), scheduled from outside the
+// pool or from inside a task of the pool.
+result pool_benchmark(bool work_stealing, bool tiny, bool from_inside, int num_tasks) {
+    ra::concurrency::thread_pool_options options;
+    options.work_stealing = work_stealing;
+    ra::concurrency::thread_pool pool(options);
+    std::atomic<int> counter(0);
+
+    auto make_task = [&counter, tiny]() -> ra::concurrency::task_function {
+        if (tiny) {
+            return [&counter]() { counter.fetch_add(1, std::memory_order_relaxed); };
+        }
+        return []() {};
+    };
+
+    auto start = clock_type::now();
+    if (from_inside) {
+        pool.schedule([&]() {
+            for (int i = 0; i < num_tasks; ++i) {
+                pool.schedule(make_task());
+            }
+        });
+    } else {
+        for (int i = 0; i < num_tasks; ++i) {
+            pool.schedule(make_task());
+        }
+    }
+    pool.wait_idle();
+    double total_ns = elapsed_ns(start);
+
+    result r{"thread_pool", {}, {}};
+    r.params["mode"] = work_stealing ? "work_stealing" : "shared";
+    r.params["task"] = tiny ? "tiny" : "empty";
+    r.params["scheduled_from"] = from_inside ? "inside" : "outside";
+    r.params["threads"] = std::to_string(pool.size());
+    r.metrics["tasks"] = num_tasks;
+    r.metrics["ns_per_task"] = total_ns / num_tasks;
+    return r;
+}
+
+// Measures the round-trip latency of a single task scheduled on an idle
+// thread pool (which has to wake up a thread), for a wait strategy.
+result pool_wake_benchmark(const std::string& wait_name, const ra::concurrency::wait_strategy& wait, int rounds) {
+    ra::concurrency::thread_pool_options options;
+    options.num_threads = 1;
+    options.wait = wait;
+    ra::concurrency::thread_pool pool(options);
+
+    std::vector<double> latencies;
+    latencies.reserve(rounds);
+    for (int i = 0; i < rounds; ++i) {
+        auto start = clock_type::now();
+        pool.submit([]() {}).get();
+        latencies.push_back(elapsed_ns(start));
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    result r{"thread_pool_wake", {}, {}};
+    r.params["wait"] = wait_name;
+    r.metrics["rounds"] = rounds;
+    r.metrics["latency_p50_ns"] = percentile(latencies, 0.50);
+    r.metrics["latency_p90_ns"] = percentile(latencies, 0.90);
+    r.metrics["latency_p99_ns"] = percentile(latencies, 0.99);
+    return r;
+}
+
+// Measures the time to render a Julia set image on a reused thread pool.
+template <class Real>
+result julia_benchmark(const std::string& type_name, int size, int max_iters, int threads, int repetitions) {
+    ra::concurrency::thread_pool pool(threads);
+    boost::multi_array<int, 2> a(boost::extents[size][size]);
+    std::complex<Real> bottom_left(-1.25, -1.25);
+    std::complex<Real> top_right(1.25, 1.25);
+    std::complex<Real> c(0.37, -0.16);
+
+    std::vector<double> times;
+    for (int k = 0; k < repetitions; ++k) {
+        auto start = clock_type::now();
+        ra::fractal::compute_julia_set<Real>(bottom_left, top_right, c, max_iters, a, pool);
+        times.push_back(elapsed_ns(start));
+    }
+    std::sort(times.begin(), times.end());
+
+    result r{"julia_set", {}, {}};
+    r.params["type"] = type_name;
+    r.params["size"] = std::to_string(size);
+    r.params["max_iters"] = std::to_string(max_iters);
+    r.params["threads"] = std::to_string(threads);
+    r.metrics["best_ms"] = times.front() * 1e-6;
+    r.metrics["median_ms"] = percentile(times, 0.5) * 1e-6;
+    r.metrics["megapixels_per_second"] = double(size) * size / (times.front() * 1e-3);
+    return r;
+}
+
+// Measures the time to render a Julia set image with the Mariani-Silver
+// algorithm, and the fraction of the pixels that it evaluates.
+result julia_subdivided_benchmark(int size, int max_iters, int threads, int repetitions) {
+    ra::concurrency::thread_pool pool(threads);
+    boost::multi_array<int, 2> a(boost::extents[size][size]);
+    std::complex<double> bottom_left(-1.25, -1.25);
+    std::complex<double> top_right(1.25, 1.25);
+    std::complex<double> c(0.37, -0.16);
+
+    std::vector<double> times;
+    std::uint64_t evaluated = 0;
+    for (int k = 0; k < repetitions; ++k) {
+        auto start = clock_type::now();
+        evaluated = ra::fractal::compute_julia_set_subdivided<double>(bottom_left, top_right, c, max_iters, a,
+                                                                      pool);
+        times.push_back(elapsed_ns(start));
+    }
+    std::sort(times.begin(), times.end());
+
+    result r{"julia_set_subdivided", {}, {}};
+    r.params["type"] = "double";
+    r.params["size"] = std::to_string(size);
+    r.params["max_iters"] = std::to_string(max_iters);
+    r.params["threads"] = std::to_string(threads);
+    r.metrics["best_ms"] = times.front() * 1e-6;
+    r.metrics["median_ms"] = percentile(times, 0.5) * 1e-6;
+    r.metrics["evaluated_fraction"] = double(evaluated) / (double(size) * size);
+    return r;
+}
+
+// Measures the time to render a Julia set image in float with the
+// precision-sensitive pixels recomputed in Real, the fraction of the
+// pixels recomputed, and the fraction that differs from a full render in
+// Real.
+template <class Real>
+result julia_mixed_benchmark(const std::string& type_name, int size, int max_iters, int threads,
+                             int repetitions) {
+    ra::concurrency::thread_pool pool(threads);
+    boost::multi_array<int, 2> a(boost::extents[size][size]);
+    boost::multi_array<int, 2> b(boost::extents[size][size]);
+    std::complex<Real> bottom_left(-1.25, -1.25);
+    std::complex<Real> top_right(1.25, 1.25);
+    std::complex<Real> c(0.37, -0.16);
+
+    std::vector<double> times;
+    ra::fractal::mixed_precision_stats stats;
+    for (int k = 0; k < repetitions; ++k) {
+        auto start = clock_type::now();
+        stats = ra::fractal::compute_julia_set_mixed<Real>(bottom_left, top_right, c, max_iters, a, pool);
+        times.push_back(elapsed_ns(start));
+    }
+    std::sort(times.begin(), times.end());
+    ra::fractal::compute_julia_set<Real>(bottom_left, top_right, c, max_iters, b, pool);
+    std::uint64_t mismatches = 0;
+    for (int i = 0; i < size; ++i) {
+        for (int j = 0; j < size; ++j) {
+            mismatches += a[i][j] != b[i][j];
+        }
+    }
+
+    result r{"julia_set_mixed", {}, {}};
+    r.params["type"] = type_name;
+    r.params["size"] = std::to_string(size);
+    r.params["max_iters"] = std::to_string(max_iters);
+    r.params["threads"] = std::to_string(threads);
+    r.metrics["best_ms"] = times.front() * 1e-6;
+    r.metrics["median_ms"] = percentile(times, 0.5) * 1e-6;
+    r.metrics["recomputed_fraction"] = double(stats.recomputed) / (double(size) * size);
+    r.metrics["mismatch_fraction"] = double(mismatches) / (double(size) * size);
+    return r;
+}
+
+// Measures the time to re-render a view panned by 16 pixels with a
+// julia_tile_cache, compared with rendering the whole view again with
+// compute_julia_set, and the time to the first (coarsest) preview of a
+// progressive rendering of a new view.
+result julia_tile_cache_benchmark(int size, int max_iters, int threads, int repetitions) {
+    ra::concurrency::thread_pool pool(threads);
+    boost::multi_array<int, 2> a(boost::extents[size][size]);
+    std::complex<double> c(0.37, -0.16);
+    double spacing = 2.5 / size;
+    std::int64_t x = -size / 2;
+    std::int64_t y = -size / 2;
+
+    std::vector<double> pan_times;
+    std::vector<double> full_times;
+    std::vector<double> preview_times;
+    for (int k = 0; k < repetitions; ++k) {
+        ra::fractal::julia_tile_cache<double> cache(spacing);
+        cache.render(c, max_iters, 0, x, y, a, pool);
+        auto start = clock_type::now();
+        cache.render(c, max_iters, 0, x + 16, y, a, pool);
+        pan_times.push_back(elapsed_ns(start));
+
+        start = clock_type::now();
+        ra::fractal::compute_julia_set<double>(cache.point(0, x + 16, y), cache.point(0, x + 16 + size - 1, y + size - 1),
+                                               c, max_iters, a, pool);
+        full_times.push_back(elapsed_ns(start));
+
+        ra::fractal::julia_tile_cache<double> empty(spacing);
+        double preview = 0;
+        start = clock_type::now();
+        empty.render_progressive(c, max_iters, 0, x, y, a, pool, 3,
+                                 [&](const boost::multi_array<int, 2>&, int shift) {
+                                     if (shift == 3) {
+                                         preview = elapsed_ns(start);
+                                     }
+                                 });
+        preview_times.push_back(preview);
+    }
+    std::sort(pan_times.begin(), pan_times.end());
+    std::sort(full_times.begin(), full_times.end());
+    std::sort(preview_times.begin(), preview_times.end());
+
+    result r{"julia_tile_cache", {}, {}};
+    r.params["size"] = std::to_string(size);
+    r.params["max_iters"] = std::to_string(max_iters);
+    r.params["threads"] = std::to_string(threads);
+    r.metrics["pan_median_ms"] = percentile(pan_times, 0.5) * 1e-6;
+    r.metrics["full_median_ms"] = percentile(full_times, 0.5) * 1e-6;
+    r.metrics["preview_median_ms"] = percentile(preview_times, 0.5) * 1e-6;
+    return r;
+}
+
+// Measures the time to render a deep zoom (a view of the given width
+// around a point of the Julia set) directly in long double and with the
+// perturbation kernel.
+result julia_perturbed_benchmark(int size, long double view_width, int max_iters, int threads) {
+    using complex = std::complex<long double>;
+    ra::concurrency::thread_pool pool(threads);
+    boost::multi_array<int, 2> a(boost::extents[size][size]);
+    complex c(-0.8L, 0.156L);
+    // A point of the Julia set, found by inverse iteration.
+    complex center(1, 0);
+    for (int k = 0; k < 300; ++k) {
+        center = std::sqrt(center - c);
+        if (k % 3 == 0) {
+            center = -center;
+        }
+    }
+    complex bottom_left = center - complex(view_width / 2, view_width / 2);
+    complex top_right = center + complex(view_width / 2, view_width / 2);
+
+    auto start = clock_type::now();
+    ra::fractal::compute_julia_set<long double>(bottom_left, top_right, c, max_iters, a, pool);
+    double direct_ns = elapsed_ns(start);
+    start = clock_type::now();
+    ra::fractal::perturbation_stats stats =
+        ra::fractal::compute_julia_set_perturbed<long double>(bottom_left, top_right, c, max_iters, a, pool);
+    double perturbed_ns = elapsed_ns(start);
+
+    result r{"julia_set_perturbed", {}, {}};
+    r.params["size"] = std::to_string(size);
+    char width_text[32];
+    std::snprintf(width_text, sizeof(width_text), "%g", double(view_width));
+    r.params["view_width"] = width_text;
+    r.params["max_iters"] = std::to_string(max_iters);
+    r.params["threads"] = std::to_string(threads);
+    r.metrics["direct_ms"] = direct_ns * 1e-6;
+    r.metrics["perturbed_ms"] = perturbed_ns * 1e-6;
+    r.metrics["references"] = stats.references;
+    r.metrics["glitched_fraction"] = double(stats.glitched) / (double(size) * size);
+    return r;
+}
+
+// Measures the time to write an image file in the given format.
+result image_benchmark(ra::fractal::image_format format, int bit_depth, int size, int threads) {
+    ra::concurrency::thread_pool pool(threads);
+    boost::multi_array<int, 2> a(boost::extents[size][size]);
+    for (int i = 0; i < size; ++i) {
+        for (int j = 0; j < size; ++j) {
+            a[i][j] = (i ^ j) & 0xffff;
+        }
+    }
+    const std::string path = "benchmark_image.tmp";
+
+    auto start = clock_type::now();
+    ra::fractal::write_image(path, a, format, bit_depth, pool);
+    double total_ns = elapsed_ns(start);
+    std::remove(path.c_str());
+
+    result r{"image_file", {}, {}};
+    r.params["format"] = format == ra::fractal::image_format::pgm ? "pgm" : "png";
+    r.params["bit_depth"] = std::to_string(bit_depth);
+    r.params["size"] = std::to_string(size);
+    r.params["threads"] = std::to_string(threads);
+    r.metrics["ms"] = total_ns * 1e-6;
+    r.metrics["megapixels_per_second"] = double(size) * size / (total_ns * 1e-3);
+    return r;
+}
+
+// Escapes a string for use in JSON.
+std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+        }
+        out += ch;
+    }
+    return out + "\"";
+}
+
+void write_json(std::ostream& out, const std::vector<result>& results) {
+    out << "{\n  \"context\": {\"build_type\": " << json_string(RA_BUILD_TYPE)
+        << ", \"hardware_concurrency\": " << std::thread::hardware_concurrency() << "},\n";
+    out << "  \"benchmarks\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const result& r = results[i];
+        out << "    {\"name\": " << json_string(r.name) << ", \"params\": {";
+        bool first = true;
+        for (const auto& [key, value] : r.params) {
+            out << (first ? "" : ", ") << json_string(key) << ": " << json_string(value);
+            first = false;
+        }
+        out << "}, \"metrics\": {";
+        first = true;
+        for (const auto& [key, value] : r.metrics) {
+            out << (first ? "" : ", ") << json_string(key) << ": " << value;
+            first = false;
+        }
+        out << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    bool quick = false;
+    std::string output;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--quick] [--output FILE]\n";
+            return 1;
+        }
+    }
+
+    std::vector<result> results;
+    auto report = [&results](result r) {
+        std::cerr << r.name;
+        for (const auto& [key, value] : r.params) {
+            std::cerr << " " << key << "=" << value;
+        }
+        std::cerr << "\n";
+        results.push_back(std::move(r));
+    };
+
+    // Queues: SPSC, MPSC and MPMC.
+    int items = quick ? 20000 : 200000;
+    for (auto [producers, consumers] : {std::pair{1, 1}, std::pair{4, 1}, std::pair{4, 4}}) {
+        report(queue_benchmark<ra::concurrency::queue<std::int64_t>>("queue", producers, consumers, items));
+        report(queue_benchmark<ra::concurrency::mpmc_queue<std::int64_t>>("mpmc_queue", producers, consumers,
+                                                                          items));
+    }
+
+    // Thread pool: per-task overhead.
+    int tasks = quick ? 20000 : 200000;
+    for (bool work_stealing : {false, true}) {
+        for (bool tiny : {false, true}) {
+            for (bool from_inside : {false, true}) {
+                report(pool_benchmark(work_stealing, tiny, from_inside, tasks));
+            }
+        }
+    }
+
+    // Thread pool: wake-up latency.
+    int rounds = quick ? 2000 : 20000;
+    report(pool_wake_benchmark("park", ra::concurrency::wait_strategy::park(), rounds));
+    report(pool_wake_benchmark("spin_then_park", ra::concurrency::wait_strategy::spin_then_park(), rounds));
+
+    // Julia set: scaling with the image size, the number of iterations,
+    // the number of threads and the element type.
+    std::vector<int> sizes = quick ? std::vector<int>{256} : std::vector<int>{256, 512, 1024, 2048};
+    std::vector<int> iterations = quick ? std::vector<int>{255} : std::vector<int>{64, 255, 1024};
+    std::vector<int> thread_counts{1, 2, 4, 8};
+    int repetitions = quick ? 1 : 3;
+    for (int size : sizes) {
+        for (int max_iters : iterations) {
+            for (int threads : thread_counts) {
+                report(julia_benchmark<float>("float", size, max_iters, threads, repetitions));
+                report(julia_benchmark<double>("double", size, max_iters, threads, repetitions));
+                report(julia_benchmark<long double>("long double", size, max_iters, threads, repetitions));
+                report(julia_subdivided_benchmark(size, max_iters, threads, repetitions));
+                report(julia_mixed_benchmark<double>("double", size, max_iters, threads, repetitions));
+                report(julia_mixed_benchmark<long double>("long double", size, max_iters, threads, repetitions));
+                report(julia_tile_cache_benchmark(size, max_iters, threads, repetitions));
+            }
+        }
+    }
+
+    // Deep zooms.
+    for (long double view_width : {1e-4L, 1e-10L}) {
+        report(julia_perturbed_benchmark(quick ? 256 : 1024, view_width, 5000, 4));
+    }
+
+    // Image files.
+    int image_size = quick ? 1024 : 8192;
+    for (auto format : {ra::fractal::image_format::pgm, ra::fractal::image_format::png}) {
+        for (int bit_depth : {8, 16}) {
+            for (int threads : {1, 4}) {
+                report(image_benchmark(format, bit_depth, image_size, threads));
+            }
+        }
+    }
+
+    if (output.empty()) {
+        write_json(std::cout, results);
+    } else {
+        std::ofstream file(output);
+        write_json(file, results);
+    }
+    return 0;
+}
@@ -0,0 +1,759 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <stop_token>
+#include <ra/image_file.hpp>
+#include <ra/julia_animation.hpp>
+#include <ra/julia_set.hpp>
+#include <ra/julia_set_mixed.hpp>
+#include <ra/julia_set_perturbation.hpp>
+#include <ra/julia_tile_cache.hpp>
+#include <string>
+#include <vector>
+
+namespace {
+
+    std::vector<unsigned char> read_file(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::vector<unsigned char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    std::uint32_t get_u32(const unsigned char* p) {
+        return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+    }
+
+    // Decodes a grayscale PNG written by image_file (stored deflate blocks
+    // and no filtering), checking its structure and checksums.
+    // Returns the pixel values row by row.
+    std::vector<int> decode_png(const std::vector<unsigned char>& file, int height, int width, int bit_depth) {
+        namespace rfd = ra::fractal::detail;
+        const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        REQUIRE(file.size() > 8);
+        REQUIRE(std::equal(signature, signature + 8, file.begin()));
+
+        std::vector<unsigned char> zlib;
+        std::size_t pos = 8;
+        bool seen_iend = false;
+        while (pos + 12 <= file.size() && !seen_iend) {
+            std::uint32_t length = get_u32(&file[pos]);
+            REQUIRE(pos + 12 + length <= file.size());
+            std::string type(file.begin() + pos + 4, file.begin() + pos + 8);
+            CHECK(get_u32(&file[pos + 8 + length]) == rfd::crc32(&file[pos + 4], 4 + length));
+            if (type == "IHDR") {
+                CHECK(int(get_u32(&file[pos + 8])) == width);
+                CHECK(int(get_u32(&file[pos + 12])) == height);
+                CHECK(file[pos + 16] == bit_depth);
+            } else if (type == "IDAT") {
+                zlib.insert(zlib.end(), file.begin() + pos + 8, file.begin() + pos + 8 + length);
+            }
+            seen_iend = type == "IEND";
+            pos += 12 + length;
+        }
+        CHECK(seen_iend);
+        CHECK(pos == file.size());
+
+        std::vector<unsigned char> raw;
+        REQUIRE(zlib.size() >= 6);
+        std::size_t z = 2;
+        bool final_block = false;
+        while (!final_block) {
+            REQUIRE(z + 5 <= zlib.size());
+            final_block = zlib[z] & 1;
+            CHECK((zlib[z] >> 1) == 0);
+            std::size_t len = zlib[z + 1] | (zlib[z + 2] << 8);
+            std::size_t nlen = zlib[z + 3] | (zlib[z + 4] << 8);
+            CHECK(len == (~nlen & 0xffff));
+            raw.insert(raw.end(), zlib.begin() + z + 5, zlib.begin() + z + 5 + len);
+            z += 5 + len;
+        }
+        REQUIRE(z + 4 == zlib.size());
+        CHECK(get_u32(&zlib[z]) == rfd::adler32(raw.data(), raw.size()));
+
+        int bytes = bit_depth / 8;
+        REQUIRE(raw.size() == std::size_t(height) * (1 + width * bytes));
+        std::vector<int> pixels;
+        for (int i = 0; i < height; ++i) {
+            const unsigned char* row = &raw[i * (1 + width * bytes)];
+            CHECK(row[0] == 0);
+            for (int j = 0; j < width; ++j) {
+                pixels.push_back(bytes == 1 ? row[1 + j] : (row[1 + 2 * j] << 8) | row[2 + 2 * j]);
+            }
+        }
+        return pixels;
+    }
+
+}  // namespace
+
+TEMPLATE_TEST_CASE("vectorized kernels match the scalar kernel", "[ra::fractal]", float, double) {
+    namespace rf = ra::fractal;
+    using complex = std::complex<TestType>;
+
+    const int height = 37;
+    const int width = 103;
+    const int max_iters = 255;
+
+    struct view {
+        complex bottom_left;
+        complex top_right;
+        complex c;
+    };
+    std::vector<view> views{
+        {complex(-1.25, -1.25), complex(1.25, 1.25), complex(0.37, -0.16)},
+        {complex(-1.5, -1.0), complex(1.5, 1.0), complex(-0.8, 0.156)},
+        {complex(-0.1, 0.6), complex(0.05, 0.7), complex(-0.4, 0.6)},
+        {complex(-2, -2), complex(2, 2), complex(0.285, 0.01)},
+    };
+
+    std::vector<rf::simd_isa> isas{rf::simd_isa::scalar};
+    if (rf::detected_simd_isa() >= rf::simd_isa::avx2) {
+        isas.push_back(rf::simd_isa::avx2);
+    }
+    if (rf::detected_simd_isa() >= rf::simd_isa::avx512) {
+        isas.push_back(rf::simd_isa::avx512);
+    }
+
+    for (const auto& v : views) {
+        for (rf::simd_isa isa : isas) {
+            std::vector<int> row(width);
+            for (int x = 0; x < height; ++x) {
+                rf::julia_set_span<TestType>(v.bottom_left, v.top_right, v.c, max_iters, height, width, x, 0,
+                                             width, row.data(), isa);
+                for (int y = 0; y < width; ++y) {
+                    int expected = rf::julia_set_point<TestType>(v.bottom_left, v.top_right, v.c, max_iters,
+                                                                 height, width, x, y);
+                    if (row[y] != expected) {
+                        FAIL("isa " << int(isa) << ", pixel (" << x << ", " << y << "): " << row[y]
+                                    << " != " << expected);
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE("compute_julia_set matches julia_set_point", "[ra::fractal]", float, double, long double) {
+    namespace rf = ra::fractal;
+    using complex = std::complex<TestType>;
+
+    const int height = 64;
+    const int width = 48;
+    const int max_iters = 100;
+    complex bottom_left(-1.25, -1.25);
+    complex top_right(1.25, 1.25);
+    complex c(0.37, -0.16);
+
+    boost::multi_array<int, 2> a(boost::extents[height][width]);
+    rf::compute_julia_set<TestType>(bottom_left, top_right, c, max_iters, a, 3);
+
+    int mismatches = 0;
+    for (int i = 0; i < height; ++i) {
+        for (int j = 0; j < width; ++j) {
+            if (a[height - i - 1][j] !=
+                rf::julia_set_point<TestType>(bottom_left, top_right, c, max_iters, height, width, i, j)) {
+                ++mismatches;
+            }
+        }
+    }
+    CHECK(mismatches == 0);
+}
+
+TEST_CASE("compute_julia_set reuses a caller-supplied pool", "[ra::fractal]") {
+    namespace rf = ra::fractal;
+    namespace rc = ra::concurrency;
+    using complex = std::complex<double>;
+
+    const int max_iters = 200;
+    complex bottom_left(-1.5, -1.0);
+    complex top_right(1.5, 1.0);
+
+    rc::thread_pool pool(4);
+    for (int height : {1, 17, 300}) {
+        for (int width : {2, 33, 520}) {
+            complex c(-0.8, 0.156 + 0.001 * height);
+            boost::multi_array<int, 2> a(boost::extents[height][width]);
+            boost::multi_array<int, 2> b(boost::extents[height][width]);
+            rf::compute_julia_set<double>(bottom_left, top_right, c, max_iters, a, pool);
+            rf::compute_julia_set<double>(bottom_left, top_right, c, max_iters, b, 1);
+            CHECK(a == b);
+        }
+    }
+    CHECK(pool.is_shutdown() == false);
+}
+
+TEST_CASE("compute_julia_set can be stopped", "[ra::fractal]") {
+    namespace rf = ra::fractal;
+    namespace rc = ra::concurrency;
+    using complex = std::complex<double>;
+
+    const int max_iters = 200;
+    complex bottom_left(-1.5, -1.0);
+    complex top_right(1.5, 1.0);
+    complex c(-0.8, 0.156);
+    rc::thread_pool pool(4);
+    boost::multi_array<int, 2> a(boost::extents[300][520]);
+    boost::multi_array<int, 2> b(boost::extents[300][520]);
+
+    std::stop_source source;
+    CHECK(rf::compute_julia_set<double>(bottom_left, top_right, c, max_iters, a, pool, source.get_token()));
+    rf::compute_julia_set<double>(bottom_left, top_right, c, max_iters, b, pool);
+    CHECK(a == b);
+
+    // A stop requested midway leaves the remaining bands undone.
+    std::atomic<int> bands(0);
+    std::atomic<int> total_bands(0);
+    rf::compute_julia_set<double>(bottom_left, top_right, c, max_iters, a, pool,
+                                  [&](int, int) { ++total_bands; });
+    bool completed = rf::compute_julia_set<double>(
+        bottom_left, top_right, c, max_iters, a, pool,
+        [&](int, int) {
+            ++bands;
+            source.request_stop();
+        },
+        source.get_token());
+    CHECK_FALSE(completed);
+    CHECK(bands >= 1);
+    CHECK(bands < total_bands);
+
+    // Nothing is computed with a token that is already stopped.
+    bands = 0;
+    CHECK_FALSE(rf::compute_julia_set<double>(bottom_left, top_right, c, max_iters, a, pool,
+                                              [&](int, int) { ++bands; }, source.get_token()));
+    CHECK(bands == 0);
+    CHECK_FALSE(rf::compute_julia_set<double>(bottom_left, top_right, c, max_iters, a, pool, source.get_token()));
+}
+
+TEST_CASE("compute_julia_set_subdivided skips uniform regions", "[ra::fractal]") {
+    namespace rf = ra::fractal;
+    namespace rc = ra::concurrency;
+    using complex = std::complex<double>;
+
+    const int max_iters = 255;
+    rc::thread_pool pool(4);
+
+    SECTION("small images are computed exactly") {
+        for (int height : {1, 2, 3, 17}) {
+            for (int width : {1, 2, 5, 40}) {
+                boost::multi_array<int, 2> a(boost::extents[height][width]);
+                boost::multi_array<int, 2> b(boost::extents[height][width]);
+                complex bottom_left(-1.5, -1.0);
+                complex top_right(1.5, 1.0);
+                complex c(-0.8, 0.156);
+                std::uint64_t evaluated =
+                    rf::compute_julia_set_subdivided<double>(bottom_left, top_right, c, max_iters, a, pool);
+                rf::compute_julia_set<double>(bottom_left, top_right, c, max_iters, b, pool);
+                CHECK(a == b);
+                CHECK(evaluated <= std::uint64_t(height) * width);
+            }
+        }
+    }
+
+    SECTION("large images evaluate fewer pixels") {
+        struct view {
+            complex bottom_left;
+            complex top_right;
+            complex c;
+        };
+        // The last view shows the whole set surrounded by uniform bands,
+        // which must not be mistaken for a uniform image.
+        std::vector<view> views{
+            {complex(-1.25, -1.25), complex(1.25, 1.25), complex(0.37, -0.16)},
+            {complex(-1.5, -1.0), complex(1.5, 1.0), complex(-0.8, 0.156)},
+            {complex(-2, -2), complex(2, 2), complex(0.285, 0.01)},
+        };
+        const int size = 512;
+        for (const auto& v : views) {
+            boost::multi_array<int, 2> a(boost::extents[size][size]);
+            boost::multi_array<int, 2> b(boost::extents[size][size]);
+            std::uint64_t evaluated =
+                rf::compute_julia_set_subdivided<double>(v.bottom_left, v.top_right, v.c, max_iters, a, pool);
+            rf::compute_julia_set<double>(v.bottom_left, v.top_right, v.c, max_iters, b, pool);
+
+            int mismatches = 0;
+            for (int i = 0; i < size; ++i) {
+                for (int j = 0; j < size; ++j) {
+                    mismatches += a[i][j] != b[i][j];
+                }
+            }
+            CHECK(evaluated < std::uint64_t(size) * size * 3 / 4);
+            // Thin filaments that cross no border may be missed.
+            CHECK(mismatches <= size * size / 1000);
+        }
+    }
+}
+
+TEST_CASE("image files", "[ra::fractal]") {
+    namespace rf = ra::fractal;
+    namespace rc = ra::concurrency;
+    using complex = std::complex<double>;
+
+    rc::thread_pool pool(3);
+    const std::string path = "test_fractal_image.tmp";
+
+    for (int bit_depth : {8, 16}) {
+        // Rows wider than a stored deflate block (65535 bytes) must be
+        // split into several blocks.
+        for (auto [height, width] : {std::pair{1, 1}, std::pair{37, 53}, std::pair{3, 40000}}) {
+            boost::multi_array<int, 2> a(boost::extents[height][width]);
+            for (int i = 0; i < height; ++i) {
+                for (int j = 0; j < width; ++j) {
+                    a[i][j] = (i * 7919 + j * 104729) % 70000 - 100;
+                }
+            }
+            int max = bit_depth == 8 ? 255 : 65535;
+            std::vector<int> expected;
+            for (int i = 0; i < height; ++i) {
+                for (int j = 0; j < width; ++j) {
+                    expected.push_back(std::clamp(a[i][j], 0, max));
+                }
+            }
+
+            rf::write_image(path, a, rf::image_format::pgm, bit_depth, pool);
+            std::vector<unsigned char> file = read_file(path);
+            std::string header =
+                "P5\n" + std::to_string(width) + " " + std::to_string(height) + "\n" + std::to_string(max) + "\n";
+            REQUIRE(file.size() == header.size() + expected.size() * (bit_depth / 8));
+            CHECK(std::equal(header.begin(), header.end(), file.begin()));
+            std::vector<int> pixels;
+            for (std::size_t k = 0; k < expected.size(); ++k) {
+                const unsigned char* p = &file[header.size() + k * (bit_depth / 8)];
+                pixels.push_back(bit_depth == 8 ? p[0] : (p[0] << 8) | p[1]);
+            }
+            CHECK(pixels == expected);
+
+            rf::write_image(path, a, rf::image_format::png, bit_depth, pool);
+            CHECK(decode_png(read_file(path), height, width, bit_depth) == expected);
+        }
+    }
+
+    SECTION("rows are streamed while the image is computed") {
+        const int height = 300;
+        const int width = 200;
+        complex bottom_left(-1.5, -1.0);
+        complex top_right(1.5, 1.0);
+        complex c(-0.8, 0.156);
+        boost::multi_array<int, 2> a(boost::extents[height][width]);
+
+        std::vector<char> done(height, 0);
+        {
+            rf::image_file file(path, height, width, rf::image_format::png);
+            rf::compute_julia_set<double>(bottom_left, top_right, c, 255, a, pool,
+                                          [&](int row_begin, int row_end) {
+                                              file.write_rows(a, row_begin, row_end);
+                                              std::fill(done.begin() + row_begin, done.begin() + row_end, 1);
+                                          });
+            file.finish();
+        }
+        CHECK(std::count(done.begin(), done.end(), 1) == height);
+        std::vector<unsigned char> streamed = read_file(path);
+
+        rf::write_image(path, a, rf::image_format::png, 8, pool);
+        CHECK(streamed == read_file(path));
+    }
+
+    std::remove(path.c_str());
+}
+
+TEMPLATE_TEST_CASE("render_julia_set writes tiles into a file", "[ra::fractal]", float, double) {
+    namespace rf = ra::fractal;
+    namespace rc = ra::concurrency;
+    using complex = std::complex<TestType>;
+
+    const int max_iters = 300;
+    complex bottom_left(-1.5, -1.0);
+    complex top_right(1.5, 1.0);
+    complex c(-0.8, 0.156);
+    rc::thread_pool pool(4);
+    const std::string path = "test_fractal_tiles.tmp";
+    const std::string expected_path = "test_fractal_expected.tmp";
+
+    for (auto format : {rf::image_format::pgm, rf::image_format::png}) {
+        for (auto [height, width] : {std::pair{1, 1}, std::pair{100, 37}, std::pair{600, 700}}) {
+            {
+                rf::image_file file(path, height, width, format, 16);
+                rf::render_julia_set<TestType>(bottom_left, top_right, c, max_iters, file, pool);
+            }
+            boost::multi_array<int, 2> a(boost::extents[height][width]);
+            rf::compute_julia_set<TestType>(bottom_left, top_right, c, max_iters, a, pool);
+            rf::write_image(expected_path, a, format, 16, pool);
+            CHECK(read_file(path) == read_file(expected_path));
+        }
+    }
+    std::remove(path.c_str());
+    std::remove(expected_path.c_str());
+}
+
+namespace {
+
+    // Returns a point of the Julia set for c, found by inverse iteration.
+    template <class T>
+    std::complex<T> julia_set_boundary_point(const std::complex<T>& c) {
+        std::complex<T> z(1, 0);
+        for (int k = 0; k < 300; ++k) {
+            z = std::sqrt(z - c);
+            if (k % 3 == 0) {
+                z = -z;
+            }
+        }
+        return z;
+    }
+
+    // Returns the number of pixels of a that differ from
+    // julia_set_point<T>.
+    template <class T>
+    int count_mismatches(const boost::multi_array<int, 2>& a, const std::complex<T>& bottom_left,
+                         const std::complex<T>& top_right, const std::complex<T>& c, int max_iters) {
+        int height = a.shape()[0];
+        int width = a.shape()[1];
+        int mismatches = 0;
+        for (int i = 0; i < height; ++i) {
+            for (int j = 0; j < width; ++j) {
+                mismatches += a[height - i - 1][j] !=
+                              ra::fractal::julia_set_point<T>(bottom_left, top_right, c, max_iters, height, width,
+                                                              i, j);
+            }
+        }
+        return mismatches;
+    }
+
+}  // namespace
+
+TEMPLATE_TEST_CASE("compute_julia_set_mixed recomputes precision-sensitive pixels", "[ra::fractal]", double,
+                   long double) {
+    namespace rf = ra::fractal;
+    namespace rc = ra::concurrency;
+    using complex = std::complex<TestType>;
+
+    const int max_iters = 255;
+    rc::thread_pool pool(4);
+
+    SECTION("the image matches a full render within the tolerance") {
+        struct view {
+            complex bottom_left;
+            complex top_right;
+            complex c;
+        };
+        std::vector<view> views{
+            {complex(-1.25, -1.25), complex(1.25, 1.25), complex(0.37, -0.16)},
+            {complex(-1.5, -1.0), complex(1.5, 1.0), complex(-0.8, 0.156)},
+            {complex(-0.1, -0.1), complex(0.1, 0.1), complex(-0.8, 0.156)},
+        };
+        const int size = 384;
+        for (const auto& v : views) {
+            boost::multi_array<int, 2> a(boost::extents[size][size]);
+            boost::multi_array<int, 2> b(boost::extents[size][size]);
+            rf::mixed_precision_stats stats =
+                rf::compute_julia_set_mixed<TestType>(v.bottom_left, v.top_right, v.c, max_iters, a, pool);
+            rf::compute_julia_set<TestType>(v.bottom_left, v.top_right, v.c, max_iters, b, pool);
+
+            int mismatches = 0;
+            for (int i = 0; i < size; ++i) {
+                for (int j = 0; j < size; ++j) {
+                    mismatches += a[i][j] != b[i][j];
+                }
+            }
+            CHECK_FALSE(stats.fallback);
+            CHECK(stats.recomputed < std::uint64_t(size) * size);
+            CHECK(mismatches <= size * size / 10000);
+        }
+    }
+
+    SECTION("views too fine for float are rendered in high precision") {
+        const int size = 64;
+        complex center(0.1, 0.2);
+        complex half(1e-7, 1e-7);
+        boost::multi_array<int, 2> a(boost::extents[size][size]);
+        boost::multi_array<int, 2> b(boost::extents[size][size]);
+        complex c(-0.8, 0.156);
+        rf::mixed_precision_stats stats =
+            rf::compute_julia_set_mixed<TestType>(center - half, center + half, c, max_iters, a, pool);
+        rf::compute_julia_set<TestType>(center - half, center + half, c, max_iters, b, pool);
+        CHECK(stats.fallback);
+        CHECK(stats.recomputed == std::uint64_t(size) * size);
+        CHECK(a == b);
+    }
+
+    SECTION("tiny images") {
+        for (int height : {1, 2, 3}) {
+            for (int width : {1, 2, 7}) {
+                boost::multi_array<int, 2> a(boost::extents[height][width]);
+                rf::compute_julia_set_mixed<TestType>(complex(-1.5, -1.0), complex(1.5, 1.0), complex(-0.8, 0.156),
+                                                      max_iters, a, pool);
+                for (int i = 0; i < height; ++i) {
+                    for (int j = 0; j < width; ++j) {
+                        CHECK(a[i][j] >= 0);
+                        CHECK(a[i][j] <= max_iters);
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("compute_julia_set_perturbed renders deep zooms", "[ra::fractal]") {
+    namespace rf = ra::fractal;
+    namespace rc = ra::concurrency;
+
+    rc::thread_pool pool(3);
+    const int size = 64;
+    const int max_iters = 2000;
+    boost::multi_array<int, 2> a(boost::extents[size][size]);
+
+    // The results may differ from a direct computation where the orbits
+    // are chaotic, so a few mismatches are allowed.
+    const int allowed = size * size / 100;
+
+    SECTION("long double references") {
+        using complex = std::complex<long double>;
+        complex c(-0.8, 0.156);
+        complex center = julia_set_boundary_point(c);
+        for (long double w : {3.0L, 1e-4L, 1e-8L}) {
+            complex bottom_left = center - complex(w / 2, w / 2);
+            complex top_right = center + complex(w / 2, w / 2);
+            rf::perturbation_stats stats =
+                rf::compute_julia_set_perturbed<long double>(bottom_left, top_right, c, max_iters, a, pool);
+            CHECK(stats.references >= 1);
+            CHECK(stats.fallback <= stats.glitched);
+            CHECK(count_mismatches(a, bottom_left, top_right, c, max_iters) <= allowed);
+        }
+    }
+
+#ifdef __SIZEOF_FLOAT128__
+    SECTION("__float128 references beyond the precision of long double") {
+        using complex = std::complex<__float128>;
+        complex c(-0.8, 0.156);
+        std::complex<long double> center_ld = julia_set_boundary_point(std::complex<long double>(-0.8L, 0.156L));
+        complex center(center_ld.real(), center_ld.imag());
+        __float128 w = 1e-20;
+        complex bottom_left(center.real() - w / 2, center.imag() - w / 2);
+        complex top_right(center.real() + w / 2, center.imag() + w / 2);
+        rf::compute_julia_set_perturbed<__float128>(bottom_left, top_right, c, max_iters, a, pool);
+        CHECK(count_mismatches(a, bottom_left, top_right, c, max_iters) <= allowed);
+    }
+#endif
+
+    SECTION("pixels still glitched after the last reference are computed directly") {
+        using complex = std::complex<double>;
+        complex bottom_left(-1.5, -1.0);
+        complex top_right(1.5, 1.0);
+        complex c(-0.8, 0.156);
+        rf::perturbation_stats stats =
+            rf::compute_julia_set_perturbed<double>(bottom_left, top_right, c, max_iters, a, pool, 1);
+        CHECK(stats.references == 1);
+        CHECK(stats.fallback == stats.glitched);
+        CHECK(count_mismatches(a, bottom_left, top_right, c, max_iters) <= allowed);
+    }
+}
+
+TEST_CASE("render_animation pipelines frames", "[ra::fractal]") {
+    namespace rf = ra::fractal;
+    namespace rc = ra::concurrency;
+    using complex = std::complex<double>;
+
+    const int height = 48;
+    const int width = 64;
+    const int max_iters = 100;
+    complex bottom_left(-1.5, -1.0);
+    complex top_right(1.5, 1.0);
+    std::vector<complex> cs;
+    for (int k = 0; k < 12; ++k) {
+        cs.emplace_back(-0.8 + 0.01 * k, 0.156);
+    }
+    rc::thread_pool pool(3);
+
+    SECTION("frames are post-processed and written in order") {
+        for (int frames_in_flight : {1, 3}) {
+            std::vector<int> written;
+            std::vector<const void*> buffers;
+            int wrong_pixels = 0;
+            rf::render_animation<double>(
+                bottom_left, top_right, cs, max_iters, height, width, pool, frames_in_flight,
+                [](rf::animation_frame<double>& frame) { frame.pixels = frame.iterations; },
+                [&](rf::animation_frame<double>& frame) {
+                    // The write stage handles one frame at a time.
+                    written.push_back(frame.index);
+                    if (std::find(buffers.begin(), buffers.end(), frame.pixels.data()) == buffers.end()) {
+                        buffers.push_back(frame.pixels.data());
+                    }
+                    boost::multi_array<int, 2> expected(boost::extents[height][width]);
+                    rf::compute_julia_set<double>(bottom_left, top_right, frame.c, max_iters, expected, 1);
+                    wrong_pixels += frame.pixels != expected;
+                });
+            std::vector<int> expected_order(cs.size());
+            for (std::size_t k = 0; k < cs.size(); ++k) {
+                expected_order[k] = k;
+            }
+            CHECK(written == expected_order);
+            CHECK(wrong_pixels == 0);
+            // The frame buffers are reused.
+            CHECK(buffers.size() <= std::size_t(frames_in_flight));
+        }
+    }
+
+    SECTION("exceptions stop the pipeline") {
+        std::atomic<int> written(0);
+        CHECK_THROWS_AS(rf::render_animation<double>(
+                            bottom_left, top_right, cs, max_iters, height, width, pool, 2,
+                            [](rf::animation_frame<double>&) {},
+                            [&](rf::animation_frame<double>& frame) {
+                                if (frame.index == 3) {
+                                    throw std::runtime_error("write failed");
+                                }
+                                ++written;
+                            }),
+                        std::runtime_error);
+        CHECK(written == 3);
+        CHECK(pool.is_shutdown() == false);
+    }
+
+    SECTION("frames are written to files") {
+        const std::string prefix = "test_fractal_frame_";
+        std::vector<complex> three(cs.begin(), cs.begin() + 3);
+        rf::render_animation_to_files<double>(bottom_left, top_right, three, max_iters, height, width, pool, 2,
+                                              prefix, rf::image_format::pgm);
+        for (const char* name : {"00000", "00001", "00002"}) {
+            std::string path = prefix + name + ".pgm";
+            std::vector<unsigned char> file = read_file(path);
+            CHECK(file.size() == std::string("P5\n64 48\n255\n").size() + height * width);
+            std::remove(path.c_str());
+        }
+    }
+}
+
+TEST_CASE("julia_tile_cache renders views from cached tiles", "[ra::fractal]") {
+    namespace rf = ra::fractal;
+    namespace rc = ra::concurrency;
+    using complex = std::complex<double>;
+
+    const int max_iters = 255;
+    const complex c(-0.8, 0.156);
+    const int height = 150;
+    const int width = 200;
+    rc::thread_pool pool(4);
+    // 1/128 per pixel at zoom level 0, in tiles of 32 x 32 pixels.
+    rf::julia_tile_cache<double> cache(1.0 / 128, 32);
+
+    // Renders the view of zoom level zoom whose bottom-left pixel is
+    // (x, y) directly.
+    auto reference = [&](int zoom, std::int64_t x, std::int64_t y) {
+        boost::multi_array<int, 2> b(boost::extents[height][width]);
+        rf::compute_julia_set<double>(cache.point(zoom, x, y), cache.point(zoom, x + width - 1, y + height - 1), c,
+                                      max_iters, b, pool);
+        return b;
+    };
+    auto mismatches = [](const boost::multi_array<int, 2>& a, const boost::multi_array<int, 2>& b) {
+        int count = 0;
+        for (std::size_t i = 0; i < a.shape()[0]; ++i) {
+            for (std::size_t j = 0; j < a.shape()[1]; ++j) {
+                count += a[i][j] != b[i][j];
+            }
+        }
+        return count;
+    };
+
+    SECTION("views match a direct render, and pans only compute exposed tiles") {
+        boost::multi_array<int, 2> a(boost::extents[height][width]);
+        rf::tile_render_stats stats = cache.render(c, max_iters, 1, -96, -64, a, pool);
+        CHECK(stats.complete);
+        CHECK(stats.tiles_hit == 0);
+        // Columns [-96, 104) and rows [-64, 86) span 7 x 5 tiles.
+        CHECK(stats.tiles_computed == 35);
+        CHECK(mismatches(a, reference(1, -96, -64)) <= height * width / 1000);
+
+        // Rendering the same view again takes all tiles from the cache.
+        boost::multi_array<int, 2> b(boost::extents[height][width]);
+        stats = cache.render(c, max_iters, 1, -96, -64, b, pool);
+        CHECK(stats.tiles_computed == 0);
+        CHECK(stats.tiles_hit == 35);
+        CHECK(a == b);
+
+        // Panning right by a tile exposes one column of tiles, and the
+        // overlap is identical.
+        stats = cache.render(c, max_iters, 1, -64, -64, b, pool);
+        CHECK(stats.tiles_computed == 5);
+        CHECK(stats.tiles_hit == 30);
+        int overlap_mismatches = 0;
+        for (int i = 0; i < height; ++i) {
+            for (int j = 0; j < width - 32; ++j) {
+                overlap_mismatches += b[i][j] != a[i][j + 32];
+            }
+        }
+        CHECK(overlap_mismatches == 0);
+
+        // Another constant or iteration limit does not share tiles.
+        stats = cache.render(c, 100, 1, -96, -64, b, pool);
+        CHECK(stats.tiles_computed == 35);
+        stats = cache.render(complex(0.285, 0.01), max_iters, 1, -96, -64, b, pool);
+        CHECK(stats.tiles_computed == 35);
+    }
+
+    SECTION("the least recently used tiles are evicted beyond the budget") {
+        rf::julia_tile_cache<double> small(1.0 / 128, 32, 40 * 32 * 32 * sizeof(int));
+        CHECK(small.capacity() == 40);
+        boost::multi_array<int, 2> a(boost::extents[height][width]);
+        small.render(c, max_iters, 1, -96, -64, a, pool);
+        CHECK(small.size() == 35);
+        // The first pan fills the cache; the second evicts the 5 least
+        // recently used tiles.
+        small.render(c, max_iters, 1, -64, -64, a, pool);
+        CHECK(small.size() == 40);
+        small.render(c, max_iters, 1, -32, -64, a, pool);
+        CHECK(small.size() == 40);
+        // The first column of tiles of the first view was evicted.
+        rf::tile_render_stats stats = small.render(c, max_iters, 1, -96, -64, a, pool);
+        CHECK(stats.tiles_computed == 5);
+        CHECK(mismatches(a, reference(1, -96, -64)) <= height * width / 1000);
+        small.clear();
+        CHECK(small.size() == 0);
+    }
+
+    SECTION("progressive rendering refines from coarse to fine") {
+        boost::multi_array<int, 2> a(boost::extents[height][width]);
+        std::vector<int> shifts;
+        rf::tile_render_stats stats =
+            cache.render_progressive(c, max_iters, 3, -96, -64, a, pool, 3,
+                                     [&](const boost::multi_array<int, 2>& frame, int shift) {
+                                         shifts.push_back(shift);
+                                         // Each pixel of the level fills a block of the frame.
+                                         int block = 1 << shift;
+                                         CHECK(frame[height - 1][0] == frame[height - block][block - 1]);
+                                     });
+        CHECK(stats.complete);
+        CHECK(shifts == std::vector<int>{3, 2, 1, 0});
+
+        boost::multi_array<int, 2> b(boost::extents[height][width]);
+        cache.render(c, max_iters, 3, -96, -64, b, pool);
+        CHECK(a == b);
+
+        // The levels of a cached view are skipped.
+        shifts.clear();
+        stats = cache.render_progressive(c, max_iters, 3, -96, -64, a, pool, 3,
+                                         [&](const boost::multi_array<int, 2>&, int shift) { shifts.push_back(shift); });
+        CHECK(shifts == std::vector<int>{0});
+        CHECK(stats.tiles_computed == 0);
+    }
+
+    SECTION("a stop skips the remaining tiles") {
+        std::stop_source source;
+        source.request_stop();
+        boost::multi_array<int, 2> a(boost::extents[height][width]);
+        rf::tile_render_stats stats = cache.render(c, max_iters, 1, -96, -64, a, pool, source.get_token());
+        CHECK_FALSE(stats.complete);
+        CHECK(stats.tiles_computed == 0);
+        CHECK(cache.size() == 0);
+
+        int frames = 0;
+        stats = cache.render_progressive(
+            c, max_iters, 1, -96, -64, a, pool, 2, [&](const boost::multi_array<int, 2>&, int) { ++frames; },
+            source.get_token());
+        CHECK_FALSE(stats.complete);
+        CHECK(frames == 0);
+    }
+
+    SECTION("invalid grids are rejected") {
+        CHECK_THROWS_AS(rf::julia_tile_cache<double>(0.0), std::invalid_argument);
+        CHECK_THROWS_AS(rf::julia_tile_cache<double>(1.0, 1), std::invalid_argument);
+    }
+}
@@ -1,9 +1,21 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <ra/mpmc_queue.hpp>
 #include <ra/queue.hpp>
+#include <ra/spin_wait.hpp>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
+// Counts allocations, to check that queue operations do not allocate.
+#include "allocation_counter.hpp"
+
 TEMPLATE_TEST_CASE("single thread basic functionality", "[ra::concurrency::queue]", int, double) {
     namespace ra = ra::concurrency;
     using queue_type = ra::queue<TestType>;
@@ -138,4 +150,419 @@ TEMPLATE_TEST_CASE("multi thread basic functionality", "[ra::concurrency::queue]
         CHECK(q.is_full() == false);
         CHECK(q.is_closed() == true);
     }
-}
\ No newline at end of file
+}
+
+TEMPLATE_TEST_CASE("lock-free queue single thread basic functionality", "[ra::concurrency::mpmc_queue]", int, double) {
+    namespace ra = ra::concurrency;
+    using queue_type = ra::mpmc_queue<TestType>;
+
+    queue_type q(10);
+
+    CHECK(q.is_empty());
+    CHECK(q.max_size() == 10);
+
+    for (int i = 1; i <= 10; ++i) {
+        CHECK(q.push(TestType(i)) == queue_type::status::success);
+    }
+
+    SECTION("full") {
+        CHECK(q.is_full() == true);
+    }
+
+    SECTION("closed") {
+        q.close();
+        CHECK(q.is_closed() == true);
+        CHECK(q.push(TestType(11)) == queue_type::status::closed);
+
+        typename queue_type::value_type x;
+        CHECK(q.pop(x) == queue_type::status::success);
+        CHECK(x == TestType(1));
+    }
+
+    SECTION("pop in order") {
+        for (int i = 1; i <= 10; ++i) {
+            typename queue_type::value_type x;
+            CHECK(q.pop(x) == queue_type::status::success);
+            CHECK(x == TestType(i));
+        }
+        CHECK(q.is_empty() == true);
+    }
+
+    SECTION("clear") {
+        q.clear();
+        CHECK(q.is_empty() == true);
+
+        q.close();
+        typename queue_type::value_type x;
+        CHECK(q.pop(x) == queue_type::status::closed);
+    }
+}
+
+TEST_CASE("lock-free queue with a single slot", "[ra::concurrency::mpmc_queue]") {
+    namespace ra = ra::concurrency;
+    using queue_type = ra::mpmc_queue<int>;
+
+    queue_type q(1);
+    int x = 0;
+    for (int i = 0; i < 5; ++i) {
+        CHECK(q.push(int(i)) == queue_type::status::success);
+        CHECK(q.is_full() == true);
+        CHECK(q.pop(x) == queue_type::status::success);
+        CHECK(x == i);
+    }
+}
+
+TEST_CASE("lock-free queue multiple producers and consumers", "[ra::concurrency::mpmc_queue]") {
+    namespace ra = ra::concurrency;
+    using queue_type = ra::mpmc_queue<int>;
+
+    queue_type q(4);
+    std::atomic<long> sum(0);
+    std::vector<std::thread> consumers;
+    for (int i = 0; i < 4; ++i) {
+        consumers.push_back(std::thread([&q, &sum]() {
+            int x;
+            while (q.pop(x) == queue_type::status::success) {
+                sum += x;
+            }
+        }));
+    }
+
+    std::atomic<int> failures(0);
+    std::vector<std::thread> producers;
+    for (int i = 0; i < 4; ++i) {
+        producers.push_back(std::thread([&q, &failures]() {
+            for (int j = 1; j <= 1000; ++j) {
+                if (q.push(int(j)) != queue_type::status::success) {
+                    ++failures;
+                }
+            }
+        }));
+    }
+
+    for (auto& t : producers) {
+        t.join();
+    }
+    q.close();
+    for (auto& t : consumers) {
+        t.join();
+    }
+
+    CHECK(failures == 0);
+    CHECK(sum == 4 * 1000 * 1001 / 2);
+    CHECK(q.is_empty() == true);
+}
+
+TEMPLATE_TEST_CASE("bulk operations", "[bulk]", ra::concurrency::queue<int>, ra::concurrency::mpmc_queue<int>) {
+    using queue_type = TestType;
+
+    queue_type q(8);
+    std::vector<int> values{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+    SECTION("non-blocking") {
+        CHECK(q.try_push_range(values.begin(), values.end()) == 8);
+        CHECK(q.is_full() == true);
+        CHECK(q.try_push_range(values.begin() + 8, values.end()) == 0);
+
+        std::vector<int> out;
+        CHECK(q.try_pop_bulk(std::back_inserter(out), 5) == 5);
+        CHECK(out == std::vector<int>{1, 2, 3, 4, 5});
+        CHECK(q.try_pop_bulk(std::back_inserter(out), 5) == 3);
+        CHECK(q.try_pop_bulk(std::back_inserter(out), 5) == 0);
+        CHECK(q.is_empty() == true);
+    }
+
+    SECTION("blocking") {
+        std::vector<int> out;
+        std::thread consumer([&q, &out]() {
+            while (q.pop_bulk(std::back_inserter(out), 3) > 0) {
+            }
+        });
+
+        CHECK(q.push_range(values.begin(), values.end()) == values.size());
+        CHECK(q.push_range(values.begin(), values.end()) == values.size());
+        q.close();
+        consumer.join();
+
+        CHECK(out.size() == 2 * values.size());
+        CHECK(std::equal(values.begin(), values.end(), out.begin()));
+        CHECK(std::equal(values.begin(), values.end(), out.begin() + values.size()));
+    }
+
+    SECTION("closed") {
+        q.close();
+        CHECK(q.push_range(values.begin(), values.end()) == 0);
+        std::vector<int> out;
+        CHECK(q.pop_bulk(std::back_inserter(out), 3) == 0);
+    }
+}
+
+TEST_CASE("blocking bulk pop of values that are not default constructible", "[ra::concurrency::mpmc_queue]") {
+    struct value {
+        explicit value(int x) : x(x) {}
+        int x;
+    };
+    static_assert(!std::is_default_constructible_v<value>);
+
+    ra::concurrency::mpmc_queue<value> q(4);
+    std::vector<value> out;
+    std::thread consumer([&q, &out]() {
+        while (q.pop_bulk(std::back_inserter(out), 3) > 0) {
+        }
+    });
+
+    for (int i = 0; i < 100; ++i) {
+        CHECK(q.push(value(i)) == ra::concurrency::mpmc_queue<value>::status::success);
+    }
+    q.close();
+    consumer.join();
+
+    REQUIRE(out.size() == 100);
+    for (int i = 0; i < 100; ++i) {
+        CHECK(out[i].x == i);
+    }
+}
+
+TEMPLATE_TEST_CASE("non-blocking and timed operations", "[try]", ra::concurrency::queue<int>,
+                   ra::concurrency::mpmc_queue<int>) {
+    using queue_type = TestType;
+    using namespace std::chrono_literals;
+
+    queue_type q(2);
+    int x = 0;
+
+    CHECK(q.try_pop(x) == queue_type::status::empty);
+    CHECK(q.try_pop_for(x, 10ms) == queue_type::status::empty);
+
+    CHECK(q.try_push(1) == queue_type::status::success);
+    CHECK(q.try_push(2) == queue_type::status::success);
+    CHECK(q.try_push(3) == queue_type::status::full);
+    CHECK(q.try_push_for(3, 10ms) == queue_type::status::full);
+
+    SECTION("a value that is not inserted is not moved from") {
+        auto value = std::make_unique<int>(3);
+        std::conditional_t<std::is_same_v<queue_type, ra::concurrency::queue<int>>,
+                           ra::concurrency::queue<std::unique_ptr<int>>,
+                           ra::concurrency::mpmc_queue<std::unique_ptr<int>>>
+            pq(1);
+        CHECK(pq.try_push(std::make_unique<int>(1)) == decltype(pq)::status::success);
+        CHECK(pq.try_push(std::move(value)) == decltype(pq)::status::full);
+        CHECK(value != nullptr);
+    }
+
+    SECTION("timed push succeeds once a slot is freed") {
+        std::thread consumer([&q]() {
+            std::this_thread::sleep_for(20ms);
+            int y;
+            q.pop(y);
+        });
+        CHECK(q.try_push_until(3, std::chrono::steady_clock::now() + 10s) == queue_type::status::success);
+        consumer.join();
+    }
+
+    SECTION("pop") {
+        CHECK(q.try_pop(x) == queue_type::status::success);
+        CHECK(x == 1);
+        CHECK(q.try_pop_until(x, std::chrono::steady_clock::now() + 10ms) == queue_type::status::success);
+        CHECK(x == 2);
+        q.close();
+        CHECK(q.try_pop(x) == queue_type::status::closed);
+        CHECK(q.try_push(4) == queue_type::status::closed);
+    }
+}
+
+TEST_CASE("queue statistics", "[ra::concurrency::queue]") {
+    using namespace std::chrono_literals;
+    ra::concurrency::queue<int> q(2);
+    q.push(1);
+    q.push(2);
+
+    // The producer blocks until the queue has room.
+    std::thread producer([&q]() { q.push(3); });
+    if (RA_STATS) {
+        while (q.stats().blocked_pushes == 0) {
+            std::this_thread::sleep_for(1ms);
+        }
+    }
+    int x;
+    q.pop(x);
+    producer.join();
+    q.pop(x);
+    q.pop(x);
+    CHECK(q.try_pop_for(x, 1ms) == ra::concurrency::queue<int>::status::empty);
+
+    ra::concurrency::queue_stats stats = q.stats();
+    if (RA_STATS) {
+        CHECK(stats.blocked_pushes == 1);
+        CHECK(stats.blocked_pops == 1);
+        CHECK(stats.high_water == 2);
+    } else {
+        CHECK(stats.blocked_pushes == 0);
+        CHECK(stats.blocked_pops == 0);
+        CHECK(stats.contended_locks == 0);
+        CHECK(stats.high_water == 0);
+    }
+}
+
+TEST_CASE("spin-then-park waits", "[ra::concurrency::queue]") {
+    namespace rc = ra::concurrency;
+
+    SECTION("the spin budget adapts to the waits") {
+        rc::spin_waiter waiter(rc::wait_strategy::spin_then_park(1024, 0));
+        CHECK(waiter.enabled());
+        CHECK(waiter.budget() == 1024);
+
+        // Waits that end up parking halve the budget, down to a floor.
+        CHECK_FALSE(waiter.spin([]() { return false; }));
+        CHECK(waiter.budget() == 512);
+        for (int i = 0; i < 14; ++i) {
+            waiter.spin([]() { return false; });
+        }
+        CHECK(waiter.budget() == 16);
+
+        // Once a (probing) wait succeeds beyond the budget, the budget moves
+        // towards twice the number of spins that the waits take.
+        bool waited = false;
+        for (int i = 0; i < 50; ++i) {
+            int checks = 0;
+            waited = waiter.spin([&checks]() { return ++checks > 100; });
+        }
+        CHECK(waited);
+        CHECK(waiter.budget() >= 180);
+        CHECK(waiter.budget() <= 200);
+
+        CHECK_FALSE(rc::spin_waiter().enabled());
+        rc::wait_strategy fixed = rc::wait_strategy::spin_then_park(64, 1);
+        fixed.adaptive = false;
+        rc::spin_waiter fixed_waiter(fixed);
+        fixed_waiter.spin([]() { return false; });
+        CHECK(fixed_waiter.budget() == 64);
+    }
+
+    SECTION("queues hand over all elements") {
+        const int n = 20000;
+        rc::queue<int> q(8, rc::wait_strategy::spin_then_park());
+        std::vector<std::thread> consumers;
+        std::atomic<long long> sum(0);
+        for (int c = 0; c < 2; ++c) {
+            consumers.emplace_back([&q, &sum]() {
+                int x;
+                while (q.pop(x) == rc::queue<int>::status::success) {
+                    sum += x;
+                }
+            });
+        }
+        for (int i = 1; i <= n; ++i) {
+            q.push(int(i));
+        }
+        q.close();
+        for (auto& consumer : consumers) {
+            consumer.join();
+        }
+        CHECK(sum == (long long)n * (n + 1) / 2);
+    }
+}
+
+// A move-only queue element that is not default constructible and that
+// counts its live instances.
+struct counted_element {
+    counted_element(int a, int b) : value(a + b) {
+        ++live;
+    }
+    counted_element(counted_element&& other) noexcept : value(other.value) {
+        ++live;
+    }
+    counted_element(const counted_element&) = delete;
+    counted_element& operator=(const counted_element&) = delete;
+    ~counted_element() {
+        --live;
+    }
+    int value;
+    static inline int live = 0;
+};
+
+TEST_CASE("in-place construction and allocation-free storage", "[ra::concurrency::queue]") {
+    namespace rc = ra::concurrency;
+
+    using queue_type = rc::queue<counted_element>;
+
+    SECTION("elements are built and consumed in their slots") {
+        {
+            queue_type q(3);
+            CHECK(q.emplace(1, 2) == queue_type::status::success);
+            CHECK(q.try_emplace(3, 4) == queue_type::status::success);
+            CHECK(q.emplace(5, 6) == queue_type::status::success);
+            CHECK(q.try_emplace(7, 8) == queue_type::status::full);
+            CHECK(counted_element::live == 3);
+
+            int value = 0;
+            CHECK(q.pop_with([&value](counted_element&& e) { value = e.value; }) == queue_type::status::success);
+            CHECK(value == 3);
+            CHECK(counted_element::live == 2);
+
+            // The ring wraps around.
+            CHECK(q.emplace(9, 10) == queue_type::status::success);
+            std::vector<int> values;
+            while (q.try_pop_with([&values](counted_element&& e) { values.push_back(e.value); }) ==
+                   queue_type::status::success) {
+            }
+            CHECK(values == std::vector<int>{7, 11, 19});
+            CHECK(counted_element::live == 0);
+
+            // The elements left in the queue are destroyed with it.
+            q.emplace(1, 1);
+            q.emplace(2, 2);
+        }
+        CHECK(counted_element::live == 0);
+    }
+
+    SECTION("a throwing consumer still frees its slot") {
+        rc::queue<int> q(1);
+        CHECK(q.push(1) == rc::queue<int>::status::success);
+
+        // The producer blocks on the full queue until the pop frees the
+        // slot, even though the consumer throws.
+        std::atomic<bool> pushed(false);
+        std::thread producer([&]() {
+            q.push(2);
+            pushed = true;
+        });
+        if (RA_STATS) {
+            while (q.stats().blocked_pushes == 0) {
+                std::this_thread::yield();
+            }
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        CHECK_THROWS_AS(q.pop_with([](int&&) { throw std::runtime_error("consumer failed"); }), std::runtime_error);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!pushed && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(pushed);
+        // Closing the queue releases the producer if it is still blocked.
+        if (!pushed) {
+            q.close();
+        }
+        producer.join();
+        int x = 0;
+        CHECK(q.try_pop(x) == rc::queue<int>::status::success);
+        CHECK(x == 2);
+    }
+
+    SECTION("steady-state pushes and pops do not allocate") {
+        rc::queue<int> q(16);
+        int x;
+        long long before = allocation_count;
+        for (int i = 0; i < 1000; ++i) {
+            q.push(int(i));
+            q.emplace(i);
+            q.try_push(int(i));
+            q.pop(x);
+            q.try_pop(x);
+            q.pop_with([&x](int&& value) { x = value; });
+        }
+        long long after = allocation_count;
+        CHECK(after == before);
+    }
+}
@@ -1,9 +1,27 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <coroutine>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <ra/coroutine.hpp>
+#include <ra/numa.hpp>
+#include <ra/parallel.hpp>
 #include <ra/thread_pool.hpp>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
 // #include <thread> // already included in thread_pool.hpp
 // #include <vector> // already included in thread_pool.hpp
 
+// Counts allocations, to check that submitting small tasks does not allocate.
+#include "allocation_counter.hpp"
+
 TEST_CASE("counter increment", "[thread_pool]") {
     namespace rc = ra::concurrency;
     rc::thread_pool::size_type counter = 0;
@@ -30,4 +48,1272 @@ TEST_CASE("counter increment", "[thread_pool]") {
     pool.shutdown();
     CHECK(pool.is_shutdown() == true);
     CHECK(counter == 10000);
-}
\ No newline at end of file
+}
+
+TEST_CASE("work stealing with nested tasks", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    std::atomic<int> counter(0);
+    rc::thread_pool_options options;
+    options.num_threads = 4;
+    options.work_stealing = true;
+    rc::thread_pool pool(options);
+
+    // Each root task spawns 100 children from inside the pool, and each
+    // child spawns 10 grandchildren.
+    for (int i = 0; i < 20; ++i) {
+        pool.schedule([&]() {
+            ++counter;
+            for (int j = 0; j < 100; ++j) {
+                pool.schedule([&]() {
+                    ++counter;
+                    for (int k = 0; k < 10; ++k) {
+                        pool.schedule([&]() { ++counter; });
+                    }
+                });
+            }
+        });
+    }
+
+    CHECK(pool.size() == 4);
+    pool.shutdown();
+    CHECK(pool.is_shutdown() == true);
+    CHECK(counter == 20 * (1 + 100 * (1 + 10)));
+}
+
+TEST_CASE("submit returns futures", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    rc::thread_pool pool(4);
+
+    SECTION("results") {
+        std::vector<rc::future<int>> results;
+        for (int i = 0; i < 100; ++i) {
+            results.push_back(pool.submit([](int x, int y) { return x * y; }, i, 2));
+        }
+        int sum = 0;
+        for (auto& f : results) {
+            sum += f.get();
+        }
+        CHECK(sum == 2 * 99 * 100 / 2);
+    }
+
+    SECTION("move-only capture") {
+        auto p = std::make_unique<int>(42);
+        auto f = pool.submit([p = std::move(p)]() { return *p; });
+        CHECK(f.get() == 42);
+        CHECK(f.valid() == false);
+    }
+
+    SECTION("void result") {
+        std::atomic<int> counter(0);
+        auto f = pool.submit([&counter]() { ++counter; });
+        f.get();
+        CHECK(counter == 1);
+    }
+
+    SECTION("exceptions are carried to the caller") {
+        auto f = pool.submit([]() -> int { throw std::runtime_error("task failed"); });
+        CHECK_THROWS_AS(f.get(), std::runtime_error);
+
+        // The threads of the pool survive the exception.
+        CHECK(pool.submit([]() { return 1; }).get() == 1);
+    }
+
+    pool.shutdown();
+    CHECK(pool.is_shutdown() == true);
+}
+
+TEST_CASE("task functions store small callables inline", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    int counter = 0;
+    std::array<char, 64> payload{};
+    long long before = allocation_count;
+    rc::task_function f([&counter, payload]() { counter += payload.size(); });
+    rc::task_function g(std::move(f));
+    CHECK(!f);
+    CHECK(static_cast<bool>(g));
+    g();
+    long long after = allocation_count;
+    CHECK(counter == 64);
+    CHECK(after == before);
+
+    // Callables larger than the inline buffer are allocated once, and
+    // moving them only moves the pointer.
+    std::array<char, 512> big{};
+    before = allocation_count;
+    rc::task_function h([&counter, big]() { counter += big.size(); });
+    g = std::move(h);
+    g();
+    after = allocation_count;
+    CHECK(counter == 64 + 512);
+    CHECK(after == before + 1);
+}
+
+TEST_CASE("submitting tasks does not allocate in the steady state", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    rc::thread_pool pool(2);
+
+    // Once more shared states have been created than the caches of the
+    // threads of the pool can hold, the states that these threads release
+    // always flow back to this thread.
+    long long sum = 0;
+    {
+        std::vector<rc::future<int>> results;
+        for (int i = 0; i < 1000; ++i) {
+            results.push_back(pool.submit([i]() { return i; }));
+        }
+        for (auto& result : results) {
+            sum += result.get();
+        }
+    }
+    long long before = allocation_count;
+    for (int i = 0; i < 10000; ++i) {
+        sum += pool.submit([i]() { return i; }).get();
+    }
+    long long after = allocation_count;
+    CHECK(sum == 1000LL * 999 / 2 + 10000LL * 9999 / 2);
+    CHECK(after == before);
+
+    SECTION("the result is destroyed with the last reference to it") {
+        auto value = std::make_shared<int>(1);
+        {
+            rc::future<std::shared_ptr<int>> result = pool.submit([value]() { return value; });
+            result.wait();
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (value.use_count() > 1 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        CHECK(value.use_count() == 1);
+    }
+}
+
+TEST_CASE("batches taken from the shared queue can be stolen", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    auto wait_until = [](auto&& done) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!done() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        return done();
+    };
+
+    // Schedules a gate on each of the num_threads threads of pool, which
+    // keeps them busy until release is set.
+    auto block_threads = [&](rc::thread_pool& pool, int num_threads, std::atomic<bool>& release) {
+        std::atomic<int> started(0);
+        for (int i = 0; i < num_threads; ++i) {
+            pool.schedule([&]() {
+                ++started;
+                while (!release) {
+                    std::this_thread::yield();
+                }
+            });
+        }
+        wait_until([&]() { return started == num_threads; });
+    };
+
+    SECTION("task group waits help with the batch behind a long task") {
+        rc::thread_pool pool(1);
+        std::atomic<bool> release(false);
+        block_threads(pool, 1, release);
+
+        // The only thread takes all three tasks in one batch, and the
+        // long task only finishes once the others have run.
+        rc::task_group group(pool);
+        std::atomic<int> done(0);
+        std::atomic<bool> started(false);
+        bool others_ran = false;
+        group.run([&]() {
+            started = true;
+            others_ran = wait_until([&]() { return done == 2; });
+        });
+        group.run([&]() { ++done; });
+        group.run([&]() { ++done; });
+        release = true;
+        wait_until([&]() { return started.load(); });
+        group.wait();
+        CHECK(others_ran);
+        pool.shutdown();
+    }
+
+    SECTION("idle threads steal the batch behind a long task") {
+        rc::thread_pool pool(2);
+        std::atomic<bool> release(false);
+        block_threads(pool, 2, release);
+
+        // Once the first thread takes the long task and the task after it
+        // in one batch, the second thread runs out of queued tasks.
+        std::atomic<int> done(0);
+        std::atomic<bool> others_ran(false);
+        std::atomic<bool> finished(false);
+        pool.schedule([&]() {
+            others_ran = wait_until([&]() { return done == 3; });
+            finished = true;
+        });
+        for (int i = 0; i < 3; ++i) {
+            pool.schedule([&]() { ++done; });
+        }
+        release = true;
+        // Not wait_idle, which would help with the batch on this thread.
+        wait_until([&]() { return finished.load(); });
+        CHECK(others_ran);
+        pool.shutdown();
+    }
+}
+
+TEST_CASE("try_schedule sheds load instead of blocking", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    rc::thread_pool pool(1);
+    std::atomic<bool> started(false);
+    std::atomic<bool> release(false);
+    std::atomic<int> counter(0);
+
+    // Keep the only thread busy, so that the queue fills up.
+    pool.schedule([&]() {
+        started = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+    });
+    while (!started) {
+        std::this_thread::yield();
+    }
+
+    int accepted = 0;
+    int inline_runs = 0;
+    for (int i = 0; i < 2 * MAX_QUEUE; ++i) {
+        rc::task_function task([&counter]() { ++counter; });
+        if (pool.try_schedule(std::move(task))) {
+            ++accepted;
+        } else {
+            CHECK(static_cast<bool>(task));
+            task();
+            ++inline_runs;
+        }
+    }
+
+    CHECK(accepted <= MAX_QUEUE);
+    CHECK(inline_runs >= MAX_QUEUE);
+    release = true;
+    pool.shutdown();
+    CHECK(counter == 2 * MAX_QUEUE);
+
+    rc::task_function late([]() {});
+    CHECK(pool.try_schedule(std::move(late)) == false);
+}
+
+TEST_CASE("task groups and wait_idle keep the pool alive", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    bool work_stealing = GENERATE(false, true);
+    rc::thread_pool_options options;
+    options.num_threads = 2;
+    options.work_stealing = work_stealing;
+    rc::thread_pool pool(options);
+    std::atomic<int> counter(0);
+
+    SECTION("task groups can be waited for repeatedly") {
+        rc::task_group group(pool);
+        for (int batch = 1; batch <= 5; ++batch) {
+            for (int i = 0; i < 100; ++i) {
+                group.run([&counter]() { ++counter; });
+            }
+            group.wait();
+            CHECK(counter == 100 * batch);
+        }
+    }
+
+    SECTION("nested task groups help instead of deadlocking") {
+        rc::task_group outer(pool);
+        for (int i = 0; i < 8; ++i) {
+            outer.run([&]() {
+                rc::task_group inner(pool);
+                for (int j = 0; j < 50; ++j) {
+                    inner.run([&counter]() { ++counter; });
+                }
+                inner.wait();
+            });
+        }
+        outer.wait();
+        CHECK(counter == 8 * 50);
+    }
+
+    SECTION("exceptions are rethrown by wait") {
+        rc::task_group group(pool);
+        group.run([]() { throw std::runtime_error("task failed"); });
+        group.run([&counter]() { ++counter; });
+        CHECK_THROWS_AS(group.wait(), std::runtime_error);
+        CHECK(counter == 1);
+        group.wait();
+    }
+
+    SECTION("wait_idle") {
+        for (int batch = 1; batch <= 3; ++batch) {
+            for (int i = 0; i < 100; ++i) {
+                pool.schedule([&counter]() { ++counter; });
+            }
+            pool.wait_idle();
+            CHECK(counter == 100 * batch);
+        }
+        CHECK(pool.is_shutdown() == false);
+    }
+
+    pool.shutdown();
+}
+
+TEST_CASE("threads are placed on CPUs and NUMA nodes", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+
+    SECTION("parse_cpu_list") {
+        CHECK(rc::parse_cpu_list("0-3,8,10-11\n") == std::vector<int>{0, 1, 2, 3, 8, 10, 11});
+        CHECK(rc::parse_cpu_list("5") == std::vector<int>{5});
+        CHECK(rc::parse_cpu_list("").empty());
+        CHECK(rc::parse_cpu_list("x,2") == std::vector<int>{2});
+    }
+
+    SECTION("the system topology covers the available CPUs") {
+        const rc::numa_topology& topology = rc::numa_topology::system();
+        REQUIRE(topology.num_nodes() >= 1);
+        for (int cpu : rc::available_cpus()) {
+            CHECK(topology.node_of_cpu(cpu) < topology.num_nodes());
+        }
+    }
+
+    SECTION("cpu_sets pin the threads") {
+        int cpu = rc::available_cpus().front();
+        rc::thread_pool_options options;
+        options.num_threads = 2;
+        options.cpu_sets = {{cpu}};
+        rc::thread_pool pool(options);
+        std::vector<rc::future<bool>> pinned;
+        for (int i = 0; i < 4; ++i) {
+            pinned.push_back(pool.submit([cpu]() {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                return sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1 &&
+                       CPU_ISSET(cpu, &set);
+            }));
+        }
+        for (auto& result : pinned) {
+            CHECK(result.get());
+        }
+        CHECK(pool.num_nodes() == 1);
+        CHECK(pool.current_node() == 1);
+        pool.shutdown();
+    }
+
+    SECTION("tasks prefer the queue of their node") {
+        // Two nodes sharing a CPU, so that the test runs anywhere.
+        int cpu = rc::available_cpus().front();
+        rc::numa_topology topology({{cpu}, {cpu}});
+        rc::thread_pool_options options;
+        options.num_threads = 2;
+        options.placement = rc::thread_placement::numa_nodes;
+        options.topology = &topology;
+        rc::thread_pool pool(options);
+        REQUIRE(pool.num_nodes() == 2);
+        CHECK(pool.node_of_thread(0) == 0);
+        CHECK(pool.node_of_thread(1) == 1);
+
+        // Keep both threads busy while the tasks are queued, then release
+        // the thread of node 1 alone, which runs the tasks of its own node
+        // before those of node 0.
+        std::atomic<int> arrived(0);
+        std::array<std::atomic<bool>, 2> release{false, false};
+        for (rc::thread_pool::size_type node = 0; node < 2; ++node) {
+            pool.schedule(
+                [&]() {
+                    ++arrived;
+                    while (!release[pool.current_node()]) {
+                        std::this_thread::yield();
+                    }
+                },
+                node);
+        }
+        while (arrived < 2) {
+            std::this_thread::yield();
+        }
+        std::mutex m;
+        std::vector<std::pair<rc::thread_pool::size_type, int>> runs;
+        for (int i = 0; i < 10; ++i) {
+            int hint = i % 2;
+            pool.schedule(
+                [&, hint]() {
+                    std::scoped_lock<std::mutex> lock(m);
+                    runs.emplace_back(pool.current_node(), hint);
+                },
+                hint);
+        }
+        // Not wait_idle, which would run the tasks in this thread.
+        release[1] = true;
+        for (;;) {
+            std::this_thread::yield();
+            std::scoped_lock<std::mutex> lock(m);
+            if (runs.size() == 10) {
+                break;
+            }
+        }
+        release[0] = true;
+        pool.wait_idle();
+        for (int i = 0; i < 10; ++i) {
+            CHECK(runs[i].first == 1);
+            CHECK(runs[i].second == (i < 5 ? 1 : 0));
+        }
+        pool.shutdown();
+    }
+
+    SECTION("first_touch zeroes the buffer") {
+        rc::thread_pool pool(3);
+        std::vector<unsigned char> buffer((3 << 20) + 1000, 1);
+        rc::first_touch(pool, buffer.data() + 7, buffer.size() - 14);
+        CHECK(std::count(buffer.begin(), buffer.begin() + 7, 1) == 7);
+        CHECK(std::count(buffer.begin() + 7, buffer.end() - 7, 0) ==
+              static_cast<std::ptrdiff_t>(buffer.size() - 14));
+        CHECK(std::count(buffer.end() - 7, buffer.end(), 1) == 7);
+        pool.shutdown();
+    }
+}
+
+TEST_CASE("the most urgent task runs first", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    using clock = std::chrono::steady_clock;
+
+    // Runs schedule_all while the only thread of pool is blocked, and then
+    // returns the labels that the tasks recorded, in the order in which
+    // they ran.
+    auto run_order = [](rc::thread_pool& pool, int num_tasks, auto schedule_all) {
+        std::atomic<bool> started(false);
+        std::atomic<bool> release(false);
+        pool.schedule([&]() {
+            started = true;
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+        while (!started) {
+            std::this_thread::yield();
+        }
+
+        std::mutex m;
+        std::vector<int> order;
+        auto record = [&](int label) {
+            return [&, label]() {
+                std::scoped_lock<std::mutex> lock(m);
+                order.push_back(label);
+            };
+        };
+        schedule_all(record);
+
+        // Not wait_idle, which would run the tasks in this thread.
+        release = true;
+        for (;;) {
+            std::this_thread::yield();
+            std::scoped_lock<std::mutex> lock(m);
+            if (order.size() == static_cast<std::size_t>(num_tasks)) {
+                break;
+            }
+        }
+        return order;
+    };
+
+    rc::thread_pool_options options;
+    options.num_threads = 1;
+    options.aging_interval = std::chrono::hours(1);
+
+    SECTION("priorities") {
+        rc::thread_pool pool(options);
+        auto order = run_order(pool, 9, [&](auto record) {
+            const rc::task_priority priorities[] = {rc::task_priority::low, rc::task_priority::normal,
+                                                    rc::task_priority::high};
+            for (int i = 0; i < 9; ++i) {
+                rc::task_options task;
+                task.priority = priorities[i % 3];
+                pool.schedule(record(i), task);
+            }
+        });
+        CHECK(order == std::vector<int>{2, 5, 8, 1, 4, 7, 0, 3, 6});
+        pool.shutdown();
+    }
+
+    SECTION("deadlines") {
+        rc::thread_pool pool(options);
+        auto order = run_order(pool, 4, [&](auto record) {
+            pool.schedule(record(0));
+            rc::task_options task;
+            task.priority = rc::task_priority::high;
+            pool.schedule(record(1), task);
+            task.priority = rc::task_priority::low;
+            task.deadline = clock::now() + std::chrono::seconds(1);
+            pool.schedule(record(2), task);
+            task.deadline = clock::time_point::max();
+            pool.schedule(record(3), task);
+        });
+        CHECK(order == std::vector<int>{1, 2, 0, 3});
+        pool.shutdown();
+    }
+
+    SECTION("aging") {
+        options.aging_interval = std::chrono::milliseconds(1);
+        rc::thread_pool pool(options);
+        auto order = run_order(pool, 3, [&](auto record) {
+            rc::task_options task;
+            task.priority = rc::task_priority::low;
+            pool.schedule(record(0), task);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            task.priority = rc::task_priority::high;
+            pool.schedule(record(1), task);
+            pool.schedule(record(2), task);
+        });
+        CHECK(order == std::vector<int>{0, 1, 2});
+        pool.shutdown();
+    }
+
+    SECTION("urgent tasks come before the rest of a batch") {
+        rc::thread_pool pool(options);
+        std::atomic<bool> gate_started(false);
+        std::atomic<bool> release(false);
+        pool.schedule([&]() {
+            gate_started = true;
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+        while (!gate_started) {
+            std::this_thread::yield();
+        }
+
+        // The thread takes the three normal tasks in one batch, and the
+        // high-priority task arrives while it runs the first one.
+        std::mutex m;
+        std::vector<int> order;
+        auto record = [&](int label) {
+            std::scoped_lock<std::mutex> lock(m);
+            order.push_back(label);
+        };
+        std::atomic<bool> started(false);
+        std::atomic<bool> go(false);
+        pool.schedule([&]() {
+            started = true;
+            while (!go) {
+                std::this_thread::yield();
+            }
+            record(0);
+        });
+        pool.schedule([&]() { record(1); });
+        pool.schedule([&]() { record(2); });
+        release = true;
+        while (!started) {
+            std::this_thread::yield();
+        }
+        rc::task_options task;
+        task.priority = rc::task_priority::high;
+        pool.schedule([&]() { record(3); }, task);
+        go = true;
+
+        // Not wait_idle, which would run the tasks in this thread.
+        for (;;) {
+            std::this_thread::yield();
+            std::scoped_lock<std::mutex> lock(m);
+            if (order.size() == 4) {
+                break;
+            }
+        }
+        CHECK(order == std::vector<int>{0, 3, 1, 2});
+        pool.shutdown();
+    }
+
+    SECTION("urgent tasks come before the local deques") {
+        options.work_stealing = true;
+        rc::thread_pool pool(options);
+        auto order = run_order(pool, 6, [&](auto record) {
+            pool.schedule([&pool, record]() {
+                for (int i = 0; i < 5; ++i) {
+                    pool.schedule(record(i));
+                }
+                rc::task_options task;
+                task.priority = rc::task_priority::high;
+                pool.schedule(record(5), task);
+            });
+        });
+        REQUIRE(order.size() == 6);
+        CHECK(order[0] == 5);
+        pool.shutdown();
+    }
+}
+
+TEST_CASE("statistics", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    using namespace std::chrono_literals;
+
+    SECTION("latency histograms") {
+        CHECK(rc::latency_histogram::bucket(0ns) == 0);
+        CHECK(rc::latency_histogram::bucket(1ns) == 0);
+        CHECK(rc::latency_histogram::bucket(2ns) == 1);
+        CHECK(rc::latency_histogram::bucket(1000ns) == 9);
+        CHECK(rc::latency_histogram::bucket(1h) == rc::latency_histogram::num_buckets - 1);
+
+        rc::latency_histogram histogram;
+        CHECK(histogram.quantile(0.5) == 0ns);
+        histogram.counts[3] = 90;
+        histogram.counts[10] = 10;
+        CHECK(histogram.total() == 100);
+        CHECK(histogram.quantile(0) == 16ns);
+        CHECK(histogram.quantile(0.5) == 16ns);
+        CHECK(histogram.quantile(0.95) == 2048ns);
+        CHECK(histogram.quantile(1) == 2048ns);
+    }
+
+    SECTION("tasks and schedules are counted") {
+        rc::thread_pool pool(1);
+        std::atomic<bool> started(false);
+        std::atomic<bool> release(false);
+        pool.schedule([&]() {
+            started = true;
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+        while (!started) {
+            std::this_thread::yield();
+        }
+        for (int i = 0; i < MAX_QUEUE; ++i) {
+            pool.schedule([]() {});
+        }
+        CHECK_FALSE(pool.try_schedule([]() {}));
+
+        // This schedule blocks until the thread takes tasks again.
+        std::thread scheduler([&pool]() { pool.schedule([]() {}); });
+        if (RA_STATS) {
+            while (pool.stats().blocked_schedules == 0) {
+                std::this_thread::sleep_for(1ms);
+            }
+        }
+        release = true;
+        scheduler.join();
+        pool.wait_idle();
+
+        rc::thread_pool_stats stats = pool.stats();
+        REQUIRE(stats.threads.size() == 1);
+        std::uint64_t total = MAX_QUEUE + 2;
+        if (stats.enabled) {
+            CHECK(stats.threads[0].tasks_executed + stats.outside.tasks_executed == total);
+            CHECK(stats.threads[0].busy_time > 0ns);
+            CHECK(stats.queue_wait.total() == total);
+            CHECK(stats.run_time.total() == total);
+            CHECK(stats.blocked_schedules == 1);
+            CHECK(stats.rejected_schedules == 1);
+        } else {
+            CHECK(stats.threads[0].tasks_executed == 0);
+            CHECK(stats.queue_wait.total() == 0);
+            CHECK(stats.blocked_schedules == 0);
+            CHECK(stats.rejected_schedules == 0);
+        }
+        pool.shutdown();
+    }
+
+    SECTION("periodic reports") {
+        std::atomic<int> reports(0);
+        rc::thread_pool_options options;
+        options.num_threads = 2;
+        options.stats_interval = 1ms;
+        options.stats_report = [&reports](const rc::thread_pool_stats& stats) {
+            if (stats.threads.size() == 2) {
+                ++reports;
+            }
+        };
+        rc::thread_pool pool(options);
+        pool.schedule([]() { std::this_thread::sleep_for(20ms); });
+        pool.wait_idle();
+        pool.shutdown();
+        if (RA_STATS) {
+            CHECK(reports > 0);
+        } else {
+            CHECK(reports == 0);
+        }
+
+        std::ostringstream out;
+        out << pool.stats();
+        CHECK(out.str().find(RA_STATS ? "thread pool: 2 threads" : "disabled") != std::string::npos);
+    }
+}
+
+TEST_CASE("idle threads can spin before parking", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    for (bool work_stealing : {false, true}) {
+        rc::thread_pool_options options;
+        options.num_threads = 2;
+        options.work_stealing = work_stealing;
+        options.wait = rc::wait_strategy::spin_then_park(256, 2);
+        rc::thread_pool pool(options);
+
+        // One task at a time, so that the threads keep running out of work.
+        int sum = 0;
+        for (int i = 0; i < 200; ++i) {
+            sum += pool.submit([i]() { return i; }).get();
+        }
+        CHECK(sum == 199 * 200 / 2);
+
+        std::atomic<int> counter(0);
+        rc::task_group group(pool);
+        for (int i = 0; i < 100; ++i) {
+            group.run([&]() {
+                for (int j = 0; j < 10; ++j) {
+                    group.run([&counter]() { ++counter; });
+                }
+            });
+        }
+        group.wait();
+        CHECK(counter == 1000);
+        pool.shutdown();
+    }
+}
+
+TEST_CASE("elastic pools grow with the load and shrink when idle", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    auto wait_until = [](auto&& done) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!done() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return done();
+    };
+
+    SECTION("fixed pools keep their size") {
+        rc::thread_pool pool(3);
+        CHECK(pool.size() == 3);
+        CHECK(pool.active_threads() == 3);
+    }
+
+    SECTION("threads are added for a backlog and retired after the idle timeout") {
+        for (bool work_stealing : {false, true}) {
+            rc::thread_pool_options options;
+            options.num_threads = 1;
+            options.max_threads = 4;
+            options.idle_timeout = std::chrono::milliseconds(50);
+            options.work_stealing = work_stealing;
+            rc::thread_pool pool(options);
+            CHECK(pool.size() == 4);
+            CHECK(pool.active_threads() == 1);
+
+            // The tasks only finish once all of them run at the same time.
+            std::atomic<int> running(0);
+            std::atomic<bool> release(false);
+            for (int i = 0; i < 4; ++i) {
+                pool.schedule([&]() {
+                    ++running;
+                    while (!release) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                });
+            }
+            bool all_running = wait_until([&]() { return running == 4; });
+            CHECK(all_running);
+            CHECK(pool.active_threads() == 4);
+            release = true;
+
+            bool shrunk = wait_until([&]() { return pool.active_threads() == 1; });
+            CHECK(shrunk);
+
+            // Retired slots are reused.
+            running = 0;
+            release = false;
+            for (int i = 0; i < 4; ++i) {
+                pool.schedule([&]() {
+                    ++running;
+                    while (!release) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                });
+            }
+            all_running = wait_until([&]() { return running == 4; });
+            CHECK(all_running);
+            release = true;
+            pool.shutdown();
+        }
+    }
+
+    SECTION("blocked threads are compensated for") {
+        rc::thread_pool_options options;
+        options.num_threads = 1;
+        options.idle_timeout = std::chrono::milliseconds(50);
+        rc::thread_pool pool(options);
+
+        // The first task blocks until the second one has run, which takes
+        // a compensation thread in a pool of one thread.
+        std::atomic<bool> started(false);
+        std::atomic<bool> done(false);
+        std::atomic<bool> finished(false);
+        bool woken = false;
+        pool.schedule([&]() {
+            started = true;
+            rc::blocking_region region(pool);
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (!done && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            woken = done;
+            finished = true;
+        });
+        wait_until([&]() { return started.load(); });
+        pool.schedule([&]() { done = true; });
+        // Not wait_idle, which would run the second task on this thread.
+        wait_until([&]() { return finished.load(); });
+        CHECK(woken);
+
+        bool shrunk = wait_until([&]() { return pool.active_threads() == 1; });
+        CHECK(shrunk);
+
+        // Outside the pool, a blocking region has no effect.
+        { rc::blocking_region region(pool); }
+        CHECK(pool.active_threads() == 1);
+    }
+
+    SECTION("the rest of a blocked thread's batch keeps its priority") {
+        rc::thread_pool_options options;
+        options.num_threads = 1;
+        options.idle_timeout = std::chrono::milliseconds(50);
+        options.aging_interval = std::chrono::hours(1);
+        rc::thread_pool pool(options);
+
+        std::atomic<bool> gate_started(false);
+        std::atomic<bool> release(false);
+        pool.schedule([&]() {
+            gate_started = true;
+            while (!release) {
+                std::this_thread::yield();
+            }
+        });
+        wait_until([&]() { return gate_started.load(); });
+
+        // The three high-priority tasks are taken in a single batch once
+        // the gate opens, and the first one then blocks.
+        std::mutex m;
+        std::vector<int> order;
+        auto record = [&](int label) {
+            return [&, label]() {
+                std::scoped_lock<std::mutex> lock(m);
+                order.push_back(label);
+            };
+        };
+        std::atomic<bool> started(false);
+        std::atomic<bool> block(false);
+        std::atomic<bool> finished(false);
+        rc::task_options high;
+        high.priority = rc::task_priority::high;
+        pool.schedule(
+            [&]() {
+                started = true;
+                while (!block) {
+                    std::this_thread::yield();
+                }
+                rc::blocking_region region(pool);
+                wait_until([&]() {
+                    std::scoped_lock<std::mutex> lock(m);
+                    return order.size() == 3;
+                });
+                finished = true;
+            },
+            high);
+        pool.schedule(record(1), high);
+        pool.schedule(record(2), high);
+        release = true;
+        wait_until([&]() { return started.load(); });
+
+        // A normal task queued while the batch waits behind the blocked
+        // task runs after the high-priority tasks of the batch (which the
+        // compensation thread steals in either order).
+        pool.schedule(record(3));
+        block = true;
+        wait_until([&]() { return finished.load(); });
+        REQUIRE(order.size() == 3);
+        CHECK(order[2] == 3);
+        pool.shutdown();
+    }
+}
+
+TEST_CASE("cancelled tasks are discarded without running", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+
+    // Counts the tasks that ran and those destroyed without running.
+    struct counted_task {
+        std::atomic<int>* ran;
+        std::atomic<int>* dropped;
+        bool done = false;
+
+        counted_task(std::atomic<int>& ran, std::atomic<int>& dropped) : ran(&ran), dropped(&dropped) {}
+        counted_task(counted_task&& other) noexcept
+            : ran(other.ran), dropped(other.dropped), done(std::exchange(other.done, true)) {}
+        ~counted_task() {
+            if (!done) {
+                ++*dropped;
+            }
+        }
+        void operator()() {
+            ++*ran;
+            done = true;
+        }
+    };
+
+    std::atomic<int> ran(0);
+    std::atomic<int> dropped(0);
+    std::atomic<bool> started(false);
+    std::atomic<bool> release(false);
+    auto blocker = [&]() {
+        started = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+    };
+
+    SECTION("stop tokens") {
+        for (bool work_stealing : {false, true}) {
+            rc::thread_pool_options options;
+            options.num_threads = 1;
+            options.work_stealing = work_stealing;
+            rc::thread_pool pool(options);
+            ran = 0;
+            dropped = 0;
+
+            // The tasks are scheduled from inside the pool (onto the local
+            // deque in work-stealing mode) and cancelled before the thread
+            // is free to run them.
+            std::stop_source source;
+            std::atomic<bool> scheduled(false);
+            pool.schedule([&]() {
+                rc::task_options task_options;
+                task_options.stop = source.get_token();
+                for (int i = 0; i < 10; ++i) {
+                    pool.schedule(counted_task(ran, dropped), task_options);
+                }
+                pool.schedule(counted_task(ran, dropped));
+                source.request_stop();
+                scheduled = true;
+            });
+            while (!scheduled) {
+                std::this_thread::yield();
+            }
+            pool.wait_idle();
+            CHECK(ran == 1);
+            CHECK(dropped == 10);
+            rc::thread_pool_stats stats = pool.stats();
+            if (stats.enabled) {
+                CHECK(stats.discarded_tasks == 10);
+            }
+            pool.shutdown();
+        }
+    }
+
+    SECTION("task groups") {
+        rc::thread_pool pool(1);
+        rc::task_group group(pool);
+        group.run(blocker);
+        while (!started) {
+            std::this_thread::yield();
+        }
+        for (int i = 0; i < 10; ++i) {
+            group.run(counted_task(ran, dropped));
+        }
+        CHECK_FALSE(group.is_cancelled());
+        std::stop_token token = group.get_stop_token();
+        group.cancel();
+        CHECK(group.is_cancelled());
+        CHECK(token.stop_requested());
+        release = true;
+        group.wait();
+        CHECK(ran == 0);
+        CHECK(dropped == 10);
+
+        // Tasks run on a cancelled group are discarded as well.
+        group.run(counted_task(ran, dropped));
+        group.wait();
+        CHECK(ran == 0);
+        CHECK(dropped == 11);
+    }
+
+    SECTION("shutdown_now discards the backlog") {
+        rc::thread_pool pool(1);
+        pool.schedule(blocker);
+        while (!started) {
+            std::this_thread::yield();
+        }
+        for (int i = 0; i < 20; ++i) {
+            pool.schedule(counted_task(ran, dropped));
+        }
+        auto result = pool.submit([]() { return 1; });
+
+        // shutdown_now discards the queued tasks right away, but waits for
+        // the running one.
+        std::thread stopper([&pool]() { pool.shutdown_now(); });
+        result.wait();
+        CHECK(dropped == 20);
+        release = true;
+        stopper.join();
+        CHECK(pool.is_shutdown());
+        CHECK(ran == 0);
+        CHECK_THROWS_AS(result.get(), std::future_error);
+    }
+}
+
+TEST_CASE("parallel algorithms", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+    rc::thread_pool_options options;
+    options.num_threads = 4;
+    options.work_stealing = GENERATE(false, true);
+    rc::thread_pool pool(options);
+
+    SECTION("parallel_for visits each index once") {
+        for (int n : {0, 1, 7, 1000, 100000}) {
+            for (std::size_t grain : {std::size_t(0), std::size_t(1), std::size_t(64)}) {
+                std::vector<std::atomic<int>> visits(n);
+                rc::parallel_for(pool, 0, n, [&visits](int i) { ++visits[i]; }, grain);
+                CHECK(std::all_of(visits.begin(), visits.end(), [](const std::atomic<int>& v) { return v == 1; }));
+            }
+        }
+
+        // A 2D range is split into blocks of at most grain elements.
+        const int rows = 37, cols = 211;
+        std::vector<std::atomic<int>> visits(rows * cols);
+        std::atomic<int> blocks(0);
+        rc::parallel_for(pool, 0, rows, 0, cols, [&](int i, int j) { ++visits[i * cols + j]; }, 100);
+        CHECK(std::all_of(visits.begin(), visits.end(), [](const std::atomic<int>& v) { return v == 1; }));
+        rc::parallel_for(pool, 0, 0, 0, cols, [&](int, int) { ++blocks; });
+        CHECK(blocks == 0);
+    }
+
+    SECTION("parallel_for can be nested") {
+        std::atomic<long long> sum(0);
+        pool.submit([&]() {
+            rc::parallel_for(pool, 0, 100, [&](int i) {
+                rc::parallel_for(pool, 0, 100, [&](int j) { sum += i * 100 + j; });
+            });
+        }).get();
+        CHECK(sum == 9999LL * 10000 / 2);
+    }
+
+    SECTION("parallel_for rethrows exceptions") {
+        std::atomic<int> calls(0);
+        CHECK_THROWS_AS(rc::parallel_for(pool, 0, 100000, [&calls](int i) {
+            ++calls;
+            if (i == 500) {
+                throw std::runtime_error("failure");
+            }
+        }, 100), std::runtime_error);
+        CHECK(calls < 100000);
+        CHECK(pool.submit([]() { return 1; }).get() == 1);
+    }
+
+    SECTION("parallel_reduce keeps the order of the chunks") {
+        long long sum = rc::parallel_reduce(pool, 0, 100000, 0LL, std::plus<>(), [](int i) { return (long long)i; });
+        CHECK(sum == 99999LL * 100000 / 2);
+        CHECK(rc::parallel_reduce(pool, 5, 5, 42, std::plus<>(), [](int i) { return i; }) == 42);
+
+        // String concatenation is associative but not commutative.
+        std::string digits = rc::parallel_reduce(pool, 0, 1000, std::string(), std::plus<>(),
+                                                 [](int i) { return std::to_string(i % 10); }, 7);
+        std::string expected;
+        for (int i = 0; i < 1000; ++i) {
+            expected += std::to_string(i % 10);
+        }
+        CHECK(digits == expected);
+    }
+
+    SECTION("parallel_scan matches std::inclusive_scan") {
+        for (std::size_t grain : {std::size_t(0), std::size_t(1), std::size_t(333)}) {
+            std::vector<long long> in(10007);
+            std::iota(in.begin(), in.end(), -500);
+            std::vector<long long> expected(in.size()), out(in.size());
+            std::inclusive_scan(in.begin(), in.end(), expected.begin());
+            CHECK(rc::parallel_scan(pool, in.begin(), in.end(), out.begin(), 0LL, std::plus<>(), grain) ==
+                  out.end());
+            CHECK(out == expected);
+
+            // The scan can be done in place.
+            rc::parallel_scan(pool, in.begin(), in.end(), in.begin(), 0LL, std::plus<>(), grain);
+            CHECK(in == expected);
+        }
+    }
+
+    SECTION("parallel_sort matches std::sort") {
+        std::uint64_t seed = 12345;
+        auto next = [&seed]() {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            return int(seed >> 33);
+        };
+        for (int modulus : {1, 3, 1000, 1 << 30}) {
+            std::vector<int> values(200000);
+            for (int& x : values) {
+                x = next() % modulus;
+            }
+            std::vector<int> expected = values;
+            std::sort(expected.begin(), expected.end(), std::greater<>());
+            rc::parallel_sort(pool, values.begin(), values.end(), std::greater<>(), 500);
+            CHECK(values == expected);
+        }
+
+        // Move-only elements can be sorted as well.
+        std::vector<std::unique_ptr<int>> pointers;
+        for (int i = 0; i < 10000; ++i) {
+            pointers.push_back(std::make_unique<int>(next() % 100));
+        }
+        rc::parallel_sort(pool, pointers.begin(), pointers.end(),
+                          [](const auto& a, const auto& b) { return *a < *b; }, 64);
+        CHECK(std::is_sorted(pointers.begin(), pointers.end(), [](const auto& a, const auto& b) { return *a < *b; }));
+    }
+}
+
+TEST_CASE("coroutines on thread pools and queues", "[thread_pool]") {
+    namespace rc = ra::concurrency;
+
+    SECTION("schedule_on moves a task onto the pool") {
+        rc::thread_pool pool(2);
+        std::thread::id caller = std::this_thread::get_id();
+        std::thread::id continuation;
+        auto square = [&pool](int x) -> rc::task<int> {
+            co_await pool.schedule_on();
+            co_return x * x;
+        };
+        auto sum_of_squares = [&](int n) -> rc::task<long long> {
+            long long sum = 0;
+            for (int i = 1; i <= n; ++i) {
+                sum += co_await square(i);
+            }
+            continuation = std::this_thread::get_id();
+            co_return sum;
+        };
+        CHECK(rc::spawn(pool, sum_of_squares(100)).get() == 338350);
+
+        // The continuations run on the threads of the pool.
+        CHECK(continuation != caller);
+
+        // Exceptions propagate through the awaiting tasks to the future.
+        auto failing = [&pool]() -> rc::task<void> {
+            co_await pool.schedule_on();
+            throw std::runtime_error("failure");
+        };
+        auto outer = [&]() -> rc::task<void> { co_await failing(); };
+        CHECK_THROWS_AS(rc::spawn(pool, outer()).get(), std::runtime_error);
+    }
+
+    SECTION("async queue operations do not block threads") {
+        // Many more producers and consumers than threads exchange values
+        // over a small queue, which only works if waiting does not block.
+        // (Catch assertions are not thread safe, so they are only made by
+        // the main thread.)
+        rc::thread_pool pool(2);
+        rc::queue<int> q(4);
+        const int num_pipelines = 500, values = 40;
+        std::atomic<int> failed_pushes(0);
+        auto producer = [&](int base) -> rc::task<void> {
+            for (int i = 0; i < values; ++i) {
+                if (co_await q.async_push(base + i, pool) != rc::queue<int>::status::success) {
+                    ++failed_pushes;
+                }
+            }
+        };
+        auto consumer = [&]() -> rc::task<long long> {
+            long long sum = 0;
+            while (std::optional<int> x = co_await q.async_pop(pool)) {
+                sum += *x;
+            }
+            co_return sum;
+        };
+        std::vector<rc::future<void>> producers;
+        std::vector<rc::future<long long>> consumers;
+        for (int k = 0; k < num_pipelines; ++k) {
+            consumers.push_back(rc::spawn(pool, consumer()));
+            producers.push_back(rc::spawn(pool, producer(k * values)));
+        }
+        for (auto& f : producers) {
+            f.get();
+        }
+        q.close();
+        long long sum = 0;
+        for (auto& f : consumers) {
+            sum += f.get();
+        }
+        long long n = (long long)num_pipelines * values;
+        CHECK(failed_pushes == 0);
+        CHECK(sum == n * (n - 1) / 2);
+    }
+
+    SECTION("coroutines and blocked threads share a queue") {
+        rc::thread_pool pool(2);
+        rc::queue<int> q(1);
+
+        // A coroutine waiting in async_pop is resumed inline by a thread
+        // that pushes, and a thread blocked in pop by a coroutine.
+        std::thread::id resumer;
+        auto relay = [&]() -> rc::task<rc::queue<int>::status> {
+            std::optional<int> x = co_await q.async_pop();
+            resumer = std::this_thread::get_id();
+            co_return co_await q.async_push(*x + 1);
+        };
+        rc::future<rc::queue<int>::status> done = rc::spawn(pool, relay());
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        CHECK(q.push(1) == rc::queue<int>::status::success);
+        int x = 0;
+        CHECK(q.pop(x) == rc::queue<int>::status::success);
+        CHECK(x == 2);
+        CHECK(done.get() == rc::queue<int>::status::success);
+        CHECK(resumer == std::this_thread::get_id());
+
+        // Closing the queue resumes the waiting coroutines.
+        auto waiter = [&]() -> rc::task<bool> { co_return (co_await q.async_pop()).has_value(); };
+        rc::future<bool> result = rc::spawn(pool, waiter());
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        q.close();
+        CHECK_FALSE(result.get());
+    }
+
+    SECTION("discarded resumptions destroy the coroutines") {
+        rc::thread_pool pool(2);
+        rc::queue<int> q(1);
+
+        // Counts the live coroutine frames (through a local variable).
+        std::atomic<int> live_frames(0);
+        struct frame_counter {
+            explicit frame_counter(std::atomic<int>& n) : n(n) {
+                ++n;
+            }
+            ~frame_counter() {
+                --n;
+            }
+            std::atomic<int>& n;
+        };
+
+        // A resumption discarded through its stop token.
+        std::stop_source stop;
+        stop.request_stop();
+        rc::task_options stopped;
+        stopped.stop = stop.get_token();
+        auto cancelled = [&]() -> rc::task<void> {
+            frame_counter counter(live_frames);
+            co_await pool.schedule_on(stopped);
+        };
+        CHECK_THROWS_AS(rc::spawn(pool, cancelled()).get(), std::future_error);
+        CHECK(live_frames == 0);
+
+        // A resumption scheduled on a pool that was shutdown while the
+        // coroutine waited in async_pop.
+        std::atomic<bool> waiting(false);
+        auto inner = [&]() -> rc::task<int> {
+            frame_counter counter(live_frames);
+            co_await pool.schedule_on();
+            waiting = true;
+            std::optional<int> x = co_await q.async_pop(pool);
+            co_return x.value_or(-1);
+        };
+        auto outer = [&]() -> rc::task<int> {
+            frame_counter counter(live_frames);
+            co_return co_await inner() + 1;
+        };
+        rc::future<int> result = rc::spawn(pool, outer());
+        while (!waiting) {
+            std::this_thread::yield();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        pool.shutdown_now();
+        CHECK(q.push(1) == rc::queue<int>::status::success);
+        CHECK_THROWS_AS(result.get(), std::future_error);
+        CHECK(live_frames == 0);
+    }
+}
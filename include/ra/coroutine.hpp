@@ -0,0 +1,319 @@
+#ifndef COROUTINE_HPP
+#define COROUTINE_HPP
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <ra/future.hpp>
+#include <ra/thread_pool.hpp>
+#include <type_traits>
+#include <utility>
+
+namespace ra::concurrency {
+
+    template <class T = void>
+    class task;
+
+    namespace detail {
+
+        // The part of the promise of a task that does not depend on the
+        // type of its result.
+        class task_promise_base {
+            public:
+                // Resumes the awaiting coroutine (if any) when the task
+                // finishes, by symmetric transfer, so that the continuation
+                // runs on the thread that finished the task.
+                struct final_awaiter {
+                    bool await_ready() const noexcept {
+                        return false;
+                    }
+
+                    template <class Promise>
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                        auto& promise = static_cast<task_promise_base&>(handle.promise());
+                        promise.owner_ = nullptr;
+                        return promise.continuation_;
+                    }
+
+                    void await_resume() const noexcept {}
+                };
+
+                task_promise_base() : continuation_(std::noop_coroutine()) {}
+
+                task_promise_base(const task_promise_base&) = delete;
+                task_promise_base& operator=(const task_promise_base&) = delete;
+
+                // If the task is destroyed while it is suspended in the
+                // middle of its body (e.g., because the thread pool
+                // discarded the task that was to resume it), it can never
+                // finish, so the coroutine awaiting it is destroyed as well,
+                // and so on up to the coroutine run by spawn, whose
+                // destruction completes the future with a broken promise.
+                ~task_promise_base() {
+                    if (owner_) {
+                        *owner_ = nullptr;
+                        continuation_.destroy();
+                    }
+                }
+
+                // A task does not start until it is awaited.
+                std::suspend_always initial_suspend() const noexcept {
+                    return {};
+                }
+
+                final_awaiter final_suspend() const noexcept {
+                    return {};
+                }
+
+                void unhandled_exception() {
+                    exception_ = std::current_exception();
+                }
+
+                // Records that the task is started by the coroutine
+                // continuation, awaiting the task that owns the coroutine of
+                // the task through *owner.
+                void set_continuation(std::coroutine_handle<> continuation, std::coroutine_handle<>* owner) {
+                    continuation_ = continuation;
+                    owner_ = owner;
+                }
+
+            protected:
+                // Rethrows the exception that the task exited with (if any).
+                void rethrow_if_exception() {
+                    if (exception_) {
+                        std::rethrow_exception(exception_);
+                    }
+                }
+
+            private:
+                // The coroutine awaiting the task.
+                std::coroutine_handle<> continuation_;
+
+                // The handle of the task object that owns the coroutine while
+                // the task is running (nullptr otherwise).
+                std::coroutine_handle<>* owner_ = nullptr;
+
+                // The exception that the task exited with (if any).
+                std::exception_ptr exception_;
+        };
+
+        template <class T>
+        class task_promise : public task_promise_base {
+            public:
+                task<T> get_return_object();
+
+                template <class U>
+                void return_value(U&& value) {
+                    value_.emplace(std::forward<U>(value));
+                }
+
+                // Returns the result of the task, or rethrows its exception.
+                T result() {
+                    rethrow_if_exception();
+                    return std::move(*value_);
+                }
+
+            private:
+                std::optional<T> value_;
+        };
+
+        template <>
+        class task_promise<void> : public task_promise_base {
+            public:
+                task<void> get_return_object();
+
+                void return_void() {}
+
+                void result() {
+                    rethrow_if_exception();
+                }
+        };
+
+        // A coroutine that starts when it is resumed the first time and
+        // destroys itself when it finishes, used to run a task detached
+        // from its caller (see spawn).
+        // The exceptions of the coroutine must be handled in its body.
+        class detached_coroutine {
+            public:
+                struct promise_type {
+                    detached_coroutine get_return_object() {
+                        return detached_coroutine(std::coroutine_handle<promise_type>::from_promise(*this));
+                    }
+
+                    std::suspend_always initial_suspend() const noexcept {
+                        return {};
+                    }
+
+                    std::suspend_never final_suspend() const noexcept {
+                        return {};
+                    }
+
+                    void return_void() {}
+
+                    void unhandled_exception() {
+                        std::terminate();
+                    }
+                };
+
+                detached_coroutine(detached_coroutine&& other) noexcept
+                    : handle_(std::exchange(other.handle_, nullptr)) {}
+                detached_coroutine& operator=(detached_coroutine&&) = delete;
+
+                // Destroys the coroutine if it has not been started.
+                ~detached_coroutine() {
+                    if (handle_) {
+                        handle_.destroy();
+                    }
+                }
+
+                // Starts the coroutine, which then owns itself.
+                void start() {
+                    std::exchange(handle_, nullptr).resume();
+                }
+
+            private:
+                explicit detached_coroutine(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+                std::coroutine_handle<promise_type> handle_;
+        };
+
+        // Runs the task t, storing its result (or exception) through p.
+        template <class T>
+        detached_coroutine run_detached(task<T> t, promise<T> p) {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    co_await std::move(t);
+                    p.set_value();
+                } else {
+                    p.set_value(co_await std::move(t));
+                }
+            } catch (...) {
+                p.set_exception(std::current_exception());
+            }
+        }
+
+    }  // namespace detail
+
+    // Coroutine task class.
+    // A task is a coroutine returning a result of type T (or nothing, for
+    // task<void>), which may co_await other tasks, the awaiters of
+    // thread_pool::schedule_on, and the asynchronous operations of queues.
+    // A task is lazy: it starts running when it is awaited (or spawned),
+    // and when it finishes, the awaiting coroutine is resumed on the thread
+    // that finished it. Once a task has moved onto a thread pool (through
+    // co_await pool.schedule_on()), its continuations thus run on the
+    // threads of the pool, and a thread is only occupied by a task while
+    // the task is running, not while it waits.
+    // If the task exits with an exception, the exception is rethrown by the
+    // co_await expression awaiting the task.
+    // If a suspended task is never resumed because the task that was to
+    // resume it is discarded (e.g., by thread_pool::shutdown_now), its
+    // coroutine is destroyed, together with the tasks awaiting it; a task
+    // must thus only be awaited by other tasks (or spawned).
+    template <class T>
+    class task {
+        public:
+            using promise_type = detail::task_promise<T>;
+
+            // The type of the result.
+            using value_type = T;
+
+            // A task is movable but not copyable.
+            task(task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+            task& operator=(task&& other) noexcept {
+                if (this != &other) {
+                    reset();
+                    handle_ = std::exchange(other.handle_, nullptr);
+                }
+                return *this;
+            }
+
+            task(const task&) = delete;
+            task& operator=(const task&) = delete;
+
+            // Destroys the coroutine of the task.
+            // Precondition: The task is not running (i.e., it has either
+            // not been awaited or has finished).
+            ~task() {
+                reset();
+            }
+
+            // Starts the task and suspends the awaiting coroutine until the
+            // task finishes, then returns its result.
+            // Precondition: The task has not been awaited before.
+            auto operator co_await() && noexcept {
+                struct awaiter {
+                    bool await_ready() const noexcept {
+                        return false;
+                    }
+
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+                        t.promise().set_continuation(continuation, &t.handle_);
+                        return t.handle_;
+                    }
+
+                    T await_resume() {
+                        return t.promise().result();
+                    }
+
+                    task& t;
+                };
+                return awaiter{*this};
+            }
+
+            auto operator co_await() & noexcept {
+                return std::move(*this).operator co_await();
+            }
+
+        private:
+            friend promise_type;
+
+            explicit task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+
+            promise_type& promise() const {
+                return std::coroutine_handle<promise_type>::from_address(handle_.address()).promise();
+            }
+
+            void reset() {
+                if (handle_) {
+                    std::exchange(handle_, nullptr).destroy();
+                }
+            }
+
+            // The coroutine of the task (see task_promise_base::owner_).
+            std::coroutine_handle<> handle_;
+    };
+
+    template <class T>
+    task<T> detail::task_promise<T>::get_return_object() {
+        return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+    }
+
+    inline task<void> detail::task_promise<void>::get_return_object() {
+        return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+    }
+
+    // Starts the task t on a thread of pool, detached from the calling
+    // thread, and returns a future for its result.
+    // Unlike thread_pool::submit, the task occupies a thread of the pool
+    // only while it runs, so that thousands of tasks waiting on queues
+    // (e.g., the stages of pipelines) can share a few threads.
+    // If the task is discarded without being started (e.g., if the thread
+    // pool is shutdown), the future holds a std::future_error.
+    // This function may block in the same way as thread_pool::schedule.
+    // Precondition: Same as for thread_pool::schedule.
+    // This function is thread safe.
+    template <class T>
+    future<T> spawn(thread_pool& pool, task<T> t) {
+        auto* state = detail::shared_state<T>::make();
+        future<T> result(state);
+        pool.schedule([coroutine = detail::run_detached(std::move(t), detail::promise<T>(state))]() mutable {
+            coroutine.start();
+        });
+        return result;
+    }
+
+}  // namespace ra::concurrency
+
+#endif  // COROUTINE_HPP
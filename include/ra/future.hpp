@@ -0,0 +1,338 @@
+#ifndef FUTURE_HPP
+#define FUTURE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace ra::concurrency {
+
+    namespace detail {
+
+        // A cache of memory blocks for objects of type State (shared
+        // states), so that creating a future does not allocate memory in
+        // the steady state.
+        // Each thread keeps up to max_size free blocks of its own, linked
+        // through the blocks themselves. A thread with too many free blocks
+        // moves half of them to a list shared by all threads, and a thread
+        // without free blocks takes some from that list, so that the blocks
+        // freed by one thread (e.g., a thread running tasks) flow back to
+        // the thread creating the objects (e.g., the thread submitting the
+        // tasks).
+        template <class State>
+        class state_cache {
+            public:
+                static constexpr std::size_t max_size = 64;
+
+                ~state_cache() {
+                    destroyed_ = true;
+                    while (head_) {
+                        deallocate(std::exchange(head_, head_->next));
+                    }
+                }
+
+                // Constructs an object in a free block, which is newly
+                // allocated only if neither the cache of the thread nor the
+                // shared list has one.
+                static State* make() {
+                    void* memory = destroyed_ ? nullptr : local().take();
+                    if (!memory) {
+                        memory = allocate();
+                    }
+                    return ::new (memory) State();
+                }
+
+                // Destroys the object state and returns its block to the
+                // cache.
+                static void recycle(State* state) {
+                    state->~State();
+                    if (destroyed_) {
+                        deallocate(state);
+                    } else {
+                        local().put(state);
+                    }
+                }
+
+            private:
+                // A free block.
+                struct block {
+                    block* next;
+                };
+
+                // The list of free blocks shared by all threads.
+                struct shared_list {
+                    std::mutex mutex;
+                    block* head = nullptr;
+                };
+
+                state_cache() : head_(nullptr), size_(0) {}
+
+                // Removes a free block from the cache (refilling the cache
+                // from the shared list if it is empty), or returns nullptr
+                // if there is none.
+                void* take() {
+                    if (!head_) {
+                        shared_list& shared = shared_blocks();
+                        std::scoped_lock lock(shared.mutex);
+                        while (shared.head && size_ < max_size / 2) {
+                            block* b = std::exchange(shared.head, shared.head->next);
+                            b->next = head_;
+                            head_ = b;
+                            ++size_;
+                        }
+                    }
+                    if (!head_) {
+                        return nullptr;
+                    }
+                    --size_;
+                    return std::exchange(head_, head_->next);
+                }
+
+                // Adds the free block at memory to the cache (moving half of
+                // the cache to the shared list if it is full).
+                void put(void* memory) {
+                    if (size_ == max_size) {
+                        shared_list& shared = shared_blocks();
+                        std::scoped_lock lock(shared.mutex);
+                        while (size_ > max_size / 2) {
+                            block* b = std::exchange(head_, head_->next);
+                            b->next = shared.head;
+                            shared.head = b;
+                            --size_;
+                        }
+                    }
+                    head_ = ::new (memory) block{head_};
+                    ++size_;
+                }
+
+                static state_cache& local() {
+                    thread_local state_cache cache;
+                    return cache;
+                }
+
+                // The shared list is never destroyed, as blocks may still
+                // be freed while the program exits.
+                static shared_list& shared_blocks() {
+                    static shared_list* shared = new shared_list;
+                    return *shared;
+                }
+
+                static void* allocate() {
+                    if constexpr (alignof(State) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+                        return ::operator new(sizeof(State), std::align_val_t(alignof(State)));
+                    } else {
+                        return ::operator new(sizeof(State));
+                    }
+                }
+
+                static void deallocate(void* memory) {
+                    if constexpr (alignof(State) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+                        ::operator delete(memory, std::align_val_t(alignof(State)));
+                    } else {
+                        ::operator delete(memory);
+                    }
+                }
+
+                // Whether the cache of the thread has been destroyed (when
+                // the thread exits), after which blocks are allocated and
+                // freed directly.
+                static inline thread_local bool destroyed_ = false;
+
+                // The free blocks of the thread, and their number.
+                block* head_;
+                std::size_t size_;
+        };
+
+        // The state shared between a future and the task producing its
+        // result. The state is reference counted and is destroyed by the
+        // last of its two owners, which returns its memory to a
+        // state_cache.
+        template <class R>
+        class shared_state {
+            public:
+                shared_state() : ready_(0), refs_(2) {}
+
+                // Returns a new state, constructed in a block taken from the
+                // cache of free blocks if possible.
+                static shared_state* make() {
+                    return state_cache<shared_state>::make();
+                }
+
+                // Stores the result and marks the state as ready.
+                template <class... Args>
+                void set_value(Args&&... args) {
+                    value_.emplace(std::forward<Args>(args)...);
+                    make_ready();
+                }
+
+                // Stores the exception e and marks the state as ready.
+                void set_exception(std::exception_ptr e) {
+                    exception_ = std::move(e);
+                    make_ready();
+                }
+
+                bool is_ready() const {
+                    return ready_.load(std::memory_order_acquire) != 0;
+                }
+
+                void wait() const {
+                    ready_.wait(0, std::memory_order_acquire);
+                }
+
+                // Returns the result, or rethrows the stored exception.
+                R get() {
+                    wait();
+                    if (exception_) {
+                        std::rethrow_exception(exception_);
+                    }
+                    if constexpr (!std::is_void_v<R>) {
+                        return std::move(*value_);
+                    }
+                }
+
+                // Releases one reference to the state.
+                void release() {
+                    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        state_cache<shared_state>::recycle(this);
+                    }
+                }
+
+            private:
+                void make_ready() {
+                    ready_.store(1, std::memory_order_release);
+                    ready_.notify_all();
+                }
+
+                using storage_type = std::conditional_t<std::is_void_v<R>, std::monostate, R>;
+
+                std::atomic<std::uint32_t> ready_;
+                std::atomic<std::uint32_t> refs_;
+                std::optional<storage_type> value_;
+                std::exception_ptr exception_;
+        };
+
+        // The producing end of a shared state.
+        // If a promise is destroyed without a result having been stored
+        // (e.g., because the task owning it was discarded), the state is
+        // completed with a std::future_error (broken promise).
+        template <class R>
+        class promise {
+            public:
+                explicit promise(shared_state<R>* state) : state_(state) {}
+
+                promise(promise&& other) noexcept : state_(std::exchange(other.state_, nullptr)) {}
+                promise& operator=(promise&&) = delete;
+
+                ~promise() {
+                    if (state_) {
+                        if (!state_->is_ready()) {
+                            state_->set_exception(
+                                std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+                        }
+                        state_->release();
+                    }
+                }
+
+                template <class... Args>
+                void set_value(Args&&... args) {
+                    state_->set_value(std::forward<Args>(args)...);
+                }
+
+                void set_exception(std::exception_ptr e) {
+                    state_->set_exception(std::move(e));
+                }
+
+            private:
+                shared_state<R>* state_;
+        };
+
+    }  // namespace detail
+
+    // Future class.
+    // A future refers to the result of a task submitted to a thread pool.
+    // The result becomes available once the task has finished, at which
+    // point it can be retrieved exactly once with get.
+    // If the task exits with an exception, get rethrows that exception.
+    template <class R>
+    class future {
+        public:
+            // The type of the result.
+            using value_type = R;
+
+            // Creates a future that does not refer to any result.
+            future() noexcept : state_(nullptr) {}
+
+            explicit future(detail::shared_state<R>* state) noexcept : state_(state) {}
+
+            // A future is movable but not copyable.
+            future(future&& other) noexcept : state_(std::exchange(other.state_, nullptr)) {}
+
+            future& operator=(future&& other) noexcept {
+                if (this != &other) {
+                    reset();
+                    state_ = std::exchange(other.state_, nullptr);
+                }
+                return *this;
+            }
+
+            future(const future&) = delete;
+            future& operator=(const future&) = delete;
+
+            ~future() {
+                reset();
+            }
+
+            // Returns if the future refers to a result.
+            bool valid() const noexcept {
+                return state_ != nullptr;
+            }
+
+            // Returns if the result is available.
+            // Precondition: valid()
+            bool is_ready() const {
+                return state_->is_ready();
+            }
+
+            // Blocks until the result is available.
+            // Precondition: valid()
+            void wait() const {
+                state_->wait();
+            }
+
+            // Blocks until the result is available and returns it (or
+            // rethrows the exception thrown by the task).
+            // After this function returns, the future is no longer valid.
+            // Precondition: valid()
+            R get() {
+                detail::shared_state<R>* state = std::exchange(state_, nullptr);
+                struct releaser {
+                    detail::shared_state<R>* state;
+                    ~releaser() {
+                        state->release();
+                    }
+                } guard{state};
+                return state->get();
+            }
+
+        private:
+            void reset() {
+                if (state_) {
+                    std::exchange(state_, nullptr)->release();
+                }
+            }
+
+            // The shared state, or nullptr if the future is not valid.
+            detail::shared_state<R>* state_;
+    };
+
+}  // namespace ra::concurrency
+
+#endif  // FUTURE_HPP
@@ -0,0 +1,492 @@
+#ifndef IMAGE_FILE_HPP
+#define IMAGE_FILE_HPP
+
+#include <algorithm>
+#include <array>
+#include <boost/multi_array.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <ra/thread_pool.hpp>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+namespace ra::fractal {
+
+    // The file formats of image_file.
+    enum class image_format {
+        pgm,  // binary PGM (P5)
+        png,  // PNG with uncompressed (stored) deflate blocks
+    };
+
+    namespace detail {
+
+        // Returns the CRC-32 (as used by PNG) of the n bytes at data,
+        // continuing from the CRC crc of the preceding bytes.
+        inline std::uint32_t crc32(const unsigned char* data, std::size_t n, std::uint32_t crc = 0) {
+            static const std::array<std::uint32_t, 256> table = []() {
+                std::array<std::uint32_t, 256> t{};
+                for (std::uint32_t i = 0; i < 256; ++i) {
+                    std::uint32_t c = i;
+                    for (int k = 0; k < 8; ++k) {
+                        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    }
+                    t[i] = c;
+                }
+                return t;
+            }();
+            crc = ~crc;
+            for (std::size_t i = 0; i < n; ++i) {
+                crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+
+        // Returns the Adler-32 checksum (as used by zlib) of the n bytes at
+        // data, continuing from the checksum adler of the preceding bytes.
+        inline std::uint32_t adler32(const unsigned char* data, std::size_t n, std::uint32_t adler = 1) {
+            constexpr std::uint32_t mod = 65521;
+            std::uint32_t a = adler & 0xffff;
+            std::uint32_t b = adler >> 16;
+            while (n > 0) {
+                // 5552 is the largest count for which b cannot overflow.
+                std::size_t block = std::min<std::size_t>(n, 5552);
+                for (std::size_t i = 0; i < block; ++i) {
+                    a += data[i];
+                    b += a;
+                }
+                a %= mod;
+                b %= mod;
+                data += block;
+                n -= block;
+            }
+            return (b << 16) | a;
+        }
+
+        // Returns the Adler-32 checksum of the concatenation of two byte
+        // sequences, given their checksums and the length n2 of the second.
+        inline std::uint32_t adler32_combine(std::uint32_t adler1, std::uint32_t adler2, std::uint64_t n2) {
+            constexpr std::uint64_t mod = 65521;
+            std::uint64_t rem = n2 % mod;
+            std::uint64_t a1 = adler1 & 0xffff;
+            std::uint64_t b1 = adler1 >> 16;
+            std::uint64_t a2 = adler2 & 0xffff;
+            std::uint64_t b2 = adler2 >> 16;
+            std::uint64_t a = (a1 + a2 + mod - 1) % mod;
+            std::uint64_t b = (b1 + b2 + rem * a1 + mod - rem) % mod;
+            return static_cast<std::uint32_t>((b << 16) | a);
+        }
+
+        // Stores x in big-endian order at out.
+        inline void put_u32(unsigned char* out, std::uint32_t x) {
+            out[0] = static_cast<unsigned char>(x >> 24);
+            out[1] = static_cast<unsigned char>(x >> 16);
+            out[2] = static_cast<unsigned char>(x >> 8);
+            out[3] = static_cast<unsigned char>(x);
+        }
+
+    }  // namespace detail
+
+    // Image file class.
+    // An image file is a grayscale image of a fixed size, written to a
+    // file whose layout is fixed when it is created, so that its rows can
+    // be written in any order (e.g., as the tiles of an image are
+    // finished) and by several threads at once, each with a single
+    // positioned write.
+    // A pixel is stored as its value clamped to [0, 2^bit_depth - 1], in
+    // 8 or 16 bits.
+    // Rows are numbered as in the arrays written by compute_julia_set,
+    // i.e., row 0 is the top row of the image.
+    // Whole rows can be written from an array with write_rows, or the
+    // image can be assembled tile by tile through a memory mapping of the
+    // file with write_tile and finish_rows, without the whole image ever
+    // being held in memory.
+    class image_file {
+        public:
+            // Creates (or truncates) the file at path for an image of
+            // height x width pixels in the given format and bit depth
+            // (8 or 16).
+            // Throws std::invalid_argument if the size or bit depth is
+            // invalid, and std::system_error if the file cannot be
+            // created.
+            image_file(const std::string& path, int height, int width, image_format format, int bit_depth = 8)
+                : height_(height), width_(width), format_(format), bit_depth_(bit_depth), fd_(-1),
+                  map_(nullptr), row_adler_(format == image_format::png ? height : 0), finished_(false) {
+                if (height <= 0 || width <= 0) {
+                    throw std::invalid_argument("image_file: invalid image size");
+                }
+                if (bit_depth != 8 && bit_depth != 16) {
+                    throw std::invalid_argument("image_file: the bit depth must be 8 or 16");
+                }
+
+                std::string header;
+                if (format == image_format::pgm) {
+                    header = "P5\n" + std::to_string(width) + " " + std::to_string(height) + "\n" +
+                             std::to_string(max_value()) + "\n";
+                } else {
+                    header = png_header();
+                }
+                rows_offset_ = header.size();
+
+                fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+                if (fd_ < 0) {
+                    throw std::system_error(errno, std::generic_category(), "image_file: cannot create " + path);
+                }
+                if (::ftruncate(fd_, static_cast<off_t>(file_size())) != 0) {
+                    int error = errno;
+                    ::close(fd_);
+                    throw std::system_error(error, std::generic_category(), "image_file: cannot resize " + path);
+                }
+                try {
+                    write_at(header.data(), header.size(), 0);
+                } catch (...) {
+                    ::close(fd_);
+                    throw;
+                }
+            }
+
+            // An image file is not copyable or movable.
+            image_file(const image_file&) = delete;
+            image_file& operator=(const image_file&) = delete;
+            image_file(image_file&&) = delete;
+            image_file& operator=(image_file&&) = delete;
+
+            // Closes the file. If finish has not been called, the file is
+            // left incomplete.
+            ~image_file() {
+                if (map_) {
+                    ::munmap(map_, file_size());
+                }
+                ::close(fd_);
+            }
+
+            // Writes the rows [row_begin, row_end) of a, which must be a
+            // height x width array, to the same rows of the image.
+            // Throws std::system_error if the write fails.
+            // This function is thread safe, provided that no row is
+            // written by two calls at once.
+            void write_rows(const boost::multi_array<int, 2>& a, int row_begin, int row_end) {
+                if (row_begin >= row_end) {
+                    return;
+                }
+                std::size_t stride = encoded_row_size();
+                std::vector<unsigned char> buffer(stride * (row_end - row_begin));
+                std::vector<unsigned char> pixels(pixel_bytes());
+                for (int i = row_begin; i < row_end; ++i) {
+                    unsigned char* out = buffer.data() + stride * (i - row_begin);
+                    encode_pixels(&a[i][0], width_, pixels.data());
+                    put_pixels(out, 0, pixels.data(), pixels.size());
+                    frame_row(i, out);
+                }
+                write_at(buffer.data(), buffer.size(), rows_offset_ + stride * row_begin);
+            }
+
+            // Writes a tile of rows x cols pixels, whose row k starts at
+            // values + k * stride, at row row_begin and column col_begin
+            // of the image, through a memory mapping of the file.
+            // Once all tiles covering some rows have been written,
+            // finish_rows must be called for these rows.
+            // Throws std::system_error if the file cannot be mapped.
+            // This function is thread safe, provided that no pixel is
+            // written by two calls at once.
+            void write_tile(int row_begin, int col_begin, int rows, int cols, const int* values,
+                            std::size_t stride) {
+                unsigned char* map = mapping();
+                std::size_t bytes = bit_depth_ / 8;
+                std::vector<unsigned char> pixels(cols * bytes);
+                for (int k = 0; k < rows; ++k) {
+                    encode_pixels(values + k * stride, cols, pixels.data());
+                    put_pixels(map + row_offset(row_begin + k), col_begin * bytes, pixels.data(), pixels.size());
+                }
+            }
+
+            // Completes the rows [row_begin, row_end), all of whose pixels
+            // have been written with write_tile, and lets the operating
+            // system write them back and drop them from memory, so that
+            // the memory used by a tiled rendering does not grow with the
+            // size of the image.
+            // This function is thread safe, provided that no row is
+            // written by two calls at once.
+            void finish_rows(int row_begin, int row_end) {
+                if (row_begin >= row_end) {
+                    return;
+                }
+                unsigned char* map = mapping();
+                for (int i = row_begin; i < row_end; ++i) {
+                    frame_row(i, map + row_offset(i));
+                }
+
+                // Only whole pages inside the rows are released, since the
+                // pages at the ends may still be written by other tiles.
+                // (Releasing them would be harmless, as the data is kept
+                // in the page cache, but would cost another page fault.)
+                std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+                std::size_t begin = (row_offset(row_begin) + page - 1) / page * page;
+                std::size_t end = row_offset(row_end) / page * page;
+                if (begin < end) {
+                    ::madvise(map + begin, end - begin, MADV_DONTNEED);
+                }
+            }
+
+            // Writes the end of the file, once all rows have been written.
+            // This function is not thread safe.
+            void finish() {
+                if (finished_) {
+                    return;
+                }
+                if (format_ == image_format::png) {
+                    // The checksum of the zlib stream, which spans all rows,
+                    // followed by the IEND chunk.
+                    std::uint32_t adler = 1;
+                    for (std::uint32_t row_adler : row_adler_) {
+                        adler = detail::adler32_combine(adler, row_adler, raw_row_size());
+                    }
+                    unsigned char checksum[4];
+                    detail::put_u32(checksum, adler);
+                    unsigned char trailer[28];
+                    std::size_t n = put_chunk(trailer, "IDAT", checksum, sizeof(checksum));
+                    n += put_chunk(trailer + n, "IEND", checksum, 0);
+                    write_at(trailer, n, rows_offset_ + encoded_row_size() * height_);
+                }
+                finished_ = true;
+            }
+
+            // Returns the size of the complete file in bytes.
+            std::size_t file_size() const {
+                std::size_t size = rows_offset_ + encoded_row_size() * height_;
+                if (format_ == image_format::png) {
+                    size += 16 + 12;  // the checksum chunk and IEND
+                }
+                return size;
+            }
+
+            int height() const {
+                return height_;
+            }
+
+            int width() const {
+                return width_;
+            }
+
+        private:
+            // The largest payload of a stored deflate block.
+            static constexpr std::size_t max_stored_block = 65535;
+
+            int max_value() const {
+                return bit_depth_ == 8 ? 255 : 65535;
+            }
+
+            // Returns the number of bytes of the pixels of a row.
+            std::size_t pixel_bytes() const {
+                return static_cast<std::size_t>(width_) * (bit_depth_ / 8);
+            }
+
+            // Returns the number of bytes of a row in the uncompressed PNG
+            // data (the filter type followed by the pixels).
+            std::size_t raw_row_size() const {
+                return 1 + pixel_bytes();
+            }
+
+            // Returns the number of bytes of a row in the file.
+            // In a PNG file, each row is its own IDAT chunk holding stored
+            // deflate blocks, so that its position and encoding depend on
+            // no other row.
+            std::size_t encoded_row_size() const {
+                if (format_ == image_format::pgm) {
+                    return pixel_bytes();
+                }
+                std::size_t blocks = (raw_row_size() + max_stored_block - 1) / max_stored_block;
+                return 12 + raw_row_size() + 5 * blocks;
+            }
+
+            // Writes the length and type of a chunk at out.
+            static void put_chunk_header(unsigned char* out, const char* type, std::size_t length) {
+                detail::put_u32(out, static_cast<std::uint32_t>(length));
+                std::copy(type, type + 4, out + 4);
+            }
+
+            // Writes a chunk of the given type holding the length bytes at
+            // data at out, and returns the size of the chunk.
+            static std::size_t put_chunk(unsigned char* out, const char* type, const unsigned char* data,
+                                         std::size_t length) {
+                put_chunk_header(out, type, length);
+                std::copy(data, data + length, out + 8);
+                detail::put_u32(out + 8 + length, detail::crc32(out + 4, 4 + length));
+                return 12 + length;
+            }
+
+            // Returns the signature, the IHDR chunk and an IDAT chunk
+            // holding the zlib header.
+            std::string png_header() const {
+                unsigned char out[8 + 25 + 14];
+                const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+                std::copy(signature, signature + 8, out);
+                unsigned char ihdr[13];
+                detail::put_u32(ihdr, width_);
+                detail::put_u32(ihdr + 4, height_);
+                ihdr[8] = static_cast<unsigned char>(bit_depth_);
+                ihdr[9] = 0;   // grayscale
+                ihdr[10] = 0;  // deflate
+                ihdr[11] = 0;  // adaptive filtering
+                ihdr[12] = 0;  // no interlace
+                std::size_t n = 8 + put_chunk(out + 8, "IHDR", ihdr, sizeof(ihdr));
+                const unsigned char zlib_header[2] = {0x78, 0x01};
+                n += put_chunk(out + n, "IDAT", zlib_header, sizeof(zlib_header));
+                return std::string(reinterpret_cast<const char*>(out), n);
+            }
+
+            // Returns the offset of row i in the file.
+            std::size_t row_offset(int i) const {
+                return rows_offset_ + encoded_row_size() * i;
+            }
+
+            // Returns the memory mapping of the whole file, creating it on
+            // first use.
+            unsigned char* mapping() {
+                std::call_once(map_once_, [this]() {
+                    void* map = ::mmap(nullptr, file_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+                    if (map == MAP_FAILED) {
+                        throw std::system_error(errno, std::generic_category(), "image_file: cannot map file");
+                    }
+                    map_ = static_cast<unsigned char*>(map);
+                });
+                return map_;
+            }
+
+            // Stores the n pixel values at values at out, big-endian if 16
+            // bits.
+            void encode_pixels(const int* values, int n, unsigned char* out) const {
+                int max = max_value();
+                if (bit_depth_ == 8) {
+                    for (int j = 0; j < n; ++j) {
+                        out[j] = static_cast<unsigned char>(std::clamp(values[j], 0, max));
+                    }
+                } else {
+                    for (int j = 0; j < n; ++j) {
+                        int v = std::clamp(values[j], 0, max);
+                        out[2 * j] = static_cast<unsigned char>(v >> 8);
+                        out[2 * j + 1] = static_cast<unsigned char>(v);
+                    }
+                }
+            }
+
+            // Copies the n encoded pixel bytes at data to the row of the
+            // file at out, starting at byte offset of the pixels of the row.
+            // In a PNG file, the bytes are split between the stored blocks.
+            void put_pixels(unsigned char* out, std::size_t offset, const unsigned char* data,
+                            std::size_t n) const {
+                if (format_ == image_format::pgm) {
+                    std::memcpy(out + offset, data, n);
+                    return;
+                }
+                // The offset in the uncompressed row, after the filter type.
+                std::size_t raw = 1 + offset;
+                while (n > 0) {
+                    std::size_t block = raw / max_stored_block;
+                    std::size_t len = std::min(n, max_stored_block - raw % max_stored_block);
+                    std::memcpy(out + 8 + 5 * (block + 1) + raw, data, len);
+                    data += len;
+                    raw += len;
+                    n -= len;
+                }
+            }
+
+            // Completes row i at out, whose pixels have been stored with
+            // put_pixels: in a PNG file, writes the chunk header, the
+            // filter type and block headers, and the CRC, and records the
+            // Adler-32 checksum of the uncompressed row.
+            void frame_row(int i, unsigned char* out) {
+                if (format_ == image_format::pgm) {
+                    return;
+                }
+                std::size_t raw = raw_row_size();
+                std::size_t blocks = (raw + max_stored_block - 1) / max_stored_block;
+                unsigned char* p = out + 8;
+                p[5] = 0;  // filter type None
+
+                std::uint32_t adler = 1;
+                for (std::size_t k = 0, done = 0; k < blocks; ++k) {
+                    std::size_t len = std::min(max_stored_block, raw - done);
+                    bool last = i == height_ - 1 && k + 1 == blocks;
+                    p[0] = last ? 1 : 0;
+                    p[1] = static_cast<unsigned char>(len);
+                    p[2] = static_cast<unsigned char>(len >> 8);
+                    p[3] = static_cast<unsigned char>(~len);
+                    p[4] = static_cast<unsigned char>(~len >> 8);
+                    adler = detail::adler32(p + 5, len, adler);
+                    p += 5 + len;
+                    done += len;
+                }
+                row_adler_[i] = adler;
+
+                std::size_t length = raw + 5 * blocks;
+                put_chunk_header(out, "IDAT", length);
+                detail::put_u32(out + 8 + length, detail::crc32(out + 4, 4 + length));
+            }
+
+            // Writes the n bytes at data at the given offset of the file.
+            void write_at(const void* data, std::size_t n, std::size_t offset) {
+                const char* p = static_cast<const char*>(data);
+                while (n > 0) {
+                    ssize_t written = ::pwrite(fd_, p, n, static_cast<off_t>(offset));
+                    if (written < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        throw std::system_error(errno, std::generic_category(), "image_file: write failed");
+                    }
+                    p += written;
+                    offset += written;
+                    n -= written;
+                }
+            }
+
+            int height_;
+            int width_;
+            image_format format_;
+            int bit_depth_;
+            int fd_;
+
+            // The memory mapping of the file, or nullptr if it has not been
+            // created yet.
+            unsigned char* map_;
+            std::once_flag map_once_;
+
+            // The offset of the first row in the file.
+            std::size_t rows_offset_;
+
+            // The Adler-32 checksums of the uncompressed rows (PNG only).
+            std::vector<std::uint32_t> row_adler_;
+
+            bool finished_;
+    };
+
+    // Writes the array a to the file at path in the given format and bit
+    // depth, encoding bands of rows in parallel on the thread pool tp.
+    // This function may also be called from inside a task of tp.
+    inline void write_image(const std::string& path, const boost::multi_array<int, 2>& a, image_format format,
+                            int bit_depth, ra::concurrency::thread_pool& tp) {
+        int height = a.shape()[0];
+        int width = a.shape()[1];
+        image_file file(path, height, width, format, bit_depth);
+
+        // Bands of about 1 MiB are encoded and written at once.
+        int band = std::max(1, static_cast<int>((1 << 20) / (static_cast<std::size_t>(width) * bit_depth / 8)));
+        ra::concurrency::task_group group(tp);
+        for (int i = 0; i < height; i += band) {
+            int end = std::min(i + band, height);
+            group.run([&file, &a, i, end]() { file.write_rows(a, i, end); });
+        }
+        group.wait();
+        file.finish();
+    }
+
+}  // namespace ra::fractal
+
+#endif  // IMAGE_FILE_HPP
@@ -0,0 +1,218 @@
+#ifndef JULIA_ANIMATION_HPP
+#define JULIA_ANIMATION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <boost/multi_array.hpp>
+#include <chrono>
+#include <complex>
+#include <cstdio>
+#include <memory>
+#include <ra/image_file.hpp>
+#include <ra/julia_set.hpp>
+#include <ra/queue.hpp>
+#include <ra/thread_pool.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ra::fractal {
+
+    // A frame of an animation rendered by render_animation.
+    template <class Real>
+    struct animation_frame {
+        // The index of the frame in the animation.
+        int index;
+        // The constant of the Julia set of the frame.
+        std::complex<Real> c;
+        // The iteration counts computed by compute_julia_set.
+        boost::multi_array<int, 2> iterations;
+        // The post-processed pixel values (e.g., gray levels), to be
+        // written out.
+        boost::multi_array<int, 2> pixels;
+    };
+
+    namespace detail {
+
+        // A pipeline stage that processes the items pushed on its input
+        // queue one at a time and in order, as tasks of a task group.
+        // A task is only scheduled while items are pending, so that no
+        // thread of the pool ever blocks waiting for input.
+        template <class T, class Process>
+        class pipeline_stage {
+            public:
+                pipeline_stage(std::size_t capacity, ra::concurrency::task_group& group, Process process)
+                    : input_(capacity), pending_(0), group_(group), process_(std::move(process)) {}
+
+                // Appends item to the input of the stage.
+                // This function is thread safe.
+                void push(T&& item) {
+                    input_.push(std::move(item));
+                    // Whoever makes pending_ nonzero starts the draining
+                    // task; the increment publishes the pushed item to it.
+                    if (pending_.fetch_add(1, std::memory_order_acq_rel) == 0) {
+                        group_.run([this]() { drain(); });
+                    }
+                }
+
+            private:
+                void drain() {
+                    do {
+                        T item;
+                        input_.try_pop(item);
+                        process_(std::move(item));
+                    } while (pending_.fetch_sub(1, std::memory_order_acq_rel) != 1);
+                }
+
+                ra::concurrency::queue<T> input_;
+                std::atomic<std::size_t> pending_;
+                ra::concurrency::task_group& group_;
+                Process process_;
+        };
+
+    }  // namespace detail
+
+    // Renders the Julia sets over the rectangle [bottom_left, top_right]
+    // for each constant in cs, as height x width frames, through a
+    // three-stage pipeline on the thread pool tp:
+    // 1. compute: the iteration counts of the frame are computed with
+    //    compute_julia_set (by the calling thread and the pool);
+    // 2. post-process: colorize(frame) computes frame.pixels from
+    //    frame.iterations;
+    // 3. write: write(frame) writes the frame out.
+    // The stages are connected by bounded queues, and each of the
+    // post-process and write stages handles one frame at a time, in the
+    // order of the frames. The frames overlap across stages: while a frame
+    // is being computed, the previous ones are post-processed and written
+    // by the other threads of the pool.
+    // At most frames_in_flight frames (and their buffers, which are
+    // reused) exist at once; when all are in use, computing the next frame
+    // waits (while helping the pool) until a frame has been written.
+    // If colorize or write throws, no more frames are started, and the
+    // first exception is rethrown once the pipeline has drained.
+    // This function should be called from outside the pool tp.
+    template <class Real, class Colorize, class Write>
+    void render_animation(const std::complex<Real>& bottom_left, const std::complex<Real>& top_right,
+                          const std::vector<std::complex<Real>>& cs, int max_iters, int height, int width,
+                          ra::concurrency::thread_pool& tp, int frames_in_flight, Colorize&& colorize,
+                          Write&& write) {
+        using frame_ptr = std::unique_ptr<animation_frame<Real>>;
+        using status = typename ra::concurrency::queue<frame_ptr>::status;
+        std::size_t capacity = static_cast<std::size_t>(std::max(frames_in_flight, 1));
+
+        // The frames that are not in the pipeline.
+        ra::concurrency::queue<frame_ptr> free_frames(capacity);
+        for (std::size_t k = 0; k < capacity; ++k) {
+            frame_ptr frame = std::make_unique<animation_frame<Real>>();
+            frame->iterations.resize(boost::extents[height][width]);
+            frame->pixels.resize(boost::extents[height][width]);
+            free_frames.push(std::move(frame));
+        }
+
+        ra::concurrency::task_group group(tp);
+        // On failure, no more frames are started, the free frames are
+        // closed to wake up the calling thread, and the exception is left
+        // to the task group.
+        std::atomic<bool> failed(false);
+        auto guarded = [&free_frames, &failed](auto&& f) {
+            try {
+                f();
+            } catch (...) {
+                failed.store(true, std::memory_order_relaxed);
+                free_frames.close();
+                throw;
+            }
+        };
+        auto write_stage_process = [&](frame_ptr&& frame) {
+            guarded([&]() { write(*frame); });
+            free_frames.push(std::move(frame));
+        };
+        detail::pipeline_stage<frame_ptr, decltype(write_stage_process)> write_stage(capacity, group,
+                                                                                      write_stage_process);
+        auto colorize_stage_process = [&](frame_ptr&& frame) {
+            guarded([&]() { colorize(*frame); });
+            write_stage.push(std::move(frame));
+        };
+        detail::pipeline_stage<frame_ptr, decltype(colorize_stage_process)> colorize_stage(
+            capacity, group, colorize_stage_process);
+
+        // The stages must outlive their tasks, even if this function exits
+        // with an exception.
+        struct drain_guard {
+            ra::concurrency::task_group& group;
+            ~drain_guard() {
+                try {
+                    group.wait();
+                } catch (...) {
+                }
+            }
+        } guard{group};
+
+        // Takes a free frame, helping the pool while there is none.
+        // Returns false if the pipeline has failed.
+        auto acquire = [&](frame_ptr& frame) {
+            while (!failed.load(std::memory_order_relaxed)) {
+                status s = free_frames.try_pop(frame);
+                if (s == status::empty && !tp.run_pending_task()) {
+                    s = free_frames.try_pop_for(frame, std::chrono::milliseconds(1));
+                }
+                if (s != status::empty) {
+                    return s == status::success;
+                }
+            }
+            return false;
+        };
+
+        for (std::size_t k = 0; k < cs.size(); ++k) {
+            frame_ptr frame;
+            if (!acquire(frame)) {
+                break;
+            }
+            frame->index = static_cast<int>(k);
+            frame->c = cs[k];
+            compute_julia_set<Real>(bottom_left, top_right, cs[k], max_iters, frame->iterations, tp);
+            colorize_stage.push(std::move(frame));
+        }
+
+        // Wait for all frames to return (or for the pipeline to fail).
+        for (std::size_t k = 0; k < capacity; ++k) {
+            frame_ptr frame;
+            if (!acquire(frame)) {
+                break;
+            }
+        }
+        group.wait();
+    }
+
+    // Renders the animation as render_animation does, storing in each pixel its iteration
+    // count scaled to [0, 255], and writes frame k to the file path_prefix
+    // followed by k (padded to five digits) and .pgm or .png, depending on
+    // the format.
+    template <class Real>
+    void render_animation_to_files(const std::complex<Real>& bottom_left, const std::complex<Real>& top_right,
+                                   const std::vector<std::complex<Real>>& cs, int max_iters, int height,
+                                   int width, ra::concurrency::thread_pool& tp, int frames_in_flight,
+                                   const std::string& path_prefix, image_format format) {
+        auto colorize = [max_iters](animation_frame<Real>& frame) {
+            const int* in = frame.iterations.data();
+            int* out = frame.pixels.data();
+            for (std::size_t k = 0; k < frame.iterations.num_elements(); ++k) {
+                out[k] = static_cast<int>(static_cast<long long>(in[k]) * 255 / std::max(max_iters, 1));
+            }
+        };
+        auto write = [&path_prefix, format](animation_frame<Real>& frame) {
+            char number[16];
+            std::snprintf(number, sizeof(number), "%05d", frame.index);
+            std::string path =
+                path_prefix + number + (format == image_format::pgm ? ".pgm" : ".png");
+            image_file file(path, frame.pixels.shape()[0], frame.pixels.shape()[1], format);
+            file.write_rows(frame.pixels, 0, frame.pixels.shape()[0]);
+            file.finish();
+        };
+        render_animation<Real>(bottom_left, top_right, cs, max_iters, height, width, tp, frames_in_flight,
+                               colorize, write);
+    }
+
+}  // namespace ra::fractal
+
+#endif  // JULIA_ANIMATION_HPP
@@ -1,61 +1,494 @@
+#ifndef JULIA_SET_HPP
+#define JULIA_SET_HPP
+
+#include <algorithm>
+#include <atomic>
 #include <boost/multi_array.hpp>
+#include <charconv>
 #include <complex>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <ra/image_file.hpp>
+#include <ra/julia_set_kernels.hpp>
 #include <ra/thread_pool.hpp>
+#include <stop_token>
+#include <string>
+#include <vector>
 
 namespace ra::fractal {
 
-    template <typename T>
-    int julia_set_point(const std::complex<T>& bottom_left,
-                        const std::complex<T>& top_right, const std::complex<T>& c,
-                        int max_iters, int height, int width, int x, int y) {
-        std::complex<T> z(bottom_left.real() + (T(y) / T(width - 1)) * (top_right.real() - bottom_left.real()),
-                          bottom_left.imag() + (T(x) / T(height - 1)) * (top_right.imag() - bottom_left.imag()));
-        
-        for (int i = 0; i < max_iters; ++i) {
-            if (std::abs(z) > 2) {
-                return i;
+    // Computes the Julia set for the constant c over the rectangle
+    // [bottom_left, top_right] of the complex plane, storing in each
+    // element of a the number of iterations before the corresponding
+    // point escapes (see julia_set_point).
+    // The image is split into square tiles, which the tasks scheduled on
+    // the thread pool tp (one per thread) claim dynamically from a shared
+    // counter until none are left, so that threads that get cheap tiles
+    // simply render more of them. The tile size is the largest power of
+    // two between 16 and 256 that still yields at least 16 tiles per
+    // thread. The calling thread also renders tiles while it waits, so
+    // this function may also be called from inside a task of tp.
+    // Whenever a band of rows of a is complete, rows_done(row_begin,
+    // row_end) is called with the band (rows [row_begin, row_end) of a)
+    // by the thread that finished it, e.g., to write the band to a file
+    // while the rest of the image is still being computed. Bands complete
+    // roughly from the bottom of a to the top, and rows_done may be
+    // called for several bands at once.
+    // If the threads of tp are grouped by NUMA node, each node first
+    // renders the tiles in its own part of a (the same parts as with
+    // ra::concurrency::first_touch), and only then helps the other nodes.
+    // The thread pool is left running, so it can be reused for the
+    // next image.
+    // If a stop is requested through stop (e.g., because the view has
+    // changed), the tasks that have not started are discarded, the
+    // running ones stop after their current row, and the function returns
+    // false without completing the remaining bands; otherwise it returns
+    // true.
+    template <class Real, class RowsDone>
+    bool compute_julia_set(const std::complex<Real>& bottom_left,
+                           const std::complex<Real>& top_right, const std::complex<Real>& c,
+                           int max_iters, boost::multi_array<int, 2>& a, ra::concurrency::thread_pool& tp,
+                           RowsDone&& rows_done, std::stop_token stop = {}) {
+        int height = a.shape()[0];
+        int width = a.shape()[1];
+        if (height == 0 || width == 0) {
+            return true;
+        }
+
+        int tile = 256;
+        while (tile > 16 && ((height + tile - 1) / tile) * ((width + tile - 1) / tile) <
+                                16 * static_cast<int>(tp.size())) {
+            tile /= 2;
+        }
+        int tile_rows = (height + tile - 1) / tile;
+        int tile_cols = (width + tile - 1) / tile;
+        int num_tiles = tile_rows * tile_cols;
+
+        // The number of unfinished tiles of each band of tile rows.
+        std::unique_ptr<std::atomic<int>[]> band_remaining(new std::atomic<int>[tile_rows]);
+        for (int k = 0; k < tile_rows; ++k) {
+            band_remaining[k].store(tile_cols, std::memory_order_relaxed);
+        }
+
+        // The tiles of node k are those in [node_begin[k], node_end[k]),
+        // i.e., the bands whose first row lies in part k of a. As the rows
+        // of a are stored from the top of the image, the parts of the
+        // higher nodes come first.
+        std::size_t num_nodes = tp.num_nodes();
+        std::vector<int> node_begin(num_nodes, num_tiles);
+        std::vector<int> node_end(num_nodes, 0);
+        for (int band = 0; band < tile_rows; ++band) {
+            std::size_t node = std::min(num_nodes - 1, static_cast<std::size_t>(height - 1 - band * tile) *
+                                                           num_nodes / static_cast<std::size_t>(height));
+            node_begin[node] = std::min(node_begin[node], band * tile_cols);
+            node_end[node] = std::max(node_end[node], (band + 1) * tile_cols);
+        }
+        std::unique_ptr<std::atomic<int>[]> next_tile(new std::atomic<int>[num_nodes]);
+        for (std::size_t k = 0; k < num_nodes; ++k) {
+            next_tile[k].store(node_begin[k], std::memory_order_relaxed);
+        }
+
+        // Claims the next tile, from the part of the node home first.
+        // Returns -1 if there is none left.
+        auto claim_tile = [&](std::size_t home) {
+            for (std::size_t i = 0; i < num_nodes; ++i) {
+                std::size_t k = (home + i) % num_nodes;
+                if (next_tile[k].load(std::memory_order_relaxed) < node_end[k]) {
+                    int t = next_tile[k].fetch_add(1, std::memory_order_relaxed);
+                    if (t < node_end[k]) {
+                        return t;
+                    }
+                }
+            }
+            return -1;
+        };
+
+        auto render_tiles = [&]() {
+            std::size_t home = std::min(tp.current_node(), num_nodes - 1);
+            for (int t = claim_tile(home); t >= 0; t = claim_tile(home)) {
+                int row_begin = (t / tile_cols) * tile;
+                int row_end = std::min(row_begin + tile, height);
+                int col_begin = (t % tile_cols) * tile;
+                int col_end = std::min(col_begin + tile, width);
+                for (int i = row_begin; i < row_end; ++i) {
+                    if (stop.stop_requested()) {
+                        return;
+                    }
+                    julia_set_span<Real>(bottom_left, top_right, c, max_iters, height, width, i, col_begin,
+                                         col_end, &a[height - i - 1][col_begin]);
+                }
+                // The thread finishing the last tile of a band sees the
+                // other tiles of the band through the acq_rel decrement.
+                if (band_remaining[t / tile_cols].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    rows_done(height - row_end, height - row_begin);
+                }
+            }
+        };
+
+        ra::concurrency::task_group group(tp);
+        std::stop_callback cancel_tasks(stop, [&group]() { group.cancel(); });
+        int num_tasks = std::min(static_cast<int>(tp.size()), num_tiles);
+        for (int k = 0; k < num_tasks; ++k) {
+            group.run(render_tiles, tp.node_of_thread(k));
+        }
+        render_tiles();
+
+        // Wait for all tasks to finish.
+        group.wait();
+        for (int k = 0; k < tile_rows; ++k) {
+            if (band_remaining[k].load(std::memory_order_relaxed) != 0) {
+                return false;
             }
-            z = z * z + c;
         }
-        // return the smallest value for which |z| > 2 or the max_iters if not exist.
-        return max_iters;
+        return true;
+    }
+
+    // Computes the Julia set as above.
+    template <class Real>
+    void compute_julia_set(const std::complex<Real>& bottom_left,
+                           const std::complex<Real>& top_right, const std::complex<Real>& c,
+                           int max_iters, boost::multi_array<int, 2>& a, ra::concurrency::thread_pool& tp) {
+        compute_julia_set<Real>(bottom_left, top_right, c, max_iters, a, tp, [](int, int) {});
+    }
+
+    // Computes the Julia set as above, unless a stop is requested through
+    // stop. Returns false if the computation was stopped early.
+    template <class Real>
+    bool compute_julia_set(const std::complex<Real>& bottom_left,
+                           const std::complex<Real>& top_right, const std::complex<Real>& c,
+                           int max_iters, boost::multi_array<int, 2>& a, ra::concurrency::thread_pool& tp,
+                           std::stop_token stop) {
+        return compute_julia_set<Real>(bottom_left, top_right, c, max_iters, a, tp, [](int, int) {},
+                                       std::move(stop));
     }
 
+    // Computes the Julia set as above on a new thread pool of num_threads
+    // threads.
     template <class Real>
     void compute_julia_set(const std::complex<Real>& bottom_left,
                            const std::complex<Real>& top_right, const std::complex<Real>& c,
                            int max_iters, boost::multi_array<int, 2>& a, int num_threads) {
-        using thread_pool = ra::concurrency::thread_pool;
+        ra::concurrency::thread_pool tp(num_threads);
+        compute_julia_set<Real>(bottom_left, top_right, c, max_iters, a, tp);
+    }
 
-        int height = a.shape()[0];  // may be const
-        int width = a.shape()[1];
+    // Computes the Julia set as compute_julia_set does, but writes the
+    // image straight into the image file out instead of an array, so that
+    // images far larger than memory can be rendered.
+    // Each task renders its tiles into its own tile-sized buffer and
+    // copies them into the memory-mapped file; once all tiles of a band
+    // of rows are written, the band is completed and its pages are
+    // released (see image_file::finish_rows). The memory used thus grows
+    // with the number of threads and the tile size, not with the image
+    // size. The tile size is chosen as in compute_julia_set.
+    // The file is finished (see image_file::finish) before this function
+    // returns.
+    // This function may also be called from inside a task of tp.
+    template <class Real>
+    void render_julia_set(const std::complex<Real>& bottom_left,
+                          const std::complex<Real>& top_right, const std::complex<Real>& c,
+                          int max_iters, image_file& out, ra::concurrency::thread_pool& tp) {
+        int height = out.height();
+        int width = out.width();
+
+        int tile = 256;
+        while (tile > 16 && (static_cast<long long>(height + tile - 1) / tile) * ((width + tile - 1) / tile) <
+                                16 * static_cast<long long>(tp.size())) {
+            tile /= 2;
+        }
+        int tile_rows = (height + tile - 1) / tile;
+        int tile_cols = (width + tile - 1) / tile;
+        long long num_tiles = static_cast<long long>(tile_rows) * tile_cols;
 
-        thread_pool tp(num_threads);
+        // The number of unfinished tiles of each band of tile rows.
+        std::unique_ptr<std::atomic<int>[]> band_remaining(new std::atomic<int>[tile_rows]);
+        for (int k = 0; k < tile_rows; ++k) {
+            band_remaining[k].store(tile_cols, std::memory_order_relaxed);
+        }
 
-        // Enqueue the tasks.
-        for (int i = 0; i < height; ++i) {
-            tp.schedule(std::move([&, i]() {
-                for (int j = 0; j < width; ++j) {
-                    a[height - i - 1][j] = julia_set_point<Real>(bottom_left, top_right, c,
-                                                                 max_iters, height, width, i, j);
+        std::atomic<long long> next_tile(0);
+        auto render_tiles = [&]() {
+            std::vector<int> buffer(static_cast<std::size_t>(tile) * tile);
+            for (long long t = next_tile.fetch_add(1, std::memory_order_relaxed); t < num_tiles;
+                 t = next_tile.fetch_add(1, std::memory_order_relaxed)) {
+                int band = static_cast<int>(t / tile_cols);
+                int row_begin = band * tile;
+                int row_end = std::min(row_begin + tile, height);
+                int col_begin = static_cast<int>(t % tile_cols) * tile;
+                int col_end = std::min(col_begin + tile, width);
+                // Row k of the buffer holds the image row row_end - k - 1,
+                // since the file stores the top row first.
+                for (int i = row_begin; i < row_end; ++i) {
+                    julia_set_span<Real>(bottom_left, top_right, c, max_iters, height, width, i, col_begin,
+                                         col_end, &buffer[static_cast<std::size_t>(row_end - i - 1) * tile]);
+                }
+                out.write_tile(height - row_end, col_begin, row_end - row_begin, col_end - col_begin,
+                               buffer.data(), tile);
+                if (band_remaining[band].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    out.finish_rows(height - row_end, height - row_begin);
                 }
-            }));
+            }
+        };
+
+        ra::concurrency::task_group group(tp);
+        long long num_tasks = std::min(static_cast<long long>(tp.size()), num_tiles);
+        for (long long k = 0; k < num_tasks; ++k) {
+            group.run(render_tiles);
         }
+        render_tiles();
 
         // Wait for all tasks to finish.
-        tp.shutdown();
+        group.wait();
+        out.finish();
     }
 
-    void print_result(const boost::multi_array<int, 2>& a) {
-        // Print the result.
-        std::cout << "P2 " << a.shape()[1] << " " << a.shape()[0] << " 255"
+    namespace detail {
+
+        // The state of a Mariani-Silver rendering (see
+        // compute_julia_set_subdivided).
+        // Rectangles are given by their inclusive bounds in image
+        // coordinates, where row i of the image is stored in row
+        // height - i - 1 of a.
+        template <class Real>
+        class mariani_silver {
+            public:
+                mariani_silver(const std::complex<Real>& bottom_left, const std::complex<Real>& top_right,
+                               const std::complex<Real>& c, int max_iters, boost::multi_array<int, 2>& a,
+                               ra::concurrency::task_group& group)
+                    : bottom_left_(bottom_left), top_right_(top_right), c_(c), max_iters_(max_iters),
+                      height_(a.shape()[0]), width_(a.shape()[1]), a_(a), group_(group), evaluated_(0) {}
+
+                // Renders the whole image.
+                // A uniform border proves nothing about a rectangle that
+                // encloses the whole Julia set (the escape-time bands then
+                // form rings around it), so the image is first cut into a
+                // grid x grid array of tiles, which are never filled as a
+                // whole.
+                void render() {
+                    std::vector<int> rows = grid_lines(height_);
+                    std::vector<int> columns = grid_lines(width_);
+                    for (int i : rows) {
+                        compute_row(i, 0, width_);
+                    }
+                    for (std::size_t k = 0; k + 1 < rows.size(); ++k) {
+                        for (int j : columns) {
+                            compute_column(j, rows[k] + 1, rows[k + 1]);
+                        }
+                    }
+                    for (std::size_t k = 0; k + 1 < rows.size(); ++k) {
+                        for (std::size_t l = 0; l + 1 < columns.size(); ++l) {
+                            int r0 = rows[k], r1 = rows[k + 1], c0 = columns[l], c1 = columns[l + 1];
+                            group_.run([this, r0, r1, c0, c1]() { split(r0, r1, c0, c1); });
+                        }
+                    }
+                }
+
+                // Fills the interior of the rectangle [r0, r1] x [c0, c1],
+                // whose border must already have been computed.
+                // If the border is uniform, the interior is filled with the
+                // same value; otherwise, the rectangle is split into four
+                // by computing a horizontal and a vertical line through
+                // it, and the quarters are processed recursively (large
+                // ones as nested tasks of the task group).
+                void subdivide(int r0, int r1, int c0, int c1) {
+                    if (r1 - r0 < 2 || c1 - c0 < 2) {
+                        return;
+                    }
+                    int value = 0;
+                    if (uniform_border(r0, r1, c0, c1, value)) {
+                        for (int i = r0 + 1; i < r1; ++i) {
+                            std::fill_n(&pixel(i, c0 + 1), c1 - c0 - 1, value);
+                        }
+                        return;
+                    }
+                    split(r0, r1, c0, c1);
+                }
+
+                // Returns the number of pixels evaluated so far.
+                std::uint64_t evaluated() const {
+                    return evaluated_.load(std::memory_order_relaxed);
+                }
+
+            private:
+                // The image is first cut into grid x grid tiles.
+                // Rectangles with a side of at most min_side pixels are not
+                // split further, and those with an area of at least
+                // min_task_area pixels are processed in a separate task.
+                static constexpr int grid = 4;
+                static constexpr int min_side = 8;
+                static constexpr int min_task_area = 64 * 64;
+
+                // Returns the distinct indices of the lines that cut n
+                // pixels into grid parts, including the first and last.
+                static std::vector<int> grid_lines(int n) {
+                    std::vector<int> lines;
+                    for (int k = 0; k <= grid; ++k) {
+                        int line = static_cast<int>(static_cast<long long>(n - 1) * k / grid);
+                        if (lines.empty() || lines.back() != line) {
+                            lines.push_back(line);
+                        }
+                    }
+                    return lines;
+                }
+
+                // Fills the interior of the rectangle [r0, r1] x [c0, c1]
+                // (whose border must already have been computed) without
+                // testing its border: small rectangles are computed pixel
+                // by pixel, and the others are split into four.
+                void split(int r0, int r1, int c0, int c1) {
+                    if (r1 - r0 < 2 || c1 - c0 < 2) {
+                        return;
+                    }
+                    if (r1 - r0 <= min_side || c1 - c0 <= min_side) {
+                        for (int i = r0 + 1; i < r1; ++i) {
+                            compute_row(i, c0 + 1, c1);
+                        }
+                        return;
+                    }
+
+                    int rm = r0 + (r1 - r0) / 2;
+                    int cm = c0 + (c1 - c0) / 2;
+                    compute_row(rm, c0 + 1, c1);
+                    compute_column(cm, r0 + 1, rm);
+                    compute_column(cm, rm + 1, r1);
+
+                    // Only the interiors of the quarters are written, and
+                    // they are disjoint.
+                    spawn(r0, rm, c0, cm);
+                    spawn(r0, rm, cm, c1);
+                    spawn(rm, r1, c0, cm);
+                    subdivide(rm, r1, cm, c1);
+                }
+
+                int& pixel(int i, int j) {
+                    return a_[height_ - i - 1][j];
+                }
+
+                void spawn(int r0, int r1, int c0, int c1) {
+                    if ((r1 - r0) * (c1 - c0) >= min_task_area) {
+                        group_.run([this, r0, r1, c0, c1]() { subdivide(r0, r1, c0, c1); });
+                    } else {
+                        subdivide(r0, r1, c0, c1);
+                    }
+                }
+
+                // Computes the pixels of row i in the columns [j_begin,
+                // j_end).
+                void compute_row(int i, int j_begin, int j_end) {
+                    if (j_begin < j_end) {
+                        julia_set_span<Real>(bottom_left_, top_right_, c_, max_iters_, height_, width_, i,
+                                             j_begin, j_end, &pixel(i, j_begin));
+                        evaluated_.fetch_add(j_end - j_begin, std::memory_order_relaxed);
+                    }
+                }
+
+                // Computes the pixels of column j in the rows [i_begin,
+                // i_end).
+                void compute_column(int j, int i_begin, int i_end) {
+                    for (int i = i_begin; i < i_end; ++i) {
+                        pixel(i, j) = julia_set_point<Real>(bottom_left_, top_right_, c_, max_iters_, height_,
+                                                            width_, i, j);
+                    }
+                    if (i_begin < i_end) {
+                        evaluated_.fetch_add(i_end - i_begin, std::memory_order_relaxed);
+                    }
+                }
+
+                // Returns if all pixels of the border of the rectangle
+                // [r0, r1] x [c0, c1] have the same value, which is then
+                // stored in value.
+                bool uniform_border(int r0, int r1, int c0, int c1, int& value) {
+                    value = pixel(r0, c0);
+                    for (int j = c0; j <= c1; ++j) {
+                        if (pixel(r0, j) != value || pixel(r1, j) != value) {
+                            return false;
+                        }
+                    }
+                    for (int i = r0 + 1; i < r1; ++i) {
+                        if (pixel(i, c0) != value || pixel(i, c1) != value) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+
+                std::complex<Real> bottom_left_;
+                std::complex<Real> top_right_;
+                std::complex<Real> c_;
+                int max_iters_;
+                int height_;
+                int width_;
+                boost::multi_array<int, 2>& a_;
+                ra::concurrency::task_group& group_;
+                std::atomic<std::uint64_t> evaluated_;
+        };
+
+    }  // namespace detail
+
+    // Computes the Julia set as compute_julia_set does, but using the
+    // Mariani-Silver algorithm: the border of a rectangle is computed
+    // first, and if all its pixels have the same value, the interior is
+    // filled with that value without being iterated; otherwise, the
+    // rectangle is subdivided recursively, with the subdivisions running as
+    // nested tasks on the thread pool tp.
+    // This relies on the regions of equal value being simply connected,
+    // which holds for connected Julia sets up to the sampling of the
+    // image, so a few pixels may differ from those computed by
+    // compute_julia_set (e.g., thin filaments that cross no border).
+    // Returns the number of pixels that were actually evaluated.
+    // This function may also be called from inside a task of tp.
+    template <class Real>
+    std::uint64_t compute_julia_set_subdivided(const std::complex<Real>& bottom_left,
+                                               const std::complex<Real>& top_right,
+                                               const std::complex<Real>& c, int max_iters,
+                                               boost::multi_array<int, 2>& a,
+                                               ra::concurrency::thread_pool& tp) {
+        int height = a.shape()[0];
+        int width = a.shape()[1];
+        if (height == 0 || width == 0) {
+            return 0;
+        }
+
+        ra::concurrency::task_group group(tp);
+        detail::mariani_silver<Real> renderer(bottom_left, top_right, c, max_iters, a, group);
+        renderer.render();
+
+        // Wait for all tasks to finish.
+        group.wait();
+        return renderer.evaluated();
+    }
+
+    // Zeroes a, such that its pages are placed on the NUMA nodes of the
+    // threads of tp that compute_julia_set will have write them (see
+    // ra::concurrency::first_touch).
+    inline void first_touch(boost::multi_array<int, 2>& a, ra::concurrency::thread_pool& tp) {
+        ra::concurrency::first_touch(tp, a.data(), a.num_elements() * sizeof(int));
+    }
+
+    // Prints a as a plain (ASCII) PGM image to standard output.
+    // Each row is formatted into a buffer and written at once; see
+    // image_file for the much more compact binary formats.
+    inline void print_result(const boost::multi_array<int, 2>& a) {
+        std::size_t height = a.shape()[0];
+        std::size_t width = a.shape()[1];
+        std::cout << "P2 " << width << " " << height << " 255"
                   << "\n";
-        for (int i = 0; i < a.shape()[0]; ++i) {
-            for (int j = 0; j < a.shape()[1]; ++j) {
-                std::cout << a[i][j] << ((j == a.shape()[1] - 1) ? "" : " ");
+        std::string line;
+        char number[16];
+        for (std::size_t i = 0; i < height; ++i) {
+            line.clear();
+            for (std::size_t j = 0; j < width; ++j) {
+                char* end = std::to_chars(number, number + sizeof(number), a[i][j]).ptr;
+                line.append(number, end);
+                line += (j == width - 1) ? '\n' : ' ';
             }
-            std::cout << "\n";
+            if (width == 0) {
+                line += '\n';
+            }
+            std::cout.write(line.data(), line.size());
         }
     }
-}  // namespace ra::fractal
\ No newline at end of file
+}  // namespace ra::fractal
+
+#endif  // JULIA_SET_HPP
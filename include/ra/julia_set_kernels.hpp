@@ -0,0 +1,291 @@
+#ifndef JULIA_SET_KERNELS_HPP
+#define JULIA_SET_KERNELS_HPP
+
+#include <complex>
+#include <type_traits>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define RA_JULIA_SET_X86_SIMD 1
+// Some AVX-512 intrinsics start from a deliberately undefined vector, which
+// GCC reports as an uninitialized use when optimizing.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#else
+#define RA_JULIA_SET_X86_SIMD 0
+#endif
+
+// The vector kernels must perform exactly the same floating-point
+// operations as the scalar kernel, so contracting a multiply and an add
+// into a fused multiply-add (which rounds only once) must be disabled in
+// the kernels (and only there, so that the files including this header
+// keep the contraction mode of the build): RA_JULIA_SET_NO_CONTRACT
+// marks such a function (for GCC), and RA_JULIA_SET_NO_CONTRACT_BODY
+// starts its body (for Clang, whose pragma is scoped to the block).
+#if defined(__clang__)
+#define RA_JULIA_SET_NO_CONTRACT
+#define RA_JULIA_SET_NO_CONTRACT_BODY _Pragma("clang fp contract(off)")
+#elif defined(__GNUC__)
+#define RA_JULIA_SET_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#define RA_JULIA_SET_NO_CONTRACT_BODY
+#else
+#define RA_JULIA_SET_NO_CONTRACT
+#define RA_JULIA_SET_NO_CONTRACT_BODY
+#endif
+
+namespace ra::fractal {
+
+    // Returns the number of iterations of z -> z * z + c after which |z|
+    // exceeds 2, where z starts at the point of the rectangle
+    // [bottom_left, top_right] that corresponds to row x and column y of
+    // a height x width image, or max_iters if |z| never exceeds 2 within
+    // max_iters iterations.
+    // The escape test compares the squared magnitude of z against 4, which
+    // avoids a square root per iteration.
+    template <typename T>
+    RA_JULIA_SET_NO_CONTRACT int julia_set_point(const std::complex<T>& bottom_left,
+                                                 const std::complex<T>& top_right, const std::complex<T>& c,
+                                                 int max_iters, int height, int width, int x, int y) {
+        RA_JULIA_SET_NO_CONTRACT_BODY
+        T zr = bottom_left.real() + (T(y) / T(width - 1)) * (top_right.real() - bottom_left.real());
+        T zi = bottom_left.imag() + (T(x) / T(height - 1)) * (top_right.imag() - bottom_left.imag());
+
+        for (int i = 0; i < max_iters; ++i) {
+            T zr2 = zr * zr;
+            T zi2 = zi * zi;
+            if (zr2 + zi2 > T(4)) {
+                return i;
+            }
+            zi = (zr + zr) * zi + c.imag();
+            zr = (zr2 - zi2) + c.real();
+        }
+        // return the smallest value for which |z| > 2 or the max_iters if not exist.
+        return max_iters;
+    }
+
+    // The instruction sets for which a vectorized kernel exists.
+    enum class simd_isa {
+        scalar = 0,  // no vectorization
+        avx2,        // 256-bit vectors (8 floats or 4 doubles)
+        avx512,      // 512-bit vectors (16 floats or 8 doubles)
+    };
+
+    // Returns the widest instruction set supported by the processor.
+    inline simd_isa detected_simd_isa() {
+#if RA_JULIA_SET_X86_SIMD
+        static const simd_isa isa = []() {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) {
+                return simd_isa::avx512;
+            }
+            if (__builtin_cpu_supports("avx2")) {
+                return simd_isa::avx2;
+            }
+            return simd_isa::scalar;
+        }();
+        return isa;
+#else
+        return simd_isa::scalar;
+#endif
+    }
+
+    namespace detail {
+
+#if RA_JULIA_SET_X86_SIMD
+        // The vector kernels below compute julia_set_point for the pixels
+        // (x, y), ..., (x, y + lanes - 1) at once, where zi is the
+        // (common) imaginary part of their starting points, and store the
+        // results in out.
+        // Each lane stops counting once it has escaped, and the loop ends
+        // as soon as all lanes have escaped.
+
+        __attribute__((target("avx2"))) RA_JULIA_SET_NO_CONTRACT inline void julia_set_lanes_avx2(
+            float left, float scale, float width_minus_one, float zi0, float cr, float ci,
+            int max_iters, int y, int* out) {
+            RA_JULIA_SET_NO_CONTRACT_BODY
+            const __m256 four = _mm256_set1_ps(4.0f);
+            const __m256 vcr = _mm256_set1_ps(cr);
+            const __m256 vci = _mm256_set1_ps(ci);
+            __m256 vy = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(y),
+                                                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+            __m256 zr = _mm256_add_ps(_mm256_set1_ps(left),
+                                      _mm256_mul_ps(_mm256_div_ps(vy, _mm256_set1_ps(width_minus_one)),
+                                                    _mm256_set1_ps(scale)));
+            __m256 zi = _mm256_set1_ps(zi0);
+            __m256 active = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            __m256i counts = _mm256_setzero_si256();
+
+            for (int i = 0; i < max_iters; ++i) {
+                __m256 zr2 = _mm256_mul_ps(zr, zr);
+                __m256 zi2 = _mm256_mul_ps(zi, zi);
+                __m256 escaped = _mm256_cmp_ps(_mm256_add_ps(zr2, zi2), four, _CMP_GT_OQ);
+                active = _mm256_andnot_ps(escaped, active);
+                if (_mm256_testz_ps(active, active)) {
+                    break;
+                }
+                counts = _mm256_sub_epi32(counts, _mm256_castps_si256(active));
+                zi = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(zr, zr), zi), vci);
+                zr = _mm256_add_ps(_mm256_sub_ps(zr2, zi2), vcr);
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), counts);
+        }
+
+        __attribute__((target("avx2"))) RA_JULIA_SET_NO_CONTRACT inline void julia_set_lanes_avx2(
+            double left, double scale, double width_minus_one, double zi0, double cr, double ci,
+            int max_iters, int y, int* out) {
+            RA_JULIA_SET_NO_CONTRACT_BODY
+            const __m256d four = _mm256_set1_pd(4.0);
+            const __m256d one = _mm256_set1_pd(1.0);
+            const __m256d vcr = _mm256_set1_pd(cr);
+            const __m256d vci = _mm256_set1_pd(ci);
+            __m256d vy = _mm256_cvtepi32_pd(_mm_add_epi32(_mm_set1_epi32(y), _mm_setr_epi32(0, 1, 2, 3)));
+            __m256d zr = _mm256_add_pd(_mm256_set1_pd(left),
+                                       _mm256_mul_pd(_mm256_div_pd(vy, _mm256_set1_pd(width_minus_one)),
+                                                     _mm256_set1_pd(scale)));
+            __m256d zi = _mm256_set1_pd(zi0);
+            __m256d active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+            __m256d counts = _mm256_setzero_pd();
+
+            for (int i = 0; i < max_iters; ++i) {
+                __m256d zr2 = _mm256_mul_pd(zr, zr);
+                __m256d zi2 = _mm256_mul_pd(zi, zi);
+                __m256d escaped = _mm256_cmp_pd(_mm256_add_pd(zr2, zi2), four, _CMP_GT_OQ);
+                active = _mm256_andnot_pd(escaped, active);
+                if (_mm256_testz_pd(active, active)) {
+                    break;
+                }
+                counts = _mm256_add_pd(counts, _mm256_and_pd(active, one));
+                zi = _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(zr, zr), zi), vci);
+                zr = _mm256_add_pd(_mm256_sub_pd(zr2, zi2), vcr);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_cvtpd_epi32(counts));
+        }
+
+        __attribute__((target("avx512f"))) RA_JULIA_SET_NO_CONTRACT inline void julia_set_lanes_avx512(
+            float left, float scale, float width_minus_one, float zi0, float cr, float ci,
+            int max_iters, int y, int* out) {
+            RA_JULIA_SET_NO_CONTRACT_BODY
+            const __m512 four = _mm512_set1_ps(4.0f);
+            const __m512i one = _mm512_set1_epi32(1);
+            const __m512 vcr = _mm512_set1_ps(cr);
+            const __m512 vci = _mm512_set1_ps(ci);
+            __m512 vy = _mm512_cvtepi32_ps(_mm512_add_epi32(
+                _mm512_set1_epi32(y), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)));
+            __m512 zr = _mm512_add_ps(_mm512_set1_ps(left),
+                                      _mm512_mul_ps(_mm512_div_ps(vy, _mm512_set1_ps(width_minus_one)),
+                                                    _mm512_set1_ps(scale)));
+            __m512 zi = _mm512_set1_ps(zi0);
+            __mmask16 active = 0xffff;
+            __m512i counts = _mm512_setzero_si512();
+
+            for (int i = 0; i < max_iters; ++i) {
+                __m512 zr2 = _mm512_mul_ps(zr, zr);
+                __m512 zi2 = _mm512_mul_ps(zi, zi);
+                active &= static_cast<__mmask16>(~_mm512_cmp_ps_mask(_mm512_add_ps(zr2, zi2), four, _CMP_GT_OQ));
+                if (!active) {
+                    break;
+                }
+                counts = _mm512_mask_add_epi32(counts, active, counts, one);
+                zi = _mm512_add_ps(_mm512_mul_ps(_mm512_add_ps(zr, zr), zi), vci);
+                zr = _mm512_add_ps(_mm512_sub_ps(zr2, zi2), vcr);
+            }
+            _mm512_storeu_si512(out, counts);
+        }
+
+        __attribute__((target("avx512f"))) RA_JULIA_SET_NO_CONTRACT inline void julia_set_lanes_avx512(
+            double left, double scale, double width_minus_one, double zi0, double cr, double ci,
+            int max_iters, int y, int* out) {
+            RA_JULIA_SET_NO_CONTRACT_BODY
+            const __m512d four = _mm512_set1_pd(4.0);
+            const __m512i one = _mm512_set1_epi64(1);
+            const __m512d vcr = _mm512_set1_pd(cr);
+            const __m512d vci = _mm512_set1_pd(ci);
+            __m512d vy = _mm512_cvtepi32_pd(_mm256_add_epi32(_mm256_set1_epi32(y),
+                                                             _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+            __m512d zr = _mm512_add_pd(_mm512_set1_pd(left),
+                                       _mm512_mul_pd(_mm512_div_pd(vy, _mm512_set1_pd(width_minus_one)),
+                                                     _mm512_set1_pd(scale)));
+            __m512d zi = _mm512_set1_pd(zi0);
+            __mmask8 active = 0xff;
+            __m512i counts = _mm512_setzero_si512();
+
+            for (int i = 0; i < max_iters; ++i) {
+                __m512d zr2 = _mm512_mul_pd(zr, zr);
+                __m512d zi2 = _mm512_mul_pd(zi, zi);
+                active &= static_cast<__mmask8>(~_mm512_cmp_pd_mask(_mm512_add_pd(zr2, zi2), four, _CMP_GT_OQ));
+                if (!active) {
+                    break;
+                }
+                counts = _mm512_mask_add_epi64(counts, active, counts, one);
+                zi = _mm512_add_pd(_mm512_mul_pd(_mm512_add_pd(zr, zr), zi), vci);
+                zr = _mm512_add_pd(_mm512_sub_pd(zr2, zi2), vcr);
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm512_cvtepi64_epi32(counts));
+        }
+#endif
+
+    }  // namespace detail
+
+    // Computes julia_set_point for the pixels in columns [y_begin, y_end)
+    // of row x, and stores the result for column y in out[y - y_begin].
+    // For float and double, the pixels are processed several at a time
+    // with the vector instruction set isa (if it is available; columns
+    // that do not fill a whole vector are processed one at a time). The
+    // results are identical to those of julia_set_point for every
+    // instruction set.
+    template <typename T>
+    RA_JULIA_SET_NO_CONTRACT void julia_set_span(const std::complex<T>& bottom_left,
+                                                 const std::complex<T>& top_right, const std::complex<T>& c,
+                                                 int max_iters, int height, int width, int x, int y_begin,
+                                                 int y_end, int* out, simd_isa isa) {
+        RA_JULIA_SET_NO_CONTRACT_BODY
+        int y = y_begin;
+
+#if RA_JULIA_SET_X86_SIMD
+        if constexpr (std::is_same_v<T, float> || std::is_same_v<T, double>) {
+            if (isa != simd_isa::scalar) {
+                // The same operations as in julia_set_point, with the
+                // operands that are common to all pixels hoisted.
+                T left = bottom_left.real();
+                T scale = top_right.real() - bottom_left.real();
+                T width_minus_one = T(width - 1);
+                T zi = bottom_left.imag() + (T(x) / T(height - 1)) * (top_right.imag() - bottom_left.imag());
+
+                if (isa == simd_isa::avx512) {
+                    constexpr int lanes = 64 / sizeof(T);
+                    for (; y + lanes <= y_end; y += lanes) {
+                        detail::julia_set_lanes_avx512(left, scale, width_minus_one, zi, c.real(), c.imag(),
+                                                       max_iters, y, out + (y - y_begin));
+                    }
+                } else {
+                    constexpr int lanes = 32 / sizeof(T);
+                    for (; y + lanes <= y_end; y += lanes) {
+                        detail::julia_set_lanes_avx2(left, scale, width_minus_one, zi, c.real(), c.imag(),
+                                                     max_iters, y, out + (y - y_begin));
+                    }
+                }
+            }
+        }
+#else
+        (void) isa;
+#endif
+
+        for (; y < y_end; ++y) {
+            out[y - y_begin] = julia_set_point<T>(bottom_left, top_right, c, max_iters, height, width, x, y);
+        }
+    }
+
+    // Computes julia_set_point for the pixels in columns [y_begin, y_end)
+    // of row x with the widest instruction set supported by the processor.
+    template <typename T>
+    void julia_set_span(const std::complex<T>& bottom_left,
+                        const std::complex<T>& top_right, const std::complex<T>& c,
+                        int max_iters, int height, int width, int x, int y_begin, int y_end, int* out) {
+        julia_set_span<T>(bottom_left, top_right, c, max_iters, height, width, x, y_begin, y_end, out,
+                          detected_simd_isa());
+    }
+
+}  // namespace ra::fractal
+
+#endif  // JULIA_SET_KERNELS_HPP
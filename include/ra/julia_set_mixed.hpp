@@ -0,0 +1,147 @@
+#ifndef JULIA_SET_MIXED_HPP
+#define JULIA_SET_MIXED_HPP
+
+#include <algorithm>
+#include <boost/multi_array.hpp>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <functional>
+#include <ra/julia_set.hpp>
+#include <ra/julia_set_kernels.hpp>
+#include <ra/parallel.hpp>
+#include <ra/thread_pool.hpp>
+#include <vector>
+
+namespace ra::fractal {
+
+    // Options of compute_julia_set_mixed.
+    struct mixed_precision_options {
+        // The float result of a pixel is recomputed if some pixel in the
+        // (2 * radius + 1) x (2 * radius + 1) square around it has a
+        // different float result (i.e., the pixel lies on the edge of an
+        // escape-time band or of the Julia set), ...
+        int radius = 1;
+
+        // ... unless the pixel escaped after fewer than trusted_iters
+        // iterations, which are too few for the rounding errors of float
+        // to grow to a significant fraction of the pixel spacing.
+        int trusted_iters = 8;
+
+        // The smallest pixel spacing, relative to the magnitude of the
+        // coordinates of the view, that is rendered in float first; views
+        // with finer pixels are rendered entirely in high precision.
+        double min_relative_spacing = 1.0 / 65536;
+    };
+
+    // Statistics of a rendering by compute_julia_set_mixed.
+    struct mixed_precision_stats {
+        // The number of pixels computed in high precision.
+        std::uint64_t recomputed = 0;
+        // Whether the whole image was computed in high precision because
+        // its pixels are too fine for float.
+        bool fallback = false;
+    };
+
+    // Computes the Julia set as compute_julia_set<Real> does, but renders
+    // the whole image in float first (with the vector kernels, see
+    // julia_set_span), and then recomputes in Real only the pixels whose
+    // float result is precision-sensitive (see mixed_precision_options).
+    // The recomputed pixels have exactly the values of compute_julia_set
+    // <Real>; the other pixels keep their float values, of which at most
+    // about 0.01% differ from the values of compute_julia_set<Real> for
+    // typical views (isolated pixels inside the Julia set or on band edges
+    // whose neighbours happen to round the same way).
+    // Both passes run on the thread pool tp (see parallel_for), so this
+    // function may also be called from inside a task of tp.
+    template <class Real>
+    mixed_precision_stats compute_julia_set_mixed(const std::complex<Real>& bottom_left,
+                                                  const std::complex<Real>& top_right,
+                                                  const std::complex<Real>& c, int max_iters,
+                                                  boost::multi_array<int, 2>& a,
+                                                  ra::concurrency::thread_pool& tp,
+                                                  const mixed_precision_options& options = {}) {
+        mixed_precision_stats stats;
+        int height = a.shape()[0];
+        int width = a.shape()[1];
+        if (height == 0 || width == 0) {
+            return stats;
+        }
+
+        // If the pixel spacing is not well above the resolution of float
+        // at the coordinates of the view, float cannot even tell the
+        // pixels apart.
+        Real magnitude = std::max({std::abs(bottom_left.real()), std::abs(bottom_left.imag()),
+                                   std::abs(top_right.real()), std::abs(top_right.imag())});
+        Real spacing = std::abs(top_right.real() - bottom_left.real()) / Real(std::max(width - 1, 1));
+        if (height > 1) {
+            spacing = std::min(spacing, std::abs(top_right.imag() - bottom_left.imag()) / Real(height - 1));
+        }
+        if (width == 1 && height == 1) {
+            spacing = magnitude;
+        }
+        if (spacing < magnitude * Real(options.min_relative_spacing)) {
+            compute_julia_set<Real>(bottom_left, top_right, c, max_iters, a, tp);
+            stats.recomputed = static_cast<std::uint64_t>(height) * width;
+            stats.fallback = true;
+            return stats;
+        }
+
+        compute_julia_set<float>(std::complex<float>(bottom_left), std::complex<float>(top_right),
+                                 std::complex<float>(c), max_iters, a, tp);
+
+        // Mark the precision-sensitive pixels (before any of them changes).
+        std::vector<unsigned char> sensitive(static_cast<std::size_t>(height) * width);
+        int radius = options.radius;
+        ra::concurrency::parallel_for(tp, 0, height, [&](int i) {
+            int i0 = std::max(i - radius, 0);
+            int i1 = std::min(i + radius, height - 1);
+            for (int j = 0; j < width; ++j) {
+                int value = a[i][j];
+                if (value < options.trusted_iters) {
+                    continue;
+                }
+                int j0 = std::max(j - radius, 0);
+                int j1 = std::min(j + radius, width - 1);
+                bool differs = false;
+                for (int k = i0; k <= i1 && !differs; ++k) {
+                    for (int l = j0; l <= j1; ++l) {
+                        if (a[k][l] != value) {
+                            differs = true;
+                            break;
+                        }
+                    }
+                }
+                sensitive[static_cast<std::size_t>(i) * width + j] = differs;
+            }
+        });
+
+        // Recompute the runs of sensitive pixels of each row in Real.
+        stats.recomputed = ra::concurrency::parallel_reduce(
+            tp, 0, height, std::uint64_t(0), std::plus<>(), [&](int i) {
+                const unsigned char* row = &sensitive[static_cast<std::size_t>(i) * width];
+                std::uint64_t count = 0;
+                int j = 0;
+                while (j < width) {
+                    if (!row[j]) {
+                        ++j;
+                        continue;
+                    }
+                    int run_end = j;
+                    while (run_end < width && row[run_end]) {
+                        ++run_end;
+                    }
+                    // Row i of a holds row height - i - 1 of the image.
+                    julia_set_span<Real>(bottom_left, top_right, c, max_iters, height, width, height - i - 1, j,
+                                         run_end, &a[i][j]);
+                    count += run_end - j;
+                    j = run_end;
+                }
+                return count;
+            });
+        return stats;
+    }
+
+}  // namespace ra::fractal
+
+#endif  // JULIA_SET_MIXED_HPP
@@ -0,0 +1,251 @@
+#ifndef JULIA_SET_PERTURBATION_HPP
+#define JULIA_SET_PERTURBATION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <boost/multi_array.hpp>
+#include <complex>
+#include <cstdint>
+#include <mutex>
+#include <ra/julia_set_kernels.hpp>
+#include <ra/thread_pool.hpp>
+#include <utility>
+#include <vector>
+
+namespace ra::fractal {
+
+    // Statistics of a rendering by compute_julia_set_perturbed.
+    struct perturbation_stats {
+        // The number of reference orbits computed.
+        int references = 0;
+        // The number of pixels that were glitched with respect to the
+        // first reference and had to be iterated again.
+        std::uint64_t glitched = 0;
+        // The number of pixels that were still glitched after the last
+        // reference and were computed directly in high precision.
+        std::uint64_t fallback = 0;
+    };
+
+    namespace detail {
+
+        // Computes the orbit Z_0 = z0, Z_{n+1} = Z_n^2 + c in the precision
+        // of High, rounded to double, up to and including the first point
+        // that escapes or up to Z_max_iters.
+        template <class High>
+        void reference_orbit(const std::complex<High>& z0, const std::complex<High>& c, int max_iters,
+                             std::vector<double>& zr_out, std::vector<double>& zi_out) {
+            zr_out.clear();
+            zi_out.clear();
+            High zr = z0.real();
+            High zi = z0.imag();
+            for (int n = 0;; ++n) {
+                zr_out.push_back(static_cast<double>(zr));
+                zi_out.push_back(static_cast<double>(zi));
+                High zr2 = zr * zr;
+                High zi2 = zi * zi;
+                if (n == max_iters || zr2 + zi2 > High(4)) {
+                    return;
+                }
+                zi = (zr + zr) * zi + c.imag();
+                zr = (zr2 - zi2) + c.real();
+            }
+        }
+
+        // A reference orbit and the pixel (row x, column y) it starts from.
+        struct reference {
+            int x;
+            int y;
+            std::vector<double> zr;
+            std::vector<double> zi;
+        };
+
+        // Iterates the pixel whose starting point differs from that of the
+        // reference ref by (dr, di), as the difference
+        // delta_{n+1} = 2 Z_n delta_n + delta_n^2 from the reference orbit
+        // Z_n, all in double.
+        // Returns the iteration count as julia_set_point does, or -1 if the
+        // pixel is glitched: its orbit came so close to 0, relative to the
+        // reference orbit, that the rounding errors of the difference
+        // dominate (Pauldelbrot's criterion |Z_n + delta_n| <
+        // tolerance * |Z_n|), or the reference escaped first.
+        inline int perturbed_point(const reference& ref, double dr, double di, int max_iters) {
+            // The square of the glitch tolerance 1e-3.
+            constexpr double tolerance2 = 1e-6;
+            const int length = static_cast<int>(ref.zr.size());
+            for (int n = 0; n < max_iters; ++n) {
+                if (n >= length) {
+                    return -1;
+                }
+                double Zr = ref.zr[n];
+                double Zi = ref.zi[n];
+                double zr = Zr + dr;
+                double zi = Zi + di;
+                double magnitude = zr * zr + zi * zi;
+                if (magnitude > 4) {
+                    return n;
+                }
+                if (magnitude < tolerance2 * (Zr * Zr + Zi * Zi)) {
+                    return -1;
+                }
+                double new_dr = 2 * (Zr * dr - Zi * di) + (dr * dr - di * di);
+                di = 2 * (Zr * di + Zi * dr) + 2 * dr * di;
+                dr = new_dr;
+            }
+            return max_iters;
+        }
+
+    }  // namespace detail
+
+    // Computes the Julia set as compute_julia_set does, for deep zooms
+    // where the distance between neighboring pixels is too small for
+    // double (or even for long double) to resolve.
+    // A single reference orbit, from the center of the image, is computed
+    // in the precision of High; every pixel is then iterated in double as
+    // its (small) difference from the reference orbit, so the image
+    // renders at nearly the speed of double.
+    // Pixels for which this difference becomes inaccurate (see
+    // detail::perturbed_point) are collected and iterated again against a
+    // new reference orbit, taken from one of them, up to max_references
+    // references in total; any pixels still glitched after that are
+    // computed directly with julia_set_point<High>.
+    // The results usually agree with julia_set_point<High>, but may differ
+    // where the orbit is chaotic, as the rounding errors differ.
+    // With the default High = long double, the view can be about a
+    // thousand times narrower than with double; for deeper zooms, use a
+    // wider type such as __float128 (GCC), whose slowness then only
+    // affects the reference orbits.
+    // This function may also be called from inside a task of tp.
+    template <class High = long double>
+    perturbation_stats compute_julia_set_perturbed(const std::complex<High>& bottom_left,
+                                                   const std::complex<High>& top_right,
+                                                   const std::complex<High>& c, int max_iters,
+                                                   boost::multi_array<int, 2>& a,
+                                                   ra::concurrency::thread_pool& tp,
+                                                   int max_references = 16) {
+        perturbation_stats stats;
+        int height = a.shape()[0];
+        int width = a.shape()[1];
+        if (height == 0 || width == 0) {
+            return stats;
+        }
+
+        // The starting point of pixel (x, y) is computed exactly as in
+        // julia_set_point, and its offset from the reference point from the
+        // pixel offsets, which only needs the (representable) size of the
+        // view in double.
+        auto start_point = [&](int x, int y) {
+            return std::complex<High>(
+                bottom_left.real() + (High(y) / High(width - 1)) * (top_right.real() - bottom_left.real()),
+                bottom_left.imag() + (High(x) / High(height - 1)) * (top_right.imag() - bottom_left.imag()));
+        };
+        double span_r = static_cast<double>(top_right.real() - bottom_left.real());
+        double span_i = static_cast<double>(top_right.imag() - bottom_left.imag());
+        double den_r = width > 1 ? double(width - 1) : 1.0;
+        double den_i = height > 1 ? double(height - 1) : 1.0;
+
+        detail::reference ref;
+        auto make_reference = [&](int x, int y) {
+            ref.x = x;
+            ref.y = y;
+            detail::reference_orbit<High>(start_point(x, y), c, max_iters, ref.zr, ref.zi);
+            ++stats.references;
+        };
+        auto iterate = [&](int x, int y) {
+            return detail::perturbed_point(ref, (double(y - ref.y) / den_r) * span_r,
+                                           (double(x - ref.x) / den_i) * span_i, max_iters);
+        };
+
+        // The glitched pixels, as (row, column) pairs of the image.
+        std::vector<std::pair<int, int>> glitched;
+        std::mutex glitched_mutex;
+
+        // First pass: all pixels, by bands of rows.
+        make_reference(height / 2, width / 2);
+        {
+            const int band = 16;
+            std::atomic<int> next_band(0);
+            int num_bands = (height + band - 1) / band;
+            auto render_bands = [&]() {
+                std::vector<std::pair<int, int>> local;
+                for (int b = next_band.fetch_add(1, std::memory_order_relaxed); b < num_bands;
+                     b = next_band.fetch_add(1, std::memory_order_relaxed)) {
+                    for (int i = b * band; i < std::min((b + 1) * band, height); ++i) {
+                        for (int j = 0; j < width; ++j) {
+                            int n = iterate(i, j);
+                            if (n < 0) {
+                                local.emplace_back(i, j);
+                            } else {
+                                a[height - i - 1][j] = n;
+                            }
+                        }
+                    }
+                }
+                std::lock_guard<std::mutex> lock(glitched_mutex);
+                glitched.insert(glitched.end(), local.begin(), local.end());
+            };
+            ra::concurrency::task_group group(tp);
+            int num_tasks = std::min(static_cast<int>(tp.size()), num_bands);
+            for (int k = 0; k < num_tasks; ++k) {
+                group.run(render_bands);
+            }
+            render_bands();
+            group.wait();
+        }
+        stats.glitched = glitched.size();
+
+        // Iterates the glitched pixels in parallel with compute, which
+        // returns -1 for pixels that are still glitched; these are kept
+        // in glitched.
+        auto redo_glitched = [&](auto compute) {
+            std::vector<std::pair<int, int>> remaining;
+            const std::size_t chunk = 4096;
+            std::atomic<std::size_t> next(0);
+            auto render_glitched = [&]() {
+                std::vector<std::pair<int, int>> local;
+                for (std::size_t k = next.fetch_add(chunk, std::memory_order_relaxed); k < glitched.size();
+                     k = next.fetch_add(chunk, std::memory_order_relaxed)) {
+                    for (std::size_t m = k; m < std::min(k + chunk, glitched.size()); ++m) {
+                        auto [i, j] = glitched[m];
+                        int n = compute(i, j);
+                        if (n < 0) {
+                            local.emplace_back(i, j);
+                        } else {
+                            a[height - i - 1][j] = n;
+                        }
+                    }
+                }
+                std::lock_guard<std::mutex> lock(glitched_mutex);
+                remaining.insert(remaining.end(), local.begin(), local.end());
+            };
+            ra::concurrency::task_group group(tp);
+            std::size_t num_tasks = std::min(tp.size(), (glitched.size() + chunk - 1) / chunk);
+            for (std::size_t k = 0; k < num_tasks; ++k) {
+                group.run(render_glitched);
+            }
+            render_glitched();
+            group.wait();
+            glitched = std::move(remaining);
+        };
+
+        // Further passes: the glitched pixels, against a reference taken
+        // from them. The reference pixel itself is never glitched, so each
+        // pass makes progress.
+        while (!glitched.empty() && stats.references < max_references) {
+            std::sort(glitched.begin(), glitched.end());
+            auto [x, y] = glitched[glitched.size() / 2];
+            make_reference(x, y);
+            redo_glitched(iterate);
+        }
+
+        stats.fallback = glitched.size();
+        if (!glitched.empty()) {
+            redo_glitched([&](int i, int j) {
+                return julia_set_point<High>(bottom_left, top_right, c, max_iters, height, width, i, j);
+            });
+        }
+        return stats;
+    }
+
+}  // namespace ra::fractal
+
+#endif  // JULIA_SET_PERTURBATION_HPP
@@ -0,0 +1,349 @@
+#ifndef JULIA_TILE_CACHE_HPP
+#define JULIA_TILE_CACHE_HPP
+
+#include <algorithm>
+#include <boost/multi_array.hpp>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <ra/julia_set_kernels.hpp>
+#include <ra/parallel.hpp>
+#include <ra/thread_pool.hpp>
+#include <stdexcept>
+#include <stop_token>
+#include <unordered_map>
+#include <vector>
+
+namespace ra::fractal {
+
+    // Statistics of a rendering by julia_tile_cache.
+    struct tile_render_stats {
+        // The number of tiles taken from the cache.
+        std::size_t tiles_hit = 0;
+        // The number of tiles computed (and added to the cache).
+        std::size_t tiles_computed = 0;
+        // Whether the image was completed (i.e., no stop was requested).
+        bool complete = true;
+    };
+
+    // Cache of the iteration counts of Julia sets for interactive
+    // viewers, which re-render the view on every pan or zoom.
+    // The complex plane is covered by a fixed grid of pixels per zoom
+    // level: at zoom level z, pixel (x, y) (for any integers x and y) is
+    // the point (x * s, y * s), where s = spacing * 2^-z and spacing is
+    // the pixel spacing at zoom level 0. The pixels of each level are
+    // grouped into square tiles of tile_size x tile_size pixels, and the
+    // tiles are computed and cached as a whole, keyed by the constant c,
+    // max_iters, the zoom level, and the position of the tile in the grid.
+    // A view is given by its zoom level and the grid position of its
+    // bottom-left pixel, so that panning a view only computes the tiles
+    // that it newly exposes, and returning to an earlier view (or zoom
+    // level) computes nothing at all.
+    // At most memory_budget bytes of iteration counts are cached; when a
+    // new tile would exceed the budget, the least recently used tiles are
+    // evicted.
+    // The tiles are computed with julia_set_span, so each pixel has the
+    // value of julia_set_point for its grid point (up to the rounding of
+    // the coordinates of the point).
+    // A julia_tile_cache must not be used by several threads at once; the
+    // tiles of a view are computed in parallel on the thread pool passed
+    // to render.
+    template <class Real>
+    class julia_tile_cache {
+        public:
+            // Creates an empty cache for the grid with the pixel spacing
+            // spacing at zoom level 0.
+            // Throws std::invalid_argument if spacing is not positive or
+            // tile_size is less than 2.
+            julia_tile_cache(Real spacing, int tile_size = 64, std::size_t memory_budget = std::size_t(64) << 20)
+                : spacing_(spacing),
+                  tile_size_(tile_size),
+                  capacity_(std::max<std::size_t>(
+                      1, memory_budget / (static_cast<std::size_t>(std::max(tile_size, 1)) *
+                                          static_cast<std::size_t>(std::max(tile_size, 1)) * sizeof(int)))) {
+                if (!(spacing > Real(0)) || tile_size < 2) {
+                    throw std::invalid_argument("invalid tile grid");
+                }
+            }
+
+            julia_tile_cache(const julia_tile_cache&) = delete;
+            julia_tile_cache& operator=(const julia_tile_cache&) = delete;
+
+            // Returns the point of the complex plane of pixel (x, y) at zoom
+            // level zoom.
+            std::complex<Real> point(int zoom, std::int64_t x, std::int64_t y) const {
+                Real s = std::ldexp(spacing_, -zoom);
+                return std::complex<Real>(Real(x) * s, Real(y) * s);
+            }
+
+            // Returns the number of pixels on each side of a tile.
+            int tile_size() const {
+                return tile_size_;
+            }
+
+            // Returns the maximum number of tiles held by the cache.
+            std::size_t capacity() const {
+                return capacity_;
+            }
+
+            // Returns the number of tiles held by the cache.
+            std::size_t size() const {
+                return lru_.size();
+            }
+
+            // Evicts all tiles.
+            void clear() {
+                index_.clear();
+                lru_.clear();
+            }
+
+            // Renders the view of zoom level zoom whose bottom-left pixel
+            // is pixel (x, y) of the grid into a, for the constant c, where
+            // row i and column j of a hold pixel (x + j, y + height - i -
+            // 1) (i.e., the rows of a are stored from the top of the image,
+            // as with compute_julia_set).
+            // The tiles of the view that are not cached are computed in
+            // parallel on tp (see parallel_for) and then added to the
+            // cache, so this function may also be called from inside a
+            // task of tp.
+            // If a stop is requested through stop, the tiles that have not
+            // been computed yet are skipped (and their pixels of a are left
+            // unchanged), and the returned stats are not complete.
+            tile_render_stats render(const std::complex<Real>& c, int max_iters, int zoom, std::int64_t x,
+                                     std::int64_t y, boost::multi_array<int, 2>& a,
+                                     ra::concurrency::thread_pool& tp, std::stop_token stop = {}) {
+                return render_level(c, max_iters, zoom, 0, x, y, a, tp, stop);
+            }
+
+            // Renders the view as render does, but progressively from
+            // coarse to fine: the view is first rendered at zoom level zoom
+            // - levels, with each pixel of that level filling a 2^levels x
+            // 2^levels block of a, then at each finer level in turn, and
+            // frame_done(a, shift) is called after each of them, where the
+            // pixels of a are 2^shift x 2^shift blocks (e.g., to display a
+            // preview). The coarse levels take a small fraction of the time
+            // of the full view, and their tiles are cached like any other,
+            // so the previews of a panned view are also mostly cached.
+            // Levels are skipped as long as all tiles of the next finer
+            // level are cached, so that a fully cached view is rendered
+            // only once.
+            // If a stop is requested through stop, no further levels are
+            // rendered (nor is frame_done called for an incomplete level).
+            // Returns the statistics summed over the rendered levels.
+            template <class FrameDone>
+            tile_render_stats render_progressive(const std::complex<Real>& c, int max_iters, int zoom,
+                                                 std::int64_t x, std::int64_t y, boost::multi_array<int, 2>& a,
+                                                 ra::concurrency::thread_pool& tp, int levels,
+                                                 FrameDone&& frame_done, std::stop_token stop = {}) {
+                int height = a.shape()[0];
+                int width = a.shape()[1];
+                int shift = std::max(levels, 0);
+                while (shift > 0 && all_cached(c, max_iters, zoom, shift - 1, x, y, height, width)) {
+                    --shift;
+                }
+
+                tile_render_stats total;
+                for (; shift >= 0; --shift) {
+                    tile_render_stats stats = render_level(c, max_iters, zoom, shift, x, y, a, tp, stop);
+                    total.tiles_hit += stats.tiles_hit;
+                    total.tiles_computed += stats.tiles_computed;
+                    if (!stats.complete) {
+                        total.complete = false;
+                        break;
+                    }
+                    frame_done(static_cast<const boost::multi_array<int, 2>&>(a), shift);
+                }
+                return total;
+            }
+
+        private:
+            struct tile_key {
+                std::complex<Real> c;
+                int max_iters;
+                int zoom;
+                std::int64_t tx;
+                std::int64_t ty;
+
+                bool operator==(const tile_key& other) const {
+                    return c == other.c && max_iters == other.max_iters && zoom == other.zoom &&
+                           tx == other.tx && ty == other.ty;
+                }
+            };
+
+            struct tile_key_hash {
+                std::size_t operator()(const tile_key& key) const {
+                    std::size_t h = std::hash<Real>()(key.c.real());
+                    auto combine = [&h](std::size_t v) { h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2); };
+                    combine(std::hash<Real>()(key.c.imag()));
+                    combine(std::hash<int>()(key.max_iters));
+                    combine(std::hash<int>()(key.zoom));
+                    combine(std::hash<std::int64_t>()(key.tx));
+                    combine(std::hash<std::int64_t>()(key.ty));
+                    return h;
+                }
+            };
+
+            // A cached tile: row r and column k of pixels hold pixel
+            // (tx * tile_size + k, ty * tile_size + r).
+            struct tile {
+                tile_key key;
+                std::vector<int> pixels;
+            };
+
+            using tile_list = std::list<tile>;
+
+            // Returns floor(n / d) for d > 0.
+            static std::int64_t floor_div(std::int64_t n, std::int64_t d) {
+                std::int64_t q = n / d;
+                return (n % d != 0 && n < 0) ? q - 1 : q;
+            }
+
+            // The range of tiles of zoom level zoom - shift that covers a
+            // view of zoom level zoom (see render), where pixel (x, y) of
+            // the view lies in pixel (x >> shift, y >> shift) of the level.
+            struct tile_range {
+                std::int64_t tx_begin;
+                std::int64_t tx_end;
+                std::int64_t ty_begin;
+                std::int64_t ty_end;
+            };
+
+            tile_range tiles_of(int shift, std::int64_t x, std::int64_t y, int height, int width) const {
+                return {floor_div(x >> shift, tile_size_), floor_div((x + width - 1) >> shift, tile_size_) + 1,
+                        floor_div(y >> shift, tile_size_), floor_div((y + height - 1) >> shift, tile_size_) + 1};
+            }
+
+            // Returns whether all tiles of the view are cached at zoom level
+            // zoom - shift.
+            bool all_cached(const std::complex<Real>& c, int max_iters, int zoom, int shift, std::int64_t x,
+                            std::int64_t y, int height, int width) const {
+                if (height == 0 || width == 0) {
+                    return true;
+                }
+                tile_range range = tiles_of(shift, x, y, height, width);
+                for (std::int64_t ty = range.ty_begin; ty < range.ty_end; ++ty) {
+                    for (std::int64_t tx = range.tx_begin; tx < range.tx_end; ++tx) {
+                        if (index_.find(tile_key{c, max_iters, zoom - shift, tx, ty}) == index_.end()) {
+                            return false;
+                        }
+                    }
+                }
+                return true;
+            }
+
+            // Computes the pixels of the tile t.
+            void compute_tile(tile& t) const {
+                std::int64_t x0 = t.key.tx * tile_size_;
+                std::int64_t y0 = t.key.ty * tile_size_;
+                std::complex<Real> bottom_left = point(t.key.zoom, x0, y0);
+                std::complex<Real> top_right = point(t.key.zoom, x0 + tile_size_ - 1, y0 + tile_size_ - 1);
+                t.pixels.resize(static_cast<std::size_t>(tile_size_) * tile_size_);
+                for (int r = 0; r < tile_size_; ++r) {
+                    julia_set_span<Real>(bottom_left, top_right, t.key.c, t.key.max_iters, tile_size_, tile_size_,
+                                         r, 0, tile_size_, &t.pixels[static_cast<std::size_t>(r) * tile_size_]);
+                }
+            }
+
+            // Renders the view (see render) at zoom level zoom - shift.
+            tile_render_stats render_level(const std::complex<Real>& c, int max_iters, int zoom, int shift,
+                                           std::int64_t x, std::int64_t y, boost::multi_array<int, 2>& a,
+                                           ra::concurrency::thread_pool& tp, std::stop_token stop) {
+                tile_render_stats stats;
+                int height = a.shape()[0];
+                int width = a.shape()[1];
+                if (height == 0 || width == 0) {
+                    return stats;
+                }
+
+                // Look up the tiles of the view, moving the cached ones to
+                // the front of the LRU list and adding the missing ones
+                // there, so that none of them is evicted before the view is
+                // complete.
+                tile_range range = tiles_of(shift, x, y, height, width);
+                std::int64_t cols = range.tx_end - range.tx_begin;
+                std::vector<const tile*> tiles;
+                tiles.reserve(static_cast<std::size_t>(cols * (range.ty_end - range.ty_begin)));
+                std::vector<typename tile_list::iterator> missing;
+                for (std::int64_t ty = range.ty_begin; ty < range.ty_end; ++ty) {
+                    for (std::int64_t tx = range.tx_begin; tx < range.tx_end; ++tx) {
+                        tile_key key{c, max_iters, zoom - shift, tx, ty};
+                        auto found = index_.find(key);
+                        if (found != index_.end()) {
+                            lru_.splice(lru_.begin(), lru_, found->second);
+                            ++stats.tiles_hit;
+                        } else {
+                            lru_.push_front(tile{key, {}});
+                            index_.emplace(key, lru_.begin());
+                            missing.push_back(lru_.begin());
+                        }
+                        tiles.push_back(&*lru_.begin());
+                    }
+                }
+
+                // Compute the missing tiles, removing those skipped by a
+                // stop from the cache again.
+                std::vector<unsigned char> computed(missing.size());
+                ra::concurrency::parallel_for(
+                    tp, std::size_t(0), missing.size(),
+                    [&](std::size_t k) {
+                        if (!stop.stop_requested()) {
+                            compute_tile(*missing[k]);
+                            computed[k] = true;
+                        }
+                    },
+                    1);
+
+                // Copy the pixels of the view from the tiles.
+                ra::concurrency::parallel_for(tp, 0, height, [&](int i) {
+                    std::int64_t gy = (y + height - 1 - i) >> shift;
+                    std::int64_t ty = floor_div(gy, tile_size_);
+                    std::size_t row_offset = static_cast<std::size_t>(gy - ty * tile_size_) * tile_size_;
+                    std::size_t tile_row = static_cast<std::size_t>((ty - range.ty_begin) * cols);
+                    for (int j = 0; j < width; ++j) {
+                        std::int64_t gx = (x + j) >> shift;
+                        std::int64_t tx = floor_div(gx, tile_size_);
+                        const tile& t = *tiles[tile_row + static_cast<std::size_t>(tx - range.tx_begin)];
+                        if (!t.pixels.empty()) {
+                            a[i][j] = t.pixels[row_offset + static_cast<std::size_t>(gx - tx * tile_size_)];
+                        }
+                    }
+                });
+
+                for (std::size_t k = 0; k < missing.size(); ++k) {
+                    if (computed[k]) {
+                        ++stats.tiles_computed;
+                    } else {
+                        index_.erase(missing[k]->key);
+                        lru_.erase(missing[k]);
+                        stats.complete = false;
+                    }
+                }
+                while (lru_.size() > capacity_) {
+                    index_.erase(lru_.back().key);
+                    lru_.pop_back();
+                }
+                return stats;
+            }
+
+            // The pixel spacing at zoom level 0.
+            Real spacing_;
+
+            // The number of pixels on each side of a tile.
+            int tile_size_;
+
+            // The maximum number of tiles held.
+            std::size_t capacity_;
+
+            // The cached tiles, from the most to the least recently used.
+            tile_list lru_;
+
+            // The position of each cached tile in lru_.
+            std::unordered_map<tile_key, typename tile_list::iterator, tile_key_hash> index_;
+    };
+
+}  // namespace ra::fractal
+
+#endif  // JULIA_TILE_CACHE_HPP
@@ -0,0 +1,574 @@
+#ifndef MPMC_QUEUE_HPP
+#define MPMC_QUEUE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+
+namespace ra::concurrency {
+
+    // Lock-free concurrent bounded FIFO queue class.
+    // The queue is a ring buffer of max_size slots, where each slot carries
+    // a sequence number (its "turn") that tells producers and consumers
+    // whether the slot is currently free or holds a value. Producers and
+    // consumers only contend on the head and tail positions (which are
+    // kept on separate cache lines), and a thread only blocks when the
+    // queue is really full (for push) or empty (for pop).
+    // The class provides the following subset of the interface of
+    // ra::concurrency::queue (with the same semantics), so the two classes
+    // can be used interchangeably through it: push, pop, try_push,
+    // try_pop, try_push_for/until, try_pop_for/until, push_range,
+    // try_push_range, pop_bulk, try_pop_bulk, close, clear, is_full,
+    // is_empty, is_closed, and max_size. It does not provide emplace,
+    // pop_with, size, the asynchronous operations, or statistics.
+    template <class T>
+    class mpmc_queue {
+        public:
+            // The type of each of the elements stored in the queue.
+            using value_type = T;
+
+            // An unsigned integral type used to represent sizes.
+            using size_type = std::size_t;
+
+            // A type for the status of a queue operation.
+            enum class status {
+                success = 0,  // operation successful
+                empty,        // queue is empty
+                full,         // queue is full
+                closed,       // queue is closed
+            };
+
+            // A queue is not default constructible.
+            mpmc_queue() = delete;
+
+            // Constructs a queue with a maximum size of max_size.
+            // The queue is marked as open (i.e., not closed).
+            // Precondition: The quantity max_size must be greater than
+            // zero.
+            mpmc_queue(size_type max_size)
+                : max_size_(max_size), slots_(new slot[max_size]), head_(0), tail_(0),
+                  closed_(false), push_epoch_(0), pop_epoch_(0), push_waiters_(0), pop_waiters_(0) {}
+
+            // A queue is not movable or copyable.
+            mpmc_queue(const mpmc_queue&) = delete;
+            mpmc_queue& operator=(const mpmc_queue&) = delete;
+            mpmc_queue(mpmc_queue&&) = delete;
+            mpmc_queue& operator=(mpmc_queue&&) = delete;
+
+            // Destroys the queue after closing the queue (if not already
+            // closed) and clearing the queue (if not already empty).
+            ~mpmc_queue() {
+                if (!is_closed()) {
+                    close();
+                }
+
+                if (!is_empty()) {
+                    clear();
+                }
+            }
+
+            // Inserts the value x at the end of the queue, blocking if
+            // necessary.
+            // If the queue is full, the thread will be blocked until the
+            // queue insertion can be completed or the queue is closed.
+            // If the value x is successfully inserted on the queue, the
+            // function returns status::success.
+            // If the value x cannot be inserted on the queue (due to the
+            // queue being closed), the function returns with a return
+            // value of status::closed.
+            // This function is thread safe.
+            // Note: The rvalue reference parameter is intentional and
+            // implies that the push function is permitted to change
+            // the value of x (e.g., by moving from x).
+            status push(value_type&& x) {
+                if (closed_.load(std::memory_order_acquire)) {
+                    return status::closed;
+                }
+
+                // Fast path: there is a free slot.
+                if (try_enqueue(x)) {
+                    notify(push_epoch_, pop_waiters_);
+                    return status::success;
+                }
+
+                // Slow path: wait for a consumer to free a slot.
+                push_waiters_.fetch_add(1, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                status result = status::success;
+                while (true) {
+                    std::uint32_t epoch = pop_epoch_.load(std::memory_order_seq_cst);
+                    if (closed_.load(std::memory_order_seq_cst)) {
+                        result = status::closed;
+                        break;
+                    }
+                    if (try_enqueue(x)) {
+                        break;
+                    }
+                    pop_epoch_.wait(epoch, std::memory_order_seq_cst);
+                }
+                push_waiters_.fetch_sub(1, std::memory_order_relaxed);
+
+                if (result == status::success) {
+                    notify(push_epoch_, pop_waiters_);
+                }
+                return result;
+            }
+
+            // Removes the value from the front of the queue and places it
+            // in x, blocking if necessary.
+            // If the queue is empty and not closed, the thread is blocked
+            // until: 1) a value can be removed from the queue; or 2) the
+            // queue is closed.
+            // If the queue is closed, the function does not block and either
+            // returns status::closed or status::success, depending on whether
+            // a value can be successfully removed from the queue.
+            // If a value is successfully removed from the queue, the value
+            // is placed in x and the function returns status::success.
+            // If a value cannot be successfully removed from the queue (due to
+            // the queue being both empty and closed), the function returns
+            // status::closed.
+            // This function is thread safe.
+            status pop(value_type& x) {
+                auto assign = [&x](value_type&& v) { x = std::move(v); };
+
+                // Fast path: there is a value available.
+                if (try_dequeue(assign)) {
+                    notify(pop_epoch_, push_waiters_);
+                    return status::success;
+                }
+
+                // Slow path: wait for a producer to fill a slot.
+                pop_waiters_.fetch_add(1, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                status result = status::success;
+                while (true) {
+                    std::uint32_t epoch = push_epoch_.load(std::memory_order_seq_cst);
+                    bool closed = closed_.load(std::memory_order_seq_cst);
+                    if (try_dequeue(assign)) {
+                        break;
+                    }
+                    if (closed) {
+                        result = status::closed;
+                        break;
+                    }
+                    push_epoch_.wait(epoch, std::memory_order_seq_cst);
+                }
+                pop_waiters_.fetch_sub(1, std::memory_order_relaxed);
+
+                if (result == status::success) {
+                    notify(pop_epoch_, push_waiters_);
+                }
+                return result;
+            }
+
+            // Inserts the value x at the end of the queue if the queue is
+            // neither full nor closed, without blocking.
+            // The function returns status::success if the value x is
+            // inserted, status::full if the queue is full, and
+            // status::closed if the queue is closed.
+            // The value x is only moved from if it is inserted.
+            // This function is thread safe.
+            status try_push(value_type&& x) {
+                if (closed_.load(std::memory_order_acquire)) {
+                    return status::closed;
+                }
+                if (!try_enqueue(x)) {
+                    return status::full;
+                }
+                notify(push_epoch_, pop_waiters_);
+                return status::success;
+            }
+
+            // Inserts the value x at the end of the queue, waiting for at
+            // most rel_time if the queue is full.
+            // The function returns status::full if the queue is still full
+            // after rel_time has elapsed, and otherwise behaves like push.
+            // The value x is only moved from if it is inserted.
+            // This function is thread safe.
+            template <class Rep, class Period>
+            status try_push_for(value_type&& x, const std::chrono::duration<Rep, Period>& rel_time) {
+                return try_push_until(std::move(x), std::chrono::steady_clock::now() + rel_time);
+            }
+
+            // Inserts the value x at the end of the queue, waiting until
+            // at most abs_time if the queue is full.
+            // Since atomic waits cannot time out, the thread polls the queue
+            // with exponential backoff (up to 1 ms between attempts).
+            // The function returns status::full if the queue is still full
+            // at abs_time, and otherwise behaves like push.
+            // The value x is only moved from if it is inserted.
+            // This function is thread safe.
+            template <class Clock, class Duration>
+            status try_push_until(value_type&& x, const std::chrono::time_point<Clock, Duration>& abs_time) {
+                for (unsigned round = 0;; ++round) {
+                    status result = try_push(std::move(x));
+                    if (result != status::full || Clock::now() >= abs_time) {
+                        return result;
+                    }
+                    backoff(round);
+                }
+            }
+
+            // Inserts the values in the range [first, last) at the end of
+            // the queue (in order), blocking if necessary.
+            // Blocked consumers are woken up once per batch of values
+            // inserted without blocking, rather than once per value.
+            // The function returns the number of values inserted, which is
+            // less than the size of the range only if the queue is closed.
+            // This function is thread safe.
+            // Note: The values in the range are moved from.
+            template <class InputIt>
+            size_type push_range(InputIt first, InputIt last) {
+                size_type count = 0;
+                while (first != last) {
+                    count += insert_range(first, last);
+                    if (first == last) {
+                        break;
+                    }
+                    if (push(std::move(*first)) != status::success) {
+                        break;
+                    }
+                    ++first;
+                    ++count;
+                }
+                return count;
+            }
+
+            // Inserts as many values from the front of the range
+            // [first, last) as currently fit at the end of the queue
+            // (in order), without blocking.
+            // The function returns the number of values inserted, which is
+            // zero if the queue is full or closed.
+            // This function is thread safe.
+            // Note: The inserted values are moved from.
+            template <class InputIt>
+            size_type try_push_range(InputIt first, InputIt last) {
+                return insert_range(first, last);
+            }
+
+            // Removes the value from the front of the queue and places it
+            // in x if the queue is not empty, without blocking.
+            // The function returns status::success if a value is removed,
+            // status::empty if the queue is empty but not closed, and
+            // status::closed if the queue is both empty and closed.
+            // This function is thread safe.
+            status try_pop(value_type& x) {
+                bool closed = closed_.load(std::memory_order_acquire);
+                if (!try_dequeue([&x](value_type&& v) { x = std::move(v); })) {
+                    return closed ? status::closed : status::empty;
+                }
+                notify(pop_epoch_, push_waiters_);
+                return status::success;
+            }
+
+            // Removes the value from the front of the queue and places it
+            // in x, waiting for at most rel_time if the queue is empty.
+            // The function returns status::empty if the queue is still
+            // empty (and not closed) after rel_time has elapsed, and
+            // otherwise behaves like pop.
+            // This function is thread safe.
+            template <class Rep, class Period>
+            status try_pop_for(value_type& x, const std::chrono::duration<Rep, Period>& rel_time) {
+                return try_pop_until(x, std::chrono::steady_clock::now() + rel_time);
+            }
+
+            // Removes the value from the front of the queue and places it
+            // in x, waiting until at most abs_time if the queue is empty.
+            // The thread polls the queue in the same way as try_push_until.
+            // The function returns status::empty if the queue is still
+            // empty (and not closed) at abs_time, and otherwise behaves
+            // like pop.
+            // This function is thread safe.
+            template <class Clock, class Duration>
+            status try_pop_until(value_type& x, const std::chrono::time_point<Clock, Duration>& abs_time) {
+                for (unsigned round = 0;; ++round) {
+                    status result = try_pop(x);
+                    if (result != status::empty || Clock::now() >= abs_time) {
+                        return result;
+                    }
+                    backoff(round);
+                }
+            }
+
+            // Removes up to max_n values from the front of the queue and
+            // writes them (in order) to out, blocking if necessary.
+            // If the queue is empty and not closed, the thread is blocked
+            // until a value can be removed or the queue is closed. Then, as
+            // many values as are available (up to max_n) are removed.
+            // The function returns the number of values removed, which is
+            // zero only if the queue is both empty and closed (or if max_n
+            // is zero).
+            // This function is thread safe.
+            template <class OutputIt>
+            size_type pop_bulk(OutputIt out, size_type max_n) {
+                size_type count = remove_bulk(out, max_n);
+                if (count > 0 || max_n == 0) {
+                    return count;
+                }
+
+                // Slow path: wait for a producer to fill a slot, in the same
+                // way as pop (but without requiring a value_type to be
+                // default constructed to receive the first value).
+                pop_waiters_.fetch_add(1, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                while (true) {
+                    std::uint32_t epoch = push_epoch_.load(std::memory_order_seq_cst);
+                    bool closed = closed_.load(std::memory_order_seq_cst);
+                    count = remove_bulk(out, max_n);
+                    if (count > 0 || closed) {
+                        break;
+                    }
+                    push_epoch_.wait(epoch, std::memory_order_seq_cst);
+                }
+                pop_waiters_.fetch_sub(1, std::memory_order_relaxed);
+                return count;
+            }
+
+            // Removes up to max_n values from the front of the queue and
+            // writes them (in order) to out, without blocking.
+            // The function returns the number of values removed, which is
+            // zero if the queue is empty.
+            // This function is thread safe.
+            template <class OutputIt>
+            size_type try_pop_bulk(OutputIt out, size_type max_n) {
+                return remove_bulk(out, max_n);
+            }
+
+            // Closes the queue.
+            // The queue is placed in the closed state.
+            // The closed state prevents more items from being inserted
+            // on the queue, but it does not clear the items that are
+            // already on the queue.
+            // A push that is concurrent with close may still succeed.
+            // Invoking this function on a closed queue has no effect.
+            // This function is thread safe.
+            void close() {
+                closed_.store(true, std::memory_order_seq_cst);
+                push_epoch_.fetch_add(1, std::memory_order_seq_cst);
+                pop_epoch_.fetch_add(1, std::memory_order_seq_cst);
+                push_epoch_.notify_all();
+                pop_epoch_.notify_all();
+            }
+
+            // Clears the queue.
+            // All of the elements on the queue are discarded.
+            // This function is thread safe.
+            void clear() {
+                bool cleared = false;
+                while (try_dequeue([](value_type&&) {})) {
+                    cleared = true;
+                }
+                if (cleared) {
+                    notify(pop_epoch_, push_waiters_);
+                }
+            }
+
+            // Returns if the queue is currently full (i.e., the number of
+            // elements in the queue equals the maximum queue size).
+            // This function is not thread safe.
+            bool is_full() const {
+                return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_relaxed) >=
+                       max_size_;
+            }
+
+            // Returns if the queue is currently empty.
+            // This function is not thread safe.
+            bool is_empty() const {
+                return tail_.load(std::memory_order_relaxed) == head_.load(std::memory_order_relaxed);
+            }
+
+            // Returns if the queue is closed (i.e., in the closed state).
+            // This function is not thread safe.
+            bool is_closed() const {
+                return closed_.load(std::memory_order_relaxed);
+            }
+
+            // Returns the maximum number of elements that can be held in
+            // the queue.
+            // This function is not thread safe.
+            size_type max_size() const {
+                return max_size_;
+            }
+
+        private:
+            // The assumed size of a cache line, used to keep the hot
+            // positions of the queue from sharing a cache line.
+            static constexpr size_type cache_line_size = 64;
+
+            // A slot of the ring buffer.
+            // The turn of a slot is even when the slot is free and odd when
+            // the slot holds a value. The element at position pos lives in
+            // slot pos % max_size_ and is pushed at turn 2 * (pos / max_size_)
+            // and popped at turn 2 * (pos / max_size_) + 1.
+            struct alignas(cache_line_size) slot {
+                slot() : turn(0) {}
+
+                ~slot() {
+                    if (turn.load(std::memory_order_relaxed) & 1) {
+                        value()->~value_type();
+                    }
+                }
+
+                value_type* value() {
+                    return std::launder(reinterpret_cast<value_type*>(storage));
+                }
+
+                std::atomic<size_type> turn;
+                alignas(value_type) unsigned char storage[sizeof(value_type)];
+            };
+
+            // Inserts x into the queue if the queue is not full.
+            // Returns true if x was inserted (in which case x has been
+            // moved from), and false otherwise (in which case x is left
+            // unchanged).
+            bool try_enqueue(value_type& x) {
+                size_type pos = tail_.load(std::memory_order_acquire);
+                while (true) {
+                    slot& s = slots_[pos % max_size_];
+                    size_type turn = 2 * (pos / max_size_);
+                    if (s.turn.load(std::memory_order_acquire) == turn) {
+                        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            ::new (static_cast<void*>(s.storage)) value_type(std::move(x));
+                            s.turn.store(turn + 1, std::memory_order_release);
+                            return true;
+                        }
+                    } else {
+                        // The slot is still occupied from the previous turn,
+                        // so the queue is full unless another producer has
+                        // moved the tail in the meantime.
+                        size_type prev = pos;
+                        pos = tail_.load(std::memory_order_acquire);
+                        if (pos == prev) {
+                            return false;
+                        }
+                    }
+                }
+            }
+
+            // Removes the value at the front of the queue (if any) and
+            // passes it as an rvalue to f.
+            // Returns true if a value was removed, and false if the queue
+            // is empty.
+            template <class F>
+            bool try_dequeue(F&& f) {
+                size_type pos = head_.load(std::memory_order_acquire);
+                while (true) {
+                    slot& s = slots_[pos % max_size_];
+                    size_type turn = 2 * (pos / max_size_) + 1;
+                    if (s.turn.load(std::memory_order_acquire) == turn) {
+                        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            value_type* v = s.value();
+                            f(std::move(*v));
+                            v->~value_type();
+                            s.turn.store(turn + 1, std::memory_order_release);
+                            return true;
+                        }
+                    } else {
+                        size_type prev = pos;
+                        pos = head_.load(std::memory_order_acquire);
+                        if (pos == prev) {
+                            return false;
+                        }
+                    }
+                }
+            }
+
+            // Inserts as many values from the front of [first, last) as
+            // fit, advancing first past them, and wakes up blocked
+            // consumers (if any) once.
+            template <class InputIt>
+            size_type insert_range(InputIt& first, InputIt last) {
+                size_type count = 0;
+                if (closed_.load(std::memory_order_acquire)) {
+                    return count;
+                }
+                while (first != last) {
+                    auto&& x = *first;
+                    if (!try_enqueue(x)) {
+                        break;
+                    }
+                    ++first;
+                    ++count;
+                }
+                if (count > 0) {
+                    notify(push_epoch_, pop_waiters_);
+                }
+                return count;
+            }
+
+            // Moves up to max_n values from the front of the queue to out,
+            // and wakes up blocked producers (if any) once.
+            template <class OutputIt>
+            size_type remove_bulk(OutputIt& out, size_type max_n) {
+                size_type count = 0;
+                auto assign = [&out](value_type&& v) {
+                    *out = std::move(v);
+                    ++out;
+                };
+                while (count < max_n && try_dequeue(assign)) {
+                    ++count;
+                }
+                if (count > 0) {
+                    notify(pop_epoch_, push_waiters_);
+                }
+                return count;
+            }
+
+            // Pauses between two polling attempts of a timed operation:
+            // the first few rounds only yield, and later rounds sleep for
+            // an exponentially growing time of up to 1 ms.
+            static void backoff(unsigned round) {
+                if (round < 4) {
+                    std::this_thread::yield();
+                } else {
+                    std::this_thread::sleep_for(std::chrono::microseconds(1u << std::min(round - 4, 10u)));
+                }
+            }
+
+            // Signals the threads (if any) that are blocked waiting on
+            // epoch. The fence pairs with the fence in the slow path of
+            // push and pop so that either the waiter observes the change
+            // to the queue or this function observes the waiter.
+            static void notify(std::atomic<std::uint32_t>& epoch, std::atomic<size_type>& waiters) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (waiters.load(std::memory_order_relaxed) > 0) {
+                    epoch.fetch_add(1, std::memory_order_seq_cst);
+                    epoch.notify_all();
+                }
+            }
+
+            // The maximum number of elements that can be held in the queue.
+            const size_type max_size_;
+
+            // The ring buffer of slots.
+            std::unique_ptr<slot[]> slots_;
+
+            // The position of the next element to be removed.
+            alignas(cache_line_size) std::atomic<size_type> head_;
+
+            // The position of the next element to be inserted.
+            alignas(cache_line_size) std::atomic<size_type> tail_;
+
+            // The flag used to indicate whether the queue is closed.
+            alignas(cache_line_size) std::atomic<bool> closed_;
+
+            // Counters that are advanced when an element is inserted
+            // (push_epoch_) or removed (pop_epoch_) while threads are
+            // blocked, so that the blocked threads can wait on them.
+            std::atomic<std::uint32_t> push_epoch_;
+            std::atomic<std::uint32_t> pop_epoch_;
+
+            // The number of threads blocked in push and pop, respectively.
+            std::atomic<size_type> push_waiters_;
+            std::atomic<size_type> pop_waiters_;
+    };
+
+}  // namespace ra::concurrency
+
+#endif  // MPMC_QUEUE_HPP
@@ -0,0 +1,63 @@
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ra::concurrency {
+
+    // NUMA topology class.
+    // A NUMA topology lists, for each NUMA node, the CPUs that belong to
+    // the node.
+    class numa_topology {
+        public:
+            // An unsigned integral type used to represent sizes.
+            using size_type = std::size_t;
+
+            // Creates a topology with the given CPUs for each node.
+            // Nodes without any CPU are dropped; if no node is left, the
+            // topology consists of a single node with the CPUs returned by
+            // available_cpus.
+            explicit numa_topology(std::vector<std::vector<int>> node_cpus);
+
+            // Returns the topology of the machine, as described by
+            // /sys/devices/system/node and restricted to the CPUs that the
+            // process may run on. Without that information (e.g., on a
+            // system other than Linux), the topology has a single node.
+            // The topology is read once, on the first call.
+            // This function is thread safe.
+            static const numa_topology& system();
+
+            // Returns the number of nodes.
+            size_type num_nodes() const;
+
+            // Returns the CPUs of the given node.
+            // Precondition: node < num_nodes()
+            const std::vector<int>& cpus(size_type node) const;
+
+            // Returns the node that the given CPU belongs to, or num_nodes()
+            // if it belongs to none.
+            size_type node_of_cpu(int cpu) const;
+
+        private:
+            // The CPUs of each node.
+            std::vector<std::vector<int>> node_cpus_;
+    };
+
+    // Returns the CPUs that the calling process may run on (or, if that
+    // cannot be determined, CPUs 0 to hardware_concurrency - 1).
+    std::vector<int> available_cpus();
+
+    // Parses a list of CPUs in the format used by Linux (e.g., "0-3,8,10-11").
+    // Malformed entries are ignored.
+    std::vector<int> parse_cpu_list(const std::string& list);
+
+    // Restricts the calling thread to run on the given CPUs.
+    // Returns true on success, and false if the CPUs are invalid or the
+    // system does not support thread affinity.
+    bool set_thread_affinity(const std::vector<int>& cpus);
+
+}  // namespace ra::concurrency
+
+#endif  // NUMA_HPP
@@ -0,0 +1,320 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <ra/thread_pool.hpp>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ra::concurrency {
+
+    // Parallel algorithms on a thread pool.
+    // Each algorithm splits its range recursively in halves down to chunks
+    // of at most grain elements: the upper half of a range is scheduled as
+    // a task of a task group, while the lower half is split further by the
+    // same thread, so that idle threads take over large pieces of the
+    // range early on. If grain is 0, it is chosen so that there are about
+    // chunks_per_thread chunks per thread of the pool, which amortizes the
+    // cost of the tasks for cheap elements and still leaves enough chunks
+    // to balance irregular costs.
+    // The calling thread executes chunks as well and helps to execute the
+    // queued tasks while it waits, so the algorithms may also be called
+    // from inside a task of the pool (e.g., nested in one another).
+    // If the function applied to the elements exits with an exception,
+    // the chunks that have not started yet are skipped, and the first
+    // exception is rethrown once the running chunks have finished.
+
+    // The number of chunks per thread that the automatic grain size aims
+    // for.
+    inline constexpr std::size_t chunks_per_thread = 16;
+
+    namespace detail {
+
+        // Returns grain if it is nonzero, and otherwise the automatic grain
+        // size for n elements on pool (but at least min_grain).
+        inline std::size_t choose_grain(const thread_pool& pool, std::size_t n, std::size_t grain,
+                                        std::size_t min_grain = 1) {
+            if (grain > 0) {
+                return grain;
+            }
+            return std::max(min_grain, n / (chunks_per_thread * pool.size()));
+        }
+
+        // Calls body(first, last) on a chunk, cancelling group if the call
+        // exits with an exception.
+        template <class Body, class... Args>
+        void run_chunk(task_group& group, const Body& body, Args... args) {
+            try {
+                body(args...);
+            } catch (...) {
+                group.cancel();
+                throw;
+            }
+        }
+
+        // Calls body(lo, hi) for each of the chunks [lo, hi) of at most
+        // grain indices that [first, last) is split into, scheduling the
+        // upper halves as tasks of group.
+        template <class Index, class Body>
+        void split_range(task_group& group, Index first, Index last, std::size_t grain, const Body& body) {
+            while (static_cast<std::size_t>(last - first) > grain) {
+                Index middle = first + (last - first) / 2;
+                group.run([&group, middle, last, grain, &body]() {
+                    split_range(group, middle, last, grain, body);
+                });
+                last = middle;
+            }
+            run_chunk(group, body, first, last);
+        }
+
+        // Calls body(r0, r1, c0, c1) for each of the blocks [r0, r1) x
+        // [c0, c1) of at most grain elements that [row_first, row_last) x
+        // [col_first, col_last) is split into, always halving the longer
+        // side of a block, and scheduling the upper halves as tasks of
+        // group.
+        template <class Index, class Body>
+        void split_range_2d(task_group& group, Index row_first, Index row_last, Index col_first, Index col_last,
+                            std::size_t grain, const Body& body) {
+            for (;;) {
+                std::size_t rows = row_last - row_first;
+                std::size_t cols = col_last - col_first;
+                if (rows * cols <= grain || (rows <= 1 && cols <= 1)) {
+                    break;
+                }
+                if (rows >= cols) {
+                    Index middle = row_first + (row_last - row_first) / 2;
+                    group.run([&group, middle, row_last, col_first, col_last, grain, &body]() {
+                        split_range_2d(group, middle, row_last, col_first, col_last, grain, body);
+                    });
+                    row_last = middle;
+                } else {
+                    Index middle = col_first + (col_last - col_first) / 2;
+                    group.run([&group, row_first, row_last, middle, col_last, grain, &body]() {
+                        split_range_2d(group, row_first, row_last, middle, col_last, grain, body);
+                    });
+                    col_last = middle;
+                }
+            }
+            run_chunk(group, body, row_first, row_last, col_first, col_last);
+        }
+
+        // Calls body(lo, hi) for the chunks of [first, last) on pool as
+        // described above.
+        template <class Index, class Body>
+        void for_each_chunk(thread_pool& pool, Index first, Index last, std::size_t grain, const Body& body) {
+            if (!(first < last)) {
+                return;
+            }
+            std::size_t n = last - first;
+            grain = choose_grain(pool, n, grain);
+            if (n <= grain) {
+                body(first, last);
+                return;
+            }
+            task_group group(pool);
+            split_range(group, first, last, grain, body);
+            group.wait();
+        }
+
+        // Sorts [first, last) by quicksort, scheduling the upper part of
+        // each partition as a task of group, and sorting parts of at most
+        // grain elements (or beyond the given recursion depth) with
+        // std::sort.
+        template <class RandomIt, class Compare>
+        void quick_sort(task_group& group, RandomIt first, RandomIt last, const Compare& comp, std::size_t grain,
+                        int depth) {
+            while (static_cast<std::size_t>(last - first) > grain && depth > 0) {
+                --depth;
+
+                // Move the median of the first, middle and last elements to
+                // the front, where it stays in place during the partition.
+                RandomIt middle = first + (last - first) / 2;
+                RandomIt back = last - 1;
+                RandomIt median = comp(*first, *middle)
+                                      ? (comp(*middle, *back) ? middle : (comp(*first, *back) ? back : first))
+                                      : (comp(*first, *back) ? first : (comp(*middle, *back) ? back : middle));
+                std::iter_swap(first, median);
+
+                // Partition the rest into the elements less than, equal to,
+                // and greater than the pivot, so that runs of equal elements
+                // are not partitioned again.
+                RandomIt lower = std::partition(first + 1, last, [&](const auto& x) { return comp(x, *first); });
+                RandomIt pivot = lower - 1;
+                std::iter_swap(first, pivot);
+                RandomIt upper =
+                    std::partition(lower, last, [&](const auto& x) { return !comp(*pivot, x); });
+
+                group.run([&group, upper, last, &comp, grain, depth]() {
+                    quick_sort(group, upper, last, comp, grain, depth);
+                });
+                last = pivot;
+            }
+            run_chunk(group, [&comp](RandomIt lo, RandomIt hi) { std::sort(lo, hi, comp); }, first, last);
+        }
+
+    }  // namespace detail
+
+    // Calls f(i) for each index i in [first, last) on pool, splitting the
+    // range into chunks of at most grain indices (see above).
+    // The calls for different indices may run concurrently, in any order.
+    // This function returns once all calls have finished.
+    template <class Index, class F>
+    void parallel_for(thread_pool& pool, Index first, Index last, F&& f, std::size_t grain = 0) {
+        static_assert(std::is_integral_v<Index>, "parallel_for requires an integral index type");
+        detail::for_each_chunk(pool, first, last, grain, [&f](Index lo, Index hi) {
+            for (Index i = lo; i < hi; ++i) {
+                f(i);
+            }
+        });
+    }
+
+    // Calls f(i, j) for each index pair (i, j) in [row_first, row_last) x
+    // [col_first, col_last) on pool, splitting the rectangle into blocks
+    // of at most grain pairs by halving the longer side of the blocks, so
+    // that the blocks stay roughly square (e.g., for the cache locality of
+    // image tiles). Within a block, the calls are made row by row.
+    // The calls for different pairs may run concurrently, in any order.
+    // This function returns once all calls have finished.
+    template <class Index, class F>
+    void parallel_for(thread_pool& pool, Index row_first, Index row_last, Index col_first, Index col_last, F&& f,
+                      std::size_t grain = 0) {
+        static_assert(std::is_integral_v<Index>, "parallel_for requires an integral index type");
+        if (!(row_first < row_last) || !(col_first < col_last)) {
+            return;
+        }
+        auto body = [&f](Index r0, Index r1, Index c0, Index c1) {
+            for (Index i = r0; i < r1; ++i) {
+                for (Index j = c0; j < c1; ++j) {
+                    f(i, j);
+                }
+            }
+        };
+        std::size_t n = std::size_t(row_last - row_first) * std::size_t(col_last - col_first);
+        grain = detail::choose_grain(pool, n, grain);
+        if (n <= grain) {
+            body(row_first, row_last, col_first, col_last);
+            return;
+        }
+        task_group group(pool);
+        detail::split_range_2d(group, row_first, row_last, col_first, col_last, grain, body);
+        group.wait();
+    }
+
+    // Returns the reduction of transform(i) over the indices i in
+    // [first, last) with the associative operation reduce, starting from
+    // identity (like std::transform_reduce, but over indices and without
+    // requiring reduce to be commutative).
+    // Each chunk is reduced by one call, starting from a copy of identity,
+    // and the results of the chunks are then reduced in order by the
+    // calling thread, so identity must be an identity element of reduce.
+    template <class Index, class T, class Reduce, class Transform>
+    T parallel_reduce(thread_pool& pool, Index first, Index last, T identity, Reduce reduce, Transform transform,
+                      std::size_t grain = 0) {
+        static_assert(std::is_integral_v<Index>, "parallel_reduce requires an integral index type");
+        if (!(first < last)) {
+            return identity;
+        }
+        std::size_t n = last - first;
+        grain = detail::choose_grain(pool, n, grain);
+        std::size_t num_chunks = (n + grain - 1) / grain;
+        std::vector<T> partial(num_chunks, identity);
+        detail::for_each_chunk(pool, std::size_t(0), num_chunks, 1, [&](std::size_t k0, std::size_t k1) {
+            for (std::size_t k = k0; k < k1; ++k) {
+                Index lo = first + Index(k * grain);
+                Index hi = k + 1 == num_chunks ? last : Index(lo + Index(grain));
+                T value = std::move(partial[k]);
+                for (Index i = lo; i < hi; ++i) {
+                    value = reduce(std::move(value), transform(i));
+                }
+                partial[k] = std::move(value);
+            }
+        });
+        T result = std::move(identity);
+        for (T& value : partial) {
+            result = reduce(std::move(result), std::move(value));
+        }
+        return result;
+    }
+
+    // Computes the inclusive scan of [first, last) with the associative
+    // operation op into the range beginning at d_first (like
+    // std::inclusive_scan), and returns the end of the output range.
+    // The scan takes two passes over the chunks of the range: the first
+    // reduces each chunk (starting from identity, which must be an
+    // identity element of op), and the second scans each chunk again,
+    // starting from the reduction of all the chunks before it.
+    // The output range may be the same as the input range, but must not
+    // overlap it otherwise.
+    template <class RandomIt, class OutputIt, class T, class BinaryOp>
+    OutputIt parallel_scan(thread_pool& pool, RandomIt first, RandomIt last, OutputIt d_first, T identity,
+                           BinaryOp op, std::size_t grain = 0) {
+        if (!(first < last)) {
+            return d_first;
+        }
+        std::size_t n = last - first;
+        grain = detail::choose_grain(pool, n, grain);
+        std::size_t num_chunks = (n + grain - 1) / grain;
+        auto chunk_end = [&](std::size_t k) { return k + 1 == num_chunks ? n : (k + 1) * grain; };
+
+        // Reduce each chunk (except the last one, which no chunk follows).
+        std::vector<T> offset(num_chunks, identity);
+        detail::for_each_chunk(pool, std::size_t(0), num_chunks - 1, 1, [&](std::size_t k0, std::size_t k1) {
+            for (std::size_t k = k0; k < k1; ++k) {
+                T value = identity;
+                for (std::size_t i = k * grain; i < chunk_end(k); ++i) {
+                    value = op(std::move(value), first[i]);
+                }
+                offset[k + 1] = std::move(value);
+            }
+        });
+
+        // Turn the reductions into the offsets of the chunks.
+        for (std::size_t k = 1; k < num_chunks; ++k) {
+            offset[k] = op(offset[k - 1], std::move(offset[k]));
+        }
+
+        // Scan each chunk, starting from its offset.
+        detail::for_each_chunk(pool, std::size_t(0), num_chunks, 1, [&](std::size_t k0, std::size_t k1) {
+            for (std::size_t k = k0; k < k1; ++k) {
+                T value = std::move(offset[k]);
+                for (std::size_t i = k * grain; i < chunk_end(k); ++i) {
+                    value = op(std::move(value), first[i]);
+                    d_first[i] = value;
+                }
+            }
+        });
+        return d_first + n;
+    }
+
+    // Sorts [first, last) according to comp on pool (not stably).
+    // The range is sorted by a parallel quicksort: each partition step
+    // splits a range into the elements less than, equal to, and greater
+    // than the median of three of its elements, and the greater part is
+    // sorted by another task. Parts of at most grain elements (by default
+    // at least 2048) are sorted with std::sort, as are the parts of
+    // partitions that keep turning out unbalanced.
+    template <class RandomIt, class Compare = std::less<>>
+    void parallel_sort(thread_pool& pool, RandomIt first, RandomIt last, Compare comp = Compare(),
+                       std::size_t grain = 0) {
+        std::size_t n = last - first;
+        grain = detail::choose_grain(pool, n, grain, 2048);
+        if (n <= grain) {
+            std::sort(first, last, comp);
+            return;
+        }
+        int depth = 0;
+        for (std::size_t m = n; m > 1; m /= 2) {
+            depth += 2;
+        }
+        task_group group(pool);
+        detail::quick_sort(group, first, last, comp, grain, depth);
+        group.wait();
+    }
+
+}  // namespace ra::concurrency
+
+#endif  // PARALLEL_HPP
@@ -1,10 +1,118 @@
+#ifndef QUEUE_HPP
+#define QUEUE_HPP
+
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <coroutine>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
+#include <optional>
+#include <ra/spin_wait.hpp>
+#include <ra/stats.hpp>
+#include <utility>
 
 namespace ra::concurrency {
 
+    namespace detail {
+
+        // A callable that resumes a suspended coroutine, for scheduling the
+        // resumption on an executor (e.g., a thread pool).
+        // If the callable is destroyed without having been called (e.g.,
+        // because the thread pool discarded the task), it destroys the
+        // coroutine instead, so that the coroutine does not leak (see
+        // ra::concurrency::task for how this ends a chain of tasks).
+        class coroutine_resumer {
+            public:
+                explicit coroutine_resumer(std::coroutine_handle<> handle) noexcept : handle_(handle) {}
+
+                coroutine_resumer(coroutine_resumer&& other) noexcept
+                    : handle_(std::exchange(other.handle_, nullptr)) {}
+                coroutine_resumer& operator=(coroutine_resumer&&) = delete;
+
+                ~coroutine_resumer() {
+                    if (handle_) {
+                        handle_.destroy();
+                    }
+                }
+
+                void operator()() {
+                    std::exchange(handle_, nullptr).resume();
+                }
+
+            private:
+                std::coroutine_handle<> handle_;
+        };
+
+        // A coroutine suspended in an asynchronous queue operation (see
+        // queue::async_push and queue::async_pop), linked into a list of
+        // the waiters of the queue.
+        struct queue_waiter {
+            // Resumes the coroutine, either inline or through its executor.
+            void resume() {
+                resume_with(executor, handle);
+            }
+
+            queue_waiter* next = nullptr;
+            std::coroutine_handle<> handle;
+            void* executor = nullptr;
+            void (*resume_with)(void* executor, std::coroutine_handle<> handle) = nullptr;
+        };
+
+        // A FIFO list of waiters.
+        template <class Waiter>
+        struct waiter_list {
+            bool empty() const {
+                return head == nullptr;
+            }
+
+            void push_back(Waiter* waiter) {
+                waiter->next = nullptr;
+                if (tail) {
+                    tail->next = waiter;
+                } else {
+                    head = waiter;
+                }
+                tail = waiter;
+            }
+
+            Waiter* pop_front() {
+                Waiter* waiter = head;
+                head = static_cast<Waiter*>(waiter->next);
+                if (!head) {
+                    tail = nullptr;
+                }
+                return waiter;
+            }
+
+            Waiter* head = nullptr;
+            Waiter* tail = nullptr;
+        };
+
+        // The waiters whose operations have been completed by a queue
+        // operation, which are resumed when the list is destroyed. The list
+        // is declared before the lock of the queue is acquired, so that the
+        // waiters are resumed after the lock has been released.
+        struct ready_waiters : waiter_list<queue_waiter> {
+            ready_waiters() = default;
+            ready_waiters(const ready_waiters&) = delete;
+            ready_waiters& operator=(const ready_waiters&) = delete;
+
+            ~ready_waiters() {
+                while (!empty()) {
+                    pop_front()->resume();
+                }
+            }
+        };
+
+    }  // namespace detail
+
     // Concurrent bounded FIFO queue class.
+    // The elements are stored in a ring of max_size slots that is
+    // allocated once, when the queue is constructed, so the operations on
+    // the queue never allocate memory themselves (although constructing
+    // or moving an element may).
     template <class T>
     class queue {
         public:
@@ -17,19 +125,91 @@ namespace ra::concurrency {
             // A type for the status of a queue operation.
             enum class status {
                 success = 0,  // operation successful
-                empty,        // queue is empty (not currently used)
-                full,         // queue is full (not currently used)
+                empty,        // queue is empty
+                full,         // queue is full
                 closed,       // queue is closed
             };
 
+            // The awaiter of async_pop (see below).
+            class pop_awaiter : public detail::queue_waiter {
+                public:
+                    pop_awaiter(const pop_awaiter&) = delete;
+                    pop_awaiter& operator=(const pop_awaiter&) = delete;
+
+                    bool await_ready() const noexcept {
+                        return false;
+                    }
+
+                    bool await_suspend(std::coroutine_handle<> handle) {
+                        return queue_.suspend_pop(*this, handle);
+                    }
+
+                    std::optional<value_type> await_resume() {
+                        return std::move(value_);
+                    }
+
+                private:
+                    friend class queue;
+
+                    pop_awaiter(queue& q, void* executor, void (*resume_with)(void*, std::coroutine_handle<>))
+                        : queue_(q) {
+                        this->executor = executor;
+                        this->resume_with = resume_with;
+                    }
+
+                    // The queue, and the value removed from it (if any).
+                    queue& queue_;
+                    std::optional<value_type> value_;
+            };
+
+            // The awaiter of async_push (see below).
+            class push_awaiter : public detail::queue_waiter {
+                public:
+                    push_awaiter(const push_awaiter&) = delete;
+                    push_awaiter& operator=(const push_awaiter&) = delete;
+
+                    bool await_ready() const noexcept {
+                        return false;
+                    }
+
+                    bool await_suspend(std::coroutine_handle<> handle) {
+                        return queue_.suspend_push(*this, handle);
+                    }
+
+                    status await_resume() const noexcept {
+                        return result_;
+                    }
+
+                private:
+                    friend class queue;
+
+                    push_awaiter(queue& q, value_type& x, void* executor,
+                                 void (*resume_with)(void*, std::coroutine_handle<>))
+                        : queue_(q), value_(&x), result_(status::closed) {
+                        this->executor = executor;
+                        this->resume_with = resume_with;
+                    }
+
+                    // The queue, the value to be inserted, and the result of
+                    // the insertion.
+                    queue& queue_;
+                    value_type* value_;
+                    status result_;
+            };
+
             // A queue is not default constructible.
             queue() = delete;
 
             // Constructs a queue with a maximum size of max_size.
             // The queue is marked as open (i.e., not closed).
+            // The threads blocked in pop and pop_bulk wait for the queue to
+            // become nonempty as specified by wait (by default, they block
+            // on a condition variable right away).
             // Precondition: The quantity max_size must be greater than
             // zero.
-            queue(size_type max_size) : max_size_(max_size), closed_(false) {}
+            queue(size_type max_size, const wait_strategy& wait = wait_strategy())
+                : max_size_(max_size), slots_(new slot[max_size]), head_(0), size_(0), closed_(false),
+                  push_waiters_(0), pop_waiters_(0), size_hint_(0), spinner_(wait) {}
 
             // A queue is not movable or copyable.
             queue(const queue&) = delete;
@@ -63,25 +243,132 @@ namespace ra::concurrency {
             // implies that the push function is permitted to change
             // the value of x (e.g., by moving from x).
             status push(value_type&& x) {
-                std::unique_lock<std::mutex> lock(mutex_);
+                return emplace(std::move(x));
+            }
+
+            // Inserts a value constructed in place from args at the end of
+            // the queue, blocking if necessary.
+            // The value is constructed directly in its slot of the queue
+            // (with the lock held). Otherwise, the function behaves like
+            // push.
+            // This function is thread safe.
+            template <class... Args>
+            status emplace(Args&&... args) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
 
                 // Wait until the queue is not full or the queue is closed.
-                condition_push_.wait(lock, [this]() { return !is_full() || closed_; });
+                wait_not_full(lock);
 
                 // If the queue is closed, return with status::closed.
                 if (closed_) {
                     return status::closed;
                 }
 
-                // Insert the value x at the end of the queue.
-                queue_.push(std::move(x));
+                // Insert the value at the end of the queue.
+                construct_back(std::forward<Args>(args)...);
 
-                // Notify any threads waiting for the queue to be not empty.
-                condition_pop_.notify_one();
+                // Notify any threads or coroutines waiting for the queue to
+                // be not empty.
+                values_inserted(ready, 1);
 
                 return status::success;
             }
 
+            // Inserts the value x at the end of the queue if the queue is
+            // neither full nor closed, without blocking.
+            // The function returns status::success if the value x is
+            // inserted, status::full if the queue is full, and
+            // status::closed if the queue is closed.
+            // The value x is only moved from if it is inserted.
+            // This function is thread safe.
+            status try_push(value_type&& x) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                return insert(ready, std::move(x));
+            }
+
+            // Inserts a value constructed in place from args at the end of
+            // the queue if the queue is neither full nor closed, without
+            // blocking.
+            // The function returns as try_push does; the value is only
+            // constructed if it is inserted.
+            // This function is thread safe.
+            template <class... Args>
+            status try_emplace(Args&&... args) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                return insert(ready, std::forward<Args>(args)...);
+            }
+
+            // Inserts the value x at the end of the queue, blocking for at
+            // most rel_time if the queue is full.
+            // The function returns status::full if the queue is still full
+            // after rel_time has elapsed, and otherwise behaves like push.
+            // The value x is only moved from if it is inserted.
+            // This function is thread safe.
+            template <class Rep, class Period>
+            status try_push_for(value_type&& x, const std::chrono::duration<Rep, Period>& rel_time) {
+                return try_push_until(std::move(x), std::chrono::steady_clock::now() + rel_time);
+            }
+
+            // Inserts the value x at the end of the queue, blocking until
+            // at most abs_time if the queue is full.
+            // The function returns status::full if the queue is still full
+            // at abs_time, and otherwise behaves like push.
+            // The value x is only moved from if it is inserted.
+            // This function is thread safe.
+            template <class Clock, class Duration>
+            status try_push_until(value_type&& x, const std::chrono::time_point<Clock, Duration>& abs_time) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                wait_not_full(lock, abs_time);
+                return insert(ready, std::move(x));
+            }
+
+            // Inserts the values in the range [first, last) at the end of
+            // the queue (in order), blocking if necessary.
+            // As many values as fit in the queue are moved in under a single
+            // acquisition of the lock, and as many threads as there are new
+            // values are woken up. If the queue becomes full, the thread is
+            // blocked until more values can be inserted or the queue is
+            // closed.
+            // The function returns the number of values inserted, which is
+            // less than the size of the range only if the queue is closed.
+            // This function is thread safe.
+            // Note: The values in the range are moved from.
+            template <class InputIt>
+            size_type push_range(InputIt first, InputIt last) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                size_type count = 0;
+                while (first != last) {
+                    wait_not_full(lock);
+                    if (closed_) {
+                        break;
+                    }
+                    count += insert_range(ready, first, last);
+                }
+                return count;
+            }
+
+            // Inserts as many values from the front of the range
+            // [first, last) as currently fit at the end of the queue
+            // (in order), without blocking.
+            // The function returns the number of values inserted, which is
+            // zero if the queue is full or closed.
+            // This function is thread safe.
+            // Note: The inserted values are moved from.
+            template <class InputIt>
+            size_type try_push_range(InputIt first, InputIt last) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                if (closed_) {
+                    return 0;
+                }
+                return insert_range(ready, first, last);
+            }
+
             // Removes the value from the front of the queue and places it
             // in x, blocking if necessary.
             // If the queue is empty and not closed, the thread is blocked
@@ -97,61 +384,223 @@ namespace ra::concurrency {
             // status::closed.
             // This function is thread safe.
             status pop(value_type& x) {
-                std::unique_lock<std::mutex> lock(mutex_);
+                return pop_with([&x](value_type&& value) { x = std::move(value); });
+            }
+
+            // Removes the value from the front of the queue as pop does, but
+            // instead of moving the value out, passes it (as an rvalue, in
+            // its slot of the queue) to f, and destroys it afterwards (even
+            // if f exits with an exception).
+            // The function f is called with the lock held, so it should be
+            // short (e.g., move out the parts of the value that it needs).
+            // This function is thread safe.
+            template <class F>
+            status pop_with(F&& f) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
 
                 // Wait until the queue is not empty or the queue is closed.
-                condition_pop_.wait(lock, [this]() { return !is_empty() || closed_; });
+                wait_not_empty(lock);
 
-                // If the queue is empty and closed, or the queue is empty, return with status::closed.
-                if ((is_empty() && closed_) || is_empty()) {
+                // If the queue is empty (and hence closed), return with
+                // status::closed.
+                if (is_empty()) {
                     return status::closed;
                 }
 
-                // Remove the value from the front of the queue.
-                x = std::move(queue_.front());
-                queue_.pop();
-
-                // Notify any threads waiting for the queue to be not full.
-                condition_push_.notify_one();
+                // Remove the value from the front of the queue, and notify
+                // any threads or coroutines waiting for the queue to be not
+                // full.
+                remove_front(ready, f);
 
                 return status::success;
             }
 
+            // Removes the value from the front of the queue and places it
+            // in x if the queue is not empty, without blocking.
+            // The function returns status::success if a value is removed,
+            // status::empty if the queue is empty but not closed, and
+            // status::closed if the queue is both empty and closed.
+            // This function is thread safe.
+            status try_pop(value_type& x) {
+                return try_pop_with([&x](value_type&& value) { x = std::move(value); });
+            }
+
+            // Removes the value from the front of the queue and passes it
+            // to f as pop_with does if the queue is not empty, without
+            // blocking.
+            // The function returns as try_pop does.
+            // This function is thread safe.
+            template <class F>
+            status try_pop_with(F&& f) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                return remove(ready, f);
+            }
+
+            // Removes the value from the front of the queue and places it
+            // in x, blocking for at most rel_time if the queue is empty.
+            // The function returns status::empty if the queue is still
+            // empty (and not closed) after rel_time has elapsed, and
+            // otherwise behaves like pop.
+            // This function is thread safe.
+            template <class Rep, class Period>
+            status try_pop_for(value_type& x, const std::chrono::duration<Rep, Period>& rel_time) {
+                return try_pop_until(x, std::chrono::steady_clock::now() + rel_time);
+            }
+
+            // Removes the value from the front of the queue and places it
+            // in x, blocking until at most abs_time if the queue is empty.
+            // The function returns status::empty if the queue is still
+            // empty (and not closed) at abs_time, and otherwise behaves
+            // like pop.
+            // This function is thread safe.
+            template <class Clock, class Duration>
+            status try_pop_until(value_type& x, const std::chrono::time_point<Clock, Duration>& abs_time) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                wait_not_empty(lock, abs_time);
+                return remove(ready, [&x](value_type&& value) { x = std::move(value); });
+            }
+
+            // Removes up to max_n values from the front of the queue and
+            // writes them (in order) to out, blocking if necessary.
+            // If the queue is empty and not closed, the thread is blocked
+            // until a value can be removed or the queue is closed. Then, as
+            // many values as are available (up to max_n) are removed under a
+            // single acquisition of the lock, and as many threads as there
+            // are free slots are woken up.
+            // The function returns the number of values removed, which is
+            // zero only if the queue is both empty and closed (or if max_n
+            // is zero).
+            // This function is thread safe.
+            template <class OutputIt>
+            size_type pop_bulk(OutputIt out, size_type max_n) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                if (max_n == 0) {
+                    return 0;
+                }
+                wait_not_empty(lock);
+                return remove_bulk(ready, out, max_n);
+            }
+
+            // Removes up to max_n values from the front of the queue and
+            // writes them (in order) to out, without blocking.
+            // The function returns the number of values removed, which is
+            // zero if the queue is empty.
+            // This function is thread safe.
+            template <class OutputIt>
+            size_type try_pop_bulk(OutputIt out, size_type max_n) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                return remove_bulk(ready, out, max_n);
+            }
+
+            // Removes the value from the front of the queue in a coroutine,
+            // suspending the coroutine (rather than blocking the thread)
+            // while the queue is empty and not closed.
+            // The expression co_await q.async_pop() yields an
+            // std::optional holding the removed value, or no value if the
+            // queue is both empty and closed.
+            // A coroutine that has to wait is resumed by the thread whose
+            // operation on the queue (e.g., a push or close) completes the
+            // pop, once that thread has released the lock of the queue.
+            // The coroutine must not be destroyed while it waits.
+            // This function is thread safe.
+            pop_awaiter async_pop() {
+                return pop_awaiter(*this, nullptr, &resume_inline);
+            }
+
+            // Removes the value from the front of the queue in a coroutine
+            // as above, but a coroutine that has to wait is resumed by a
+            // task scheduled with executor.schedule (e.g., on a thread
+            // pool), so that long pipelines of coroutines do not nest on
+            // the stack of the thread that completes their operations.
+            // If that task is discarded (e.g., because the thread pool has
+            // been shutdown), the coroutine is destroyed instead (see
+            // ra::concurrency::task), and a value it removed is lost.
+            // This function is thread safe.
+            template <class Executor>
+            pop_awaiter async_pop(Executor& executor) {
+                return pop_awaiter(*this, &executor, &resume_on<Executor>);
+            }
+
+            // Inserts the value x at the end of the queue in a coroutine,
+            // suspending the coroutine (rather than blocking the thread)
+            // while the queue is full and not closed.
+            // The expression co_await q.async_push(x) yields
+            // status::success if the value x is inserted and
+            // status::closed if the queue is closed; x is only moved from
+            // if it is inserted, and must stay alive until then.
+            // A coroutine that has to wait is resumed as with async_pop.
+            // This function is thread safe.
+            push_awaiter async_push(value_type&& x) {
+                return push_awaiter(*this, x, nullptr, &resume_inline);
+            }
+
+            // Inserts the value x at the end of the queue in a coroutine as
+            // above, but a coroutine that has to wait is resumed by a task
+            // scheduled with executor.schedule (see async_pop).
+            // This function is thread safe.
+            template <class Executor>
+            push_awaiter async_push(value_type&& x, Executor& executor) {
+                return push_awaiter(*this, x, &executor, &resume_on<Executor>);
+            }
+
             // Closes the queue.
             // The queue is placed in the closed state.
             // The closed state prevents more items from being inserted
             // on the queue, but it does not clear the items that are
             // already on the queue.
+            // The coroutines waiting in async_push or async_pop are resumed
+            // with the result of a closed queue.
             // Invoking this function on a closed queue has no effect.
             // This function is thread safe.
             void close() {
-                std::unique_lock<std::mutex> lock(mutex_);
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
                 closed_ = true;
                 condition_push_.notify_all();
                 condition_pop_.notify_all();
+                while (!async_pushes_.empty()) {
+                    ready.push_back(async_pushes_.pop_front());
+                }
+                while (!async_pops_.empty()) {
+                    ready.push_back(async_pops_.pop_front());
+                }
             }
 
             // Clears the queue.
             // All of the elements on the queue are discarded.
             // This function is thread safe.
             void clear() {
-                std::unique_lock<std::mutex> lock(mutex_);
-                while (!queue_.empty()) {
-                    queue_.pop();
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                size_type count = size_;
+                while (!is_empty()) {
+                    destroy_front();
                 }
+                slots_freed(ready, count);
             }
 
             // Returns if the queue is currently full (i.e., the number of
             // elements in the queue equals the maximum queue size).
             // This function is not thread safe.
             bool is_full() const {
-                return queue_.size() == max_size_;
+                return size_ == max_size_;
             }
 
             // Returns if the queue is currently empty.
             // This function is not thread safe.
             bool is_empty() const {
-                return queue_.empty();
+                return size_ == 0;
+            }
+
+            // Returns the number of elements in the queue.
+            // This function is not thread safe.
+            size_type size() const {
+                return size_;
             }
 
             // Returns if the queue is closed (i.e., in the closed state).
@@ -167,24 +616,388 @@ namespace ra::concurrency {
                 return max_size_;
             }
 
+            // Returns the statistics of the queue, which are all zero
+            // unless RA_STATS is 1 (see ra/stats.hpp).
+            // This function is thread safe.
+            queue_stats stats() const {
+#if RA_STATS
+                std::unique_lock<std::mutex> lock(mutex_);
+                return stats_;
+#else
+                return queue_stats();
+#endif
+            }
+
         private:
+            // The assumed size of a cache line, used to keep the fields that
+            // different threads write from sharing a cache line.
+            static constexpr size_type cache_line_size = 64;
+
+            // A slot of the ring buffer, which holds an element while it is
+            // in the queue.
+            struct slot {
+                value_type* value() {
+                    return std::launder(reinterpret_cast<value_type*>(storage));
+                }
+
+                alignas(value_type) unsigned char storage[sizeof(value_type)];
+            };
+
+            // Constructs a value from args at the end of the queue.
+            // The lock must be held, and the queue must not be full.
+            template <class... Args>
+            void construct_back(Args&&... args) {
+                size_type tail = head_ + size_;
+                if (tail >= max_size_) {
+                    tail -= max_size_;
+                }
+                ::new (static_cast<void*>(slots_[tail].storage)) value_type(std::forward<Args>(args)...);
+                ++size_;
+            }
+
+            // Destroys the value at the front of the queue.
+            // The lock must be held, and the queue must not be empty.
+            void destroy_front() {
+                slots_[head_].value()->~value_type();
+                if (++head_ == max_size_) {
+                    head_ = 0;
+                }
+                --size_;
+            }
+
+            // Passes the value at the front of the queue to f as an rvalue,
+            // then destroys it.
+            // The lock must be held, and the queue must not be empty.
+            template <class F>
+            void consume_front(F& f) {
+                struct guard {
+                    queue* q;
+                    ~guard() {
+                        q->destroy_front();
+                        q->size_changed();
+                    }
+                } g{this};
+                f(std::move(*slots_[head_].value()));
+            }
+
+            // Removes the value at the front of the queue as consume_front
+            // does, and then announces the freed slot (see slots_freed),
+            // even if f exits with an exception.
+            // The lock must be held, and the queue must not be empty.
+            template <class F>
+            void remove_front(detail::ready_waiters& ready, F& f) {
+                try {
+                    consume_front(f);
+                } catch (...) {
+                    slots_freed(ready, 1);
+                    throw;
+                }
+                slots_freed(ready, 1);
+            }
+
+            // Resumes the coroutine handle in the calling thread.
+            static void resume_inline(void*, std::coroutine_handle<> handle) {
+                handle.resume();
+            }
+
+            // Resumes the coroutine handle in a task scheduled on executor
+            // (or destroys it if the task is discarded).
+            template <class Executor>
+            static void resume_on(void* executor, std::coroutine_handle<> handle) {
+                static_cast<Executor*>(executor)->schedule(detail::coroutine_resumer(handle));
+            }
+
+            // Completes the pop of awaiter if the queue is not empty or is
+            // closed, and otherwise adds awaiter to the waiting pops.
+            // Returns if the coroutine handle has to wait.
+            bool suspend_pop(pop_awaiter& awaiter, std::coroutine_handle<> handle) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                if (!is_empty()) {
+                    auto move_to_awaiter = [&awaiter](value_type&& value) { awaiter.value_.emplace(std::move(value)); };
+                    remove_front(ready, move_to_awaiter);
+                    return false;
+                }
+                if (closed_) {
+                    return false;
+                }
+#if RA_STATS
+                ++stats_.blocked_pops;
+#endif
+                awaiter.handle = handle;
+                async_pops_.push_back(&awaiter);
+                return true;
+            }
+
+            // Completes the push of awaiter if the queue is not full or is
+            // closed, and otherwise adds awaiter to the waiting pushes.
+            // Returns if the coroutine handle has to wait.
+            bool suspend_push(push_awaiter& awaiter, std::coroutine_handle<> handle) {
+                detail::ready_waiters ready;
+                std::unique_lock<std::mutex> lock = lock_mutex();
+                if (closed_) {
+                    awaiter.result_ = status::closed;
+                    return false;
+                }
+                if (!is_full()) {
+                    construct_back(std::move(*awaiter.value_));
+                    awaiter.result_ = status::success;
+                    values_inserted(ready, 1);
+                    return false;
+                }
+#if RA_STATS
+                ++stats_.blocked_pushes;
+#endif
+                awaiter.handle = handle;
+                async_pushes_.push_back(&awaiter);
+                return true;
+            }
+
+            // Hands the n values just inserted to the waiting pops (which
+            // thus complete and are added to ready) and wakes up the blocked
+            // consumers for the rest of them.
+            // The lock must be held.
+            void values_inserted(detail::ready_waiters& ready, size_type n) {
+                while (n > 0 && !async_pops_.empty()) {
+                    pop_awaiter* awaiter = async_pops_.pop_front();
+                    auto move_to_awaiter = [awaiter](value_type&& value) { awaiter->value_.emplace(std::move(value)); };
+                    consume_front(move_to_awaiter);
+                    ready.push_back(awaiter);
+                    --n;
+                }
+                size_changed();
+                notify(condition_pop_, pop_waiters_, n);
+            }
+
+            // Fills the n slots just freed with the values of the waiting
+            // pushes (which thus complete and are added to ready) and wakes
+            // up the blocked producers for the rest of them.
+            // The lock must be held.
+            void slots_freed(detail::ready_waiters& ready, size_type n) {
+                while (n > 0 && !async_pushes_.empty()) {
+                    push_awaiter* awaiter = async_pushes_.pop_front();
+                    construct_back(std::move(*awaiter->value_));
+                    awaiter->result_ = status::success;
+                    ready.push_back(awaiter);
+                    --n;
+                }
+                size_changed();
+                notify(condition_push_, push_waiters_, n);
+            }
+
+            // Acquires the mutex, counting the acquisitions that have to
+            // wait for another thread.
+            std::unique_lock<std::mutex> lock_mutex() const {
+#if RA_STATS
+                std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+                if (!lock.owns_lock()) {
+                    lock.lock();
+                    ++stats_.contended_locks;
+                }
+                return lock;
+#else
+                return std::unique_lock<std::mutex>(mutex_);
+#endif
+            }
+
+            // Records the current size of the queue for spinning waiters
+            // (and in the statistics). The lock must be held.
+            void size_changed() {
+                size_hint_.store(size_, std::memory_order_relaxed);
+#if RA_STATS
+                stats_.high_water = std::max(stats_.high_water, size_);
+#endif
+            }
+
+            // Blocks (with lock held on entry and exit) until the queue is
+            // not full or the queue is closed.
+            void wait_not_full(std::unique_lock<std::mutex>& lock) {
+#if RA_STATS
+                stats_.blocked_pushes += is_full() && !closed_;
+#endif
+                while (is_full() && !closed_) {
+                    ++push_waiters_;
+                    condition_push_.wait(lock);
+                    --push_waiters_;
+                }
+            }
+
+            // Blocks (with lock held on entry and exit) until the queue is
+            // not empty or the queue is closed.
+            void wait_not_empty(std::unique_lock<std::mutex>& lock) {
+#if RA_STATS
+                stats_.blocked_pops += is_empty() && !closed_;
+#endif
+                // Spin (without the lock) before parking. Spinning threads
+                // do not count as waiters, so they need no notification.
+                if (is_empty() && !closed_ && spinner_.enabled()) {
+                    lock.unlock();
+                    spinner_.spin([this]() { return size_hint_.load(std::memory_order_relaxed) > 0; });
+                    lock.lock();
+                }
+                while (is_empty() && !closed_) {
+                    ++pop_waiters_;
+                    condition_pop_.wait(lock);
+                    --pop_waiters_;
+                }
+            }
+
+            // Blocks (with lock held on entry and exit) until the queue is
+            // not full, the queue is closed, or abs_time is reached.
+            template <class Clock, class Duration>
+            void wait_not_full(std::unique_lock<std::mutex>& lock,
+                               const std::chrono::time_point<Clock, Duration>& abs_time) {
+#if RA_STATS
+                stats_.blocked_pushes += is_full() && !closed_;
+#endif
+                while (is_full() && !closed_) {
+                    ++push_waiters_;
+                    std::cv_status result = condition_push_.wait_until(lock, abs_time);
+                    --push_waiters_;
+                    if (result == std::cv_status::timeout) {
+                        break;
+                    }
+                }
+            }
+
+            // Blocks (with lock held on entry and exit) until the queue is
+            // not empty, the queue is closed, or abs_time is reached.
+            template <class Clock, class Duration>
+            void wait_not_empty(std::unique_lock<std::mutex>& lock,
+                                const std::chrono::time_point<Clock, Duration>& abs_time) {
+#if RA_STATS
+                stats_.blocked_pops += is_empty() && !closed_;
+#endif
+                while (is_empty() && !closed_) {
+                    ++pop_waiters_;
+                    std::cv_status result = condition_pop_.wait_until(lock, abs_time);
+                    --pop_waiters_;
+                    if (result == std::cv_status::timeout) {
+                        break;
+                    }
+                }
+            }
+
+            // Inserts a value constructed from args at the end of the queue
+            // (if possible) without blocking.
+            // The lock must be held.
+            template <class... Args>
+            status insert(detail::ready_waiters& ready, Args&&... args) {
+                if (closed_) {
+                    return status::closed;
+                }
+                if (is_full()) {
+                    return status::full;
+                }
+                construct_back(std::forward<Args>(args)...);
+                values_inserted(ready, 1);
+                return status::success;
+            }
+
+            // Removes the value at the front of the queue (if any) and
+            // passes it to f without blocking.
+            // The lock must be held.
+            template <class F>
+            status remove(detail::ready_waiters& ready, F&& f) {
+                if (is_empty()) {
+                    return closed_ ? status::closed : status::empty;
+                }
+                remove_front(ready, f);
+                return status::success;
+            }
+
+            // Wakes up enough of the waiters blocked on condition to
+            // consume n newly inserted values (or n newly freed slots).
+            static void notify(std::condition_variable& condition, size_type waiters, size_type n) {
+                if (waiters == 0 || n == 0) {
+                    return;
+                }
+                if (n >= waiters) {
+                    condition.notify_all();
+                } else {
+                    while (n-- > 0) {
+                        condition.notify_one();
+                    }
+                }
+            }
+
+            // Moves as many values from the front of [first, last) into the
+            // queue as fit, advancing first past them, and wakes up the
+            // corresponding number of waiting consumers.
+            // The lock must be held.
+            template <class InputIt>
+            size_type insert_range(detail::ready_waiters& ready, InputIt& first, InputIt last) {
+                size_type count = 0;
+                while (first != last && !is_full()) {
+                    construct_back(std::move(*first));
+                    ++first;
+                    ++count;
+                }
+                values_inserted(ready, count);
+                return count;
+            }
+
+            // Moves up to max_n values from the front of the queue to out,
+            // and wakes up the corresponding number of waiting producers.
+            // The lock must be held.
+            template <class OutputIt>
+            size_type remove_bulk(detail::ready_waiters& ready, OutputIt& out, size_type max_n) {
+                size_type count = 0;
+                while (count < max_n && !is_empty()) {
+                    *out = std::move(*slots_[head_].value());
+                    ++out;
+                    destroy_front();
+                    ++count;
+                }
+                slots_freed(ready, count);
+                return count;
+            }
 
             // The maximum number of elements that can be held in the queue.
             size_type max_size_;
 
-            // The queue of elements.
-            std::queue<value_type> queue_;
-            
+            // The ring buffer of max_size_ slots. The elements of the queue
+            // are in the size_ slots starting at head_ (wrapping around).
+            std::unique_ptr<slot[]> slots_;
+
+            // The mutex used to protect the queue, followed by the state
+            // that it protects (which only the thread holding the lock
+            // touches, so it may share the cache line of the mutex).
+            alignas(cache_line_size) mutable std::mutex mutex_;
+            size_type head_;
+            size_type size_;
+
             // The flag used to indicate whether the queue is closed.
             bool closed_;
 
-            // The mutex used to protect the queue.
-            mutable std::mutex mutex_;
+            // The number of threads blocked on condition_push_ and
+            // condition_pop_, respectively.
+            size_type push_waiters_;
+            size_type pop_waiters_;
+
+            // The coroutines waiting in async_push and async_pop,
+            // respectively, in the order in which they started waiting.
+            detail::waiter_list<push_awaiter> async_pushes_;
+            detail::waiter_list<pop_awaiter> async_pops_;
 
             // The condition variable used to block threads when the queue is
-            // full or empty.
-            mutable std::condition_variable condition_push_;
-            mutable std::condition_variable condition_pop_;
+            // full or empty, each on a cache line of its own, since the
+            // waiting threads write to them as they block and wake up.
+            alignas(cache_line_size) mutable std::condition_variable condition_push_;
+            alignas(cache_line_size) mutable std::condition_variable condition_pop_;
+
+            // The number of elements in the queue, readable without the
+            // lock by spinning waiters, and the spinning phase of their
+            // waits, which the spinning waiters poll and update.
+            alignas(cache_line_size) std::atomic<size_type> size_hint_;
+            spin_waiter spinner_;
+#if RA_STATS
+
+            // The statistics of the queue (protected by the mutex).
+            mutable queue_stats stats_;
+#endif
     };
 
-}  // namespace ra::concurrency
\ No newline at end of file
+}  // namespace ra::concurrency
+
+#endif  // QUEUE_HPP
@@ -0,0 +1,144 @@
+#ifndef SPIN_WAIT_HPP
+#define SPIN_WAIT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace ra::concurrency {
+
+    // Hints to the CPU that the calling thread is spinning (e.g., with the
+    // pause instruction on x86), which saves power and frees resources for
+    // a sibling hyperthread.
+    inline void cpu_relax() {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_ia32_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    // How a thread waits for work (e.g., for a queue to become nonempty).
+    // The thread first spins, checking for work between pause
+    // instructions, then yields its CPU a few times, and only then parks
+    // (blocks on a condition variable). Spinning avoids the latency of a
+    // sleep and wake-up through the kernel when work arrives shortly, at
+    // the cost of keeping a CPU busy while waiting.
+    struct wait_strategy {
+        // The maximum number of checks (between pause instructions) before
+        // yielding, or zero to never spin.
+        std::uint32_t max_spins = 0;
+
+        // The number of times to yield before parking.
+        std::uint32_t yields = 0;
+
+        // Whether the number of spins adapts to recent waits. If so, the
+        // budget moves towards twice the number of spins that recent
+        // successful waits took, and is halved whenever the thread ends up
+        // parking, so that threads whose waits are long stop spinning.
+        // Every 16th wait spins for max_spins regardless, so that the
+        // budget grows again once waits become short.
+        bool adaptive = true;
+
+        // Returns the strategy that parks right away (the default).
+        static wait_strategy park() {
+            return wait_strategy();
+        }
+
+        // Returns a strategy that spins (adaptively) and yields before
+        // parking.
+        static wait_strategy spin_then_park(std::uint32_t max_spins = 4096, std::uint32_t yields = 8) {
+            wait_strategy strategy;
+            strategy.max_spins = max_spins;
+            strategy.yields = yields;
+            return strategy;
+        }
+    };
+
+    // Spin-wait class.
+    // A spin waiter implements the spinning and yielding phases of a wait
+    // strategy, and keeps its (adaptive) spin budget across waits.
+    class spin_waiter {
+        public:
+            // Creates a spin waiter for the given strategy.
+            explicit spin_waiter(const wait_strategy& strategy = wait_strategy())
+                : strategy_(strategy), budget_(strategy.max_spins), waits_(0) {}
+
+            // A spin waiter is not copyable or movable.
+            spin_waiter(const spin_waiter&) = delete;
+            spin_waiter& operator=(const spin_waiter&) = delete;
+
+            // Tests if the strategy spins or yields at all.
+            bool enabled() const {
+                return strategy_.max_spins > 0 || strategy_.yields > 0;
+            }
+
+            // Returns the current spin budget.
+            std::uint32_t budget() const {
+                return budget_.load(std::memory_order_relaxed);
+            }
+
+            // Spins and yields as budgeted until ready() returns true.
+            // Returns true if ready() returned true, and false if the caller
+            // should park.
+            // This function is thread safe (the threads then share the
+            // budget).
+            template <class Ready>
+            bool spin(Ready&& ready) {
+                std::uint32_t budget = budget_.load(std::memory_order_relaxed);
+                bool probe = strategy_.adaptive && waits_.fetch_add(1, std::memory_order_relaxed) % 16 == 15;
+                std::uint32_t spins = probe ? strategy_.max_spins : budget;
+                for (std::uint32_t i = 0; i < spins; ++i) {
+                    if (ready()) {
+                        adapt(budget, 2 * i, i >= budget);
+                        return true;
+                    }
+                    cpu_relax();
+                }
+                for (std::uint32_t i = 0; i < strategy_.yields; ++i) {
+                    if (ready()) {
+                        adapt(budget, strategy_.max_spins, false);
+                        return true;
+                    }
+                    std::this_thread::yield();
+                }
+                if (ready()) {
+                    return true;
+                }
+
+                // Keep a small budget, so that the waiter can find out when
+                // waits become short again.
+                if (strategy_.adaptive) {
+                    std::uint32_t floor = std::max<std::uint32_t>(strategy_.max_spins / 64, 1);
+                    budget_.store(std::max(budget / 2, std::min(floor, strategy_.max_spins)),
+                                  std::memory_order_relaxed);
+                }
+                return false;
+            }
+
+        private:
+            // Moves the budget a quarter of the way towards target, or all
+            // the way if the wait only succeeded beyond the budget.
+            void adapt(std::uint32_t budget, std::uint32_t target, bool beyond_budget) {
+                if (strategy_.adaptive) {
+                    target = std::min<std::uint32_t>(std::max<std::uint32_t>(target, 16), strategy_.max_spins);
+                    budget = beyond_budget ? std::max(budget, target)
+                                           : static_cast<std::uint32_t>((std::uint64_t(budget) * 3 + target) / 4);
+                    budget_.store(budget, std::memory_order_relaxed);
+                }
+            }
+
+            // The wait strategy.
+            wait_strategy strategy_;
+
+            // The current number of spins before yielding.
+            std::atomic<std::uint32_t> budget_;
+
+            // The number of waits so far (modulo 2^32).
+            std::atomic<std::uint32_t> waits_;
+    };
+
+}  // namespace ra::concurrency
+
+#endif  // SPIN_WAIT_HPP
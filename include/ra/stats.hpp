@@ -0,0 +1,143 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Whether queues and thread pools collect statistics (see queue::stats and
+// thread_pool::stats). The statistics cost a few clock reads and counter
+// updates per task, so they are disabled unless RA_STATS is defined as 1
+// (e.g., with the CMake option ENABLE_STATS). The setting must be the same
+// in all translation units of a program.
+#ifndef RA_STATS
+#define RA_STATS 0
+#endif
+
+namespace ra::concurrency {
+
+    // A histogram of durations, with buckets on a logarithmic scale.
+    struct latency_histogram {
+        // The number of buckets.
+        static constexpr std::size_t num_buckets = 32;
+
+        // The number of durations in each bucket. Bucket k holds the
+        // durations from 2^k ns up to (but excluding) 2^(k + 1) ns, except
+        // that bucket 0 also holds durations below 1 ns and the last
+        // bucket holds all longer durations.
+        std::array<std::uint64_t, num_buckets> counts{};
+
+        // Returns the bucket of the duration d.
+        static std::size_t bucket(std::chrono::nanoseconds d) {
+            auto ns = static_cast<std::uint64_t>(std::max<std::chrono::nanoseconds::rep>(d.count(), 1));
+            return std::min<std::size_t>(std::bit_width(ns) - 1, num_buckets - 1);
+        }
+
+        // Returns the number of durations in the histogram.
+        std::uint64_t total() const {
+            std::uint64_t n = 0;
+            for (std::uint64_t count : counts) {
+                n += count;
+            }
+            return n;
+        }
+
+        // Returns an upper bound of the q-quantile (0 <= q <= 1) of the
+        // durations, namely the end of the bucket that holds it (or zero if
+        // the histogram is empty).
+        std::chrono::nanoseconds quantile(double q) const {
+            std::uint64_t n = total();
+            if (n == 0) {
+                return std::chrono::nanoseconds(0);
+            }
+            auto rank = static_cast<std::uint64_t>(q * static_cast<double>(n - 1));
+            std::size_t k = 0;
+            for (std::uint64_t seen = counts[0]; seen <= rank; seen += counts[++k]) {
+            }
+            return std::chrono::nanoseconds(std::int64_t(1) << (k + 1));
+        }
+
+        // Adds the durations of other to the histogram.
+        latency_histogram& operator+=(const latency_histogram& other) {
+            for (std::size_t k = 0; k < num_buckets; ++k) {
+                counts[k] += other.counts[k];
+            }
+            return *this;
+        }
+    };
+
+    // Statistics of a queue (see queue::stats).
+    struct queue_stats {
+        // The number of insertions that had to wait for the queue to have
+        // room (including those that gave up).
+        std::uint64_t blocked_pushes = 0;
+
+        // The number of removals that had to wait for the queue to be
+        // nonempty (including those that gave up).
+        std::uint64_t blocked_pops = 0;
+
+        // The number of times that the mutex of the queue was held by
+        // another thread when a thread tried to acquire it.
+        std::uint64_t contended_locks = 0;
+
+        // The largest number of elements that the queue has held.
+        std::size_t high_water = 0;
+    };
+
+    // Statistics of a thread pool (see thread_pool::stats).
+    struct thread_pool_stats {
+        // The statistics of a thread.
+        struct thread_stats {
+            // The number of tasks executed by the thread.
+            std::uint64_t tasks_executed = 0;
+
+            // The total time spent executing tasks.
+            std::chrono::nanoseconds busy_time{0};
+
+            // The total time spent waiting for tasks (threads of the pool
+            // only).
+            std::chrono::nanoseconds idle_time{0};
+        };
+
+        // Whether statistics are collected (i.e., RA_STATS is 1). If not,
+        // all counts are zero.
+        bool enabled = false;
+
+        // The statistics of each thread of the pool.
+        std::vector<thread_stats> threads;
+
+        // The statistics of the threads outside the pool, which execute
+        // tasks while waiting (e.g., in task_group::wait), combined.
+        thread_stats outside;
+
+        // The time from scheduling to the start of execution of the tasks.
+        latency_histogram queue_wait;
+
+        // The execution time of the tasks.
+        latency_histogram run_time;
+
+        // The number of calls to schedule that had to wait for room in a
+        // full queue (see MAX_QUEUE).
+        std::uint64_t blocked_schedules = 0;
+
+        // The number of calls to try_schedule that failed because the
+        // queue was full.
+        std::uint64_t rejected_schedules = 0;
+
+        // The number of times that the mutex of the pool was held by
+        // another thread when a thread tried to acquire it to schedule or
+        // take a task.
+        std::uint64_t contended_locks = 0;
+
+        // The number of tasks discarded without running because they were
+        // cancelled (see task_options::stop) or the pool was shut down
+        // with shutdown_now.
+        std::uint64_t discarded_tasks = 0;
+    };
+
+}  // namespace ra::concurrency
+
+#endif  // STATS_HPP
@@ -0,0 +1,145 @@
+#ifndef TASK_FUNCTION_HPP
+#define TASK_FUNCTION_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ra::concurrency {
+
+    // Move-only wrapper for a callable entity taking no arguments.
+    // Unlike std::function, the wrapped callable is only required to be
+    // movable (not copyable), and any callable whose size is at most
+    // inline_size bytes (and that can be moved without throwing) is
+    // stored inside the wrapper itself, so wrapping a typical lambda does
+    // not allocate any memory.
+    class task_function {
+        public:
+            // The size of the buffer used to store callables inline.
+            static constexpr std::size_t inline_size = 112;
+
+            // Creates an empty task function.
+            task_function() noexcept : vtable_(nullptr) {}
+
+            task_function(std::nullptr_t) noexcept : vtable_(nullptr) {}
+
+            // Creates a task function wrapping the callable entity f.
+            template <class F, class = std::enable_if_t<!std::is_same_v<std::decay_t<F>, task_function> &&
+                                                        std::is_invocable_v<std::decay_t<F>&>>>
+            task_function(F&& f) : vtable_(nullptr) {
+                using callable = std::decay_t<F>;
+                if constexpr (is_inline<callable>) {
+                    ::new (static_cast<void*>(storage_)) callable(std::forward<F>(f));
+                    vtable_ = &inline_vtable<callable>;
+                } else {
+                    ::new (static_cast<void*>(storage_)) callable*(new callable(std::forward<F>(f)));
+                    vtable_ = &heap_vtable<callable>;
+                }
+            }
+
+            // Moves the callable held by other (if any) into a new task
+            // function, leaving other empty.
+            task_function(task_function&& other) noexcept : vtable_(other.vtable_) {
+                if (vtable_) {
+                    vtable_->move(storage_, other.storage_);
+                    other.vtable_ = nullptr;
+                }
+            }
+
+            task_function& operator=(task_function&& other) noexcept {
+                if (this != &other) {
+                    reset();
+                    if (other.vtable_) {
+                        other.vtable_->move(storage_, other.storage_);
+                        vtable_ = other.vtable_;
+                        other.vtable_ = nullptr;
+                    }
+                }
+                return *this;
+            }
+
+            task_function& operator=(std::nullptr_t) noexcept {
+                reset();
+                return *this;
+            }
+
+            // A task function is not copyable.
+            task_function(const task_function&) = delete;
+            task_function& operator=(const task_function&) = delete;
+
+            ~task_function() {
+                reset();
+            }
+
+            // Invokes the wrapped callable.
+            // Precondition: The task function is not empty.
+            void operator()() {
+                vtable_->invoke(storage_);
+            }
+
+            // Returns if the task function wraps a callable.
+            explicit operator bool() const noexcept {
+                return vtable_ != nullptr;
+            }
+
+        private:
+            // The operations on the stored callable.
+            struct vtable {
+                void (*invoke)(void* storage);
+                void (*move)(void* dst, void* src) noexcept;
+                void (*destroy)(void* storage) noexcept;
+            };
+
+            // Whether a callable of type F is stored inline.
+            template <class F>
+            static constexpr bool is_inline = sizeof(F) <= inline_size &&
+                                              alignof(std::max_align_t) % alignof(F) == 0 &&
+                                              std::is_nothrow_move_constructible_v<F>;
+
+            template <class F>
+            static F* inline_target(void* storage) noexcept {
+                return std::launder(reinterpret_cast<F*>(storage));
+            }
+
+            template <class F>
+            static F*& heap_target(void* storage) noexcept {
+                return *std::launder(reinterpret_cast<F**>(storage));
+            }
+
+            template <class F>
+            static constexpr vtable inline_vtable = {
+                [](void* storage) { (*inline_target<F>(storage))(); },
+                [](void* dst, void* src) noexcept {
+                    F* from = inline_target<F>(src);
+                    ::new (dst) F(std::move(*from));
+                    from->~F();
+                },
+                [](void* storage) noexcept { inline_target<F>(storage)->~F(); },
+            };
+
+            template <class F>
+            static constexpr vtable heap_vtable = {
+                [](void* storage) { (*heap_target<F>(storage))(); },
+                [](void* dst, void* src) noexcept { ::new (dst) F*(heap_target<F>(src)); },
+                [](void* storage) noexcept { delete heap_target<F>(storage); },
+            };
+
+            // Destroys the wrapped callable (if any).
+            void reset() noexcept {
+                if (vtable_) {
+                    vtable_->destroy(storage_);
+                    vtable_ = nullptr;
+                }
+            }
+
+            // The storage for the callable (or for a pointer to it).
+            alignas(std::max_align_t) unsigned char storage_[inline_size];
+
+            // The operations on the stored callable, or nullptr if empty.
+            const vtable* vtable_;
+    };
+
+}  // namespace ra::concurrency
+
+#endif  // TASK_FUNCTION_HPP
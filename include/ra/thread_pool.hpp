@@ -1,22 +1,191 @@
 #ifndef THREAD_POOL_HPP
 #define THREAD_POOL_HPP
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <iosfwd>
+#include <memory>
 #include <mutex>
+#include <ra/future.hpp>
+#include <ra/numa.hpp>
 #include <ra/queue.hpp>
+#include <ra/spin_wait.hpp>
+#include <ra/stats.hpp>
+#include <ra/task_function.hpp>
+#include <stop_token>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 #define MAX_QUEUE 36  // Maximum number of elements in the queue, at least 32.
 
 namespace ra::concurrency {
 
+    namespace detail {
+        // A task queued on a thread pool (see thread_pool.cpp).
+        struct queued_task;
+    }  // namespace detail
+
+    // How the threads of a thread pool are placed on the CPUs.
+    enum class thread_placement {
+        none,        // the threads may run on any CPU
+        cores,       // thread i is pinned to the i-th available CPU (cyclically)
+        numa_nodes,  // the threads are split evenly between the NUMA nodes,
+                     // each pinned to the CPUs of its node
+    };
+
+    // The priority of a task scheduled on a thread pool.
+    enum class task_priority {
+        low,     // background work
+        normal,  // the priority of tasks scheduled without options
+        high,    // interactive work
+    };
+
+    // Scheduling options for a task.
+    struct task_options {
+        // A node value for tasks that may run on the threads of any node.
+        static constexpr std::size_t any_node = static_cast<std::size_t>(-1);
+
+        // The priority of the task.
+        task_priority priority = task_priority::normal;
+
+        // The time by which the task should start, or time_point::max()
+        // for none. A task whose deadline comes before the time at which
+        // its priority alone would make it the most urgent one is ordered
+        // by its deadline instead (see thread_pool_options::aging_interval).
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+        // The NUMA node whose threads should preferably execute the task
+        // (see thread_pool::schedule), or any_node.
+        std::size_t node = any_node;
+
+        // A token that cancels the task. If a stop is requested before the
+        // task starts, the task is discarded without running: its callable
+        // is destroyed (so a future obtained with submit holds a
+        // std::future_error, and a task of a task group counts as
+        // finished). A task that is already running is not interrupted,
+        // but may poll the token itself.
+        std::stop_token stop;
+    };
+
+    // Construction options for a thread pool.
+    struct thread_pool_options {
+        // The number of threads in the thread pool, or zero to use the
+        // hardware concurrency level (if known; otherwise 2).
+        std::size_t num_threads = 0;
+
+        // The maximum number of threads, or zero for num_threads.
+        // If max_threads is greater than num_threads, the pool is elastic:
+        // it starts num_threads threads, and starts another one (up to
+        // max_threads) whenever a task is queued (or a schedule call would
+        // block on a full queue) while no thread is idle. The threads
+        // beyond num_threads exit after idle_timeout without work.
+        std::size_t max_threads = 0;
+
+        // The time after which an idle thread beyond the minimum number of
+        // threads exits (see max_threads and max_compensation_threads).
+        std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(10);
+
+        // The maximum number of compensation threads. While tasks are
+        // blocked inside a blocking_region, the pool starts threads in
+        // their place as if they had exited, beyond max_threads if
+        // necessary (but by at most max_compensation_threads), so that
+        // the other tasks keep running.
+        std::size_t max_compensation_threads = 16;
+
+        // Whether each thread keeps its own deque of tasks.
+        // In work-stealing mode, tasks scheduled from inside a thread of
+        // the pool are pushed onto (and later popped from) the bottom of
+        // that thread's deque without taking any lock. Tasks scheduled
+        // from outside the pool go through the shared (injection) queue.
+        // A thread that runs out of work first takes tasks from the
+        // shared queue and then steals from the top of the deques of the
+        // other threads, starting at a random victim.
+        // In both modes, a thread takes a fair share of the queued tasks
+        // at once and keeps the rest of the batch on its deque, from where
+        // idle threads (and threads waiting for a task group) can steal it.
+        bool work_stealing = false;
+
+        // The placement of the threads on the CPUs.
+        // With thread_placement::numa_nodes, the pool also keeps a shared
+        // queue of tasks per node. A thread takes tasks from the queue of
+        // its own node first, and only when that queue is empty from the
+        // queues of the other nodes.
+        thread_placement placement = thread_placement::none;
+
+        // If not empty, thread i is pinned to the CPUs in
+        // cpu_sets[i % cpu_sets.size()], regardless of placement.
+        std::vector<std::vector<int>> cpu_sets;
+
+        // The NUMA topology used with thread_placement::numa_nodes, or
+        // nullptr for numa_topology::system(). The topology must outlive
+        // the construction of the pool.
+        const numa_topology* topology = nullptr;
+
+        // The time after which a queued task counts as urgent as a newly
+        // scheduled task of the next higher priority.
+        // Each queued task is ranked by the time at which it was scheduled
+        // plus aging_interval for each level that its priority is below
+        // task_priority::high (or by its deadline, if that is earlier),
+        // and the threads always take the task of lowest rank first.
+        // So higher-priority tasks overtake lower-priority ones, but a
+        // task of any priority eventually runs, however many more urgent
+        // tasks keep arriving.
+        std::chrono::steady_clock::duration aging_interval = std::chrono::milliseconds(10);
+
+        // How an idle thread waits for tasks. By default, it blocks right
+        // away; with wait_strategy::spin_then_park, it first spins and
+        // yields (with a budget adapted per thread), which lowers the
+        // latency of tasks scheduled shortly after the thread ran out of
+        // work but keeps its CPU busy in the meantime.
+        wait_strategy wait;
+
+        // The interval at which the statistics of the pool are reported
+        // (see thread_pool::stats), or zero for never.
+        // The statistics are reported by a thread of their own, and only
+        // if RA_STATS is 1.
+        std::chrono::steady_clock::duration stats_interval = std::chrono::steady_clock::duration::zero();
+
+        // The function that the statistics are reported to, or an empty
+        // function to print them to std::clog.
+        std::function<void(const thread_pool_stats&)> stats_report;
+    };
+
     // Thread pool class.
     class thread_pool {
         public:
             // An unsigned integral type used to represent sizes.
             using size_type = std::size_t;
 
+            // The awaiter of schedule_on (see below).
+            class schedule_awaiter {
+                public:
+                    bool await_ready() const noexcept {
+                        return false;
+                    }
+
+                    void await_suspend(std::coroutine_handle<> handle) {
+                        pool_.schedule(detail::coroutine_resumer(handle), options_);
+                    }
+
+                    void await_resume() const noexcept {}
+
+                private:
+                    friend class thread_pool;
+
+                    schedule_awaiter(thread_pool& pool, const task_options& options)
+                        : pool_(pool), options_(options) {}
+
+                    thread_pool& pool_;
+                    task_options options_;
+            };
+
             // Creates a thread pool with the number of threads equal to the
             // hardware concurrency level (if known); otherwise the number of
             // threads is set to 2.
@@ -26,6 +195,9 @@ namespace ra::concurrency {
             // Precondition: num_threads > 0
             thread_pool(std::size_t num_threads);
 
+            // Creates a thread pool configured by options.
+            thread_pool(const thread_pool_options& options);
+
             // A thread pool is not copyable or movable.
             thread_pool(const thread_pool&) = delete;
             thread_pool& operator=(const thread_pool&) = delete;
@@ -36,16 +208,30 @@ namespace ra::concurrency {
             // (if not already shutdown).
             ~thread_pool();
 
-            // Gets the number of threads in the thread pool.
+            // Gets the number of threads in the thread pool (for an elastic
+            // pool, the maximum number, see thread_pool_options::max_threads),
+            // i.e., the number of tasks that it can execute at once.
             // This function is not thread safe.
             size_type size() const;
 
+            // Gets the number of threads currently running in the thread
+            // pool (including compensation threads).
+            // This function is thread safe.
+            size_type active_threads() const;
+
             // Enqueues a task for execution by the thread pool.
             // This function inserts the task specified by the callable
             // entity func into the queue of tasks associated with the
             // thread pool.
+            // The task must not exit with an exception (use submit for
+            // tasks that may throw).
             // This function may block if the number of currently
-            // queued tasks is sufficiently large.
+            // queued tasks is sufficiently large (except when called from
+            // a thread of the pool, which executes queued tasks instead
+            // of blocking).
+            // In work-stealing mode, a task scheduled from inside a thread
+            // of the pool is instead pushed onto that thread's own deque,
+            // which never blocks.
             // Note: The rvalue reference parameter is intentional and
             // implies that the schedule function is permitted to change
             // the value of func (e.g., by moving from func).
@@ -53,7 +239,78 @@ namespace ra::concurrency {
             // and is not currently in the process of being shutdown via
             // the shutdown member function.
             // This function is thread safe.
-            void schedule(std::function<void()>&& func);
+            void schedule(task_function&& func);
+
+            // Enqueues a task as above, preferably for execution by the
+            // threads of the given NUMA node (taken modulo num_nodes()).
+            // The task goes onto the queue of that node, so it only runs on
+            // a thread of another node if that thread has nothing else to
+            // do.
+            // Precondition: Same as for schedule.
+            // This function is thread safe.
+            void schedule(task_function&& func, size_type node);
+
+            // Enqueues a task as above, with the priority, deadline and
+            // NUMA node given by options.
+            // The threads of the pool always take the most urgent of the
+            // queued tasks first (see thread_pool_options::aging_interval);
+            // tasks of the same priority without deadlines run in the
+            // order in which they were scheduled.
+            // In work-stealing mode, only tasks of normal priority without
+            // a deadline go onto the local deque of the calling thread, and
+            // the threads take urgent tasks (of high priority or with a
+            // deadline) from the queues before their local tasks.
+            // Precondition: Same as for schedule.
+            // This function is thread safe.
+            void schedule(task_function&& func, const task_options& options);
+
+            // Enqueues a task for execution by the thread pool if this can
+            // be done without blocking.
+            // The function returns true if the task is enqueued, and false
+            // if the queue of tasks already holds MAX_QUEUE tasks or the
+            // thread pool is shutdown (or is being shutdown).
+            // The task func is only moved from if it is enqueued, so that
+            // the caller can, for instance, run it inline instead.
+            // In work-stealing mode, a task scheduled from inside a thread
+            // of the pool is always enqueued (on that thread's deque).
+            // This function is thread safe.
+            bool try_schedule(task_function&& func);
+
+            // Enqueues the invocation of f with the arguments args for
+            // execution by the thread pool, and returns a future for the
+            // result of the invocation.
+            // The callable entity f and the arguments args are decay-copied
+            // (or moved) into the task. For a typical lambda, the task is
+            // stored inline (see task_function), and the state shared with
+            // the future is recycled (see detail::state_cache), so that a
+            // thread submitting tasks does not allocate memory in the
+            // steady state.
+            // If the invocation exits with an exception, the exception is
+            // stored in the future and rethrown by its get member function.
+            // If the task is discarded without being executed (e.g., if the
+            // thread pool is shutdown), the future holds a std::future_error.
+            // This function may block in the same way as schedule.
+            // Precondition: Same as for schedule.
+            // This function is thread safe.
+            template <class F, class... Args>
+            auto submit(F&& f, Args&&... args)
+                -> future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>;
+
+            // Returns an awaiter that moves a coroutine onto the thread
+            // pool: co_await pool.schedule_on() suspends the coroutine and
+            // schedules a task (with the given options) that resumes it on
+            // a thread of the pool, so that the calling thread is free to
+            // do other work in the meantime.
+            // If the task is discarded without running (e.g., by
+            // shutdown_now or through options.stop), the coroutine is
+            // destroyed instead of resumed (see ra::concurrency::task).
+            // This function may block in the same way as schedule (when the
+            // awaiter is awaited).
+            // Precondition: Same as for schedule.
+            // This function is thread safe.
+            schedule_awaiter schedule_on(const task_options& options = task_options()) {
+                return schedule_awaiter(*this, options);
+            }
 
             // Shuts down the thread pool.
             // This function places the thread pool into a state where
@@ -69,26 +326,212 @@ namespace ra::concurrency {
             // This function is thread safe.
             void shutdown();
 
+            // Shuts down the thread pool as shutdown does, but discards the
+            // tasks that have not started yet instead of executing them
+            // (as if they were cancelled, see task_options::stop), so that
+            // the threads are freed as soon as the running tasks finish.
+            // Tasks scheduled while the pool is being shut down are
+            // discarded as well.
+            // This function is thread safe.
+            void shutdown_now();
+
+            // Returns the number of NUMA nodes that the threads are grouped
+            // by (1 unless the placement is thread_placement::numa_nodes).
+            // This function is thread safe.
+            size_type num_nodes() const;
+
+            // Returns the NUMA node of the thread with the given index.
+            // Precondition: index < size()
+            // This function is thread safe.
+            size_type node_of_thread(size_type index) const;
+
+            // Returns the NUMA node of the calling thread if it belongs to
+            // the thread pool, and num_nodes() otherwise.
+            // This function is thread safe.
+            size_type current_node() const;
+
             // Tests if the thread pool has been shutdown.
             // This function is not thread safe.
             bool is_shutdown() const;
 
+            // Blocks until all of the tasks scheduled so far (and any tasks
+            // scheduled by them) have been executed, without shutting down
+            // the thread pool.
+            // While there are queued tasks, the calling thread helps to
+            // execute them instead of sleeping.
+            // Precondition: This function is not called from a task executed
+            // by the thread pool (since that task would wait for itself).
+            // This function is thread safe.
+            void wait_idle();
+
+            // Executes one queued task (if any) in the calling thread.
+            // Returns true if a task was executed, and false if no task was
+            // queued.
+            // This function is thread safe.
+            bool run_pending_task();
+
+            // Returns a snapshot of the statistics of the thread pool, which
+            // are all zero unless RA_STATS is 1 (see ra/stats.hpp).
+            // The counters of each thread are read one at a time while the
+            // threads keep running, so the snapshot is only approximately
+            // consistent.
+            // This function is thread safe.
+            thread_pool_stats stats() const;
+
         private:
+            friend class blocking_region;
+
+            // The per-thread state of the thread pool.
+            struct worker;
+
+            // A queue of tasks ordered by urgency.
+            struct task_queue;
+
+            // The statistics counters of a thread.
+            struct stats_counters;
+
+            // Starts the threads of the thread pool, placed as specified by
+            // options.
+            void start(const thread_pool_options& options);
+
+            // Acquires the mutex, counting the acquisitions that have to
+            // wait for another thread.
+            std::unique_lock<std::mutex> lock_mutex();
+
+#if RA_STATS
+            // Returns the statistics counters of the calling thread.
+            stats_counters& local_stats();
+#endif
+
+            // Executes task in the calling thread and marks it as finished.
+            void run_task(detail::queued_task& task);
+
+            // Enqueues func with the given options on the queue with the
+            // given index, blocking while that queue is full.
+            void enqueue(size_type queue, task_function&& func, const task_options& options);
+
+            // Returns the index of the queue that a task for the given node
+            // (or task_options::any_node) goes onto.
+            size_type queue_for(size_type node);
+
+            // Takes the most urgent task from the queues, looking first at
+            // the queue of node, and wakes up a blocked scheduler.
+            // Returns false if all queues are empty.
+            // The mutex must be held.
+            bool pop_queued(size_type node, detail::queued_task& task);
+
+            // Returns the index of the first nonempty queue, looking first at
+            // the queue of node, or num_nodes() if all queues are empty.
+            // The mutex must be held.
+            size_type nonempty_queue(size_type node) const;
+
+            // Wakes up threads blocked in schedule after count tasks were
+            // removed from the queues. The mutex must be held.
+            void notify_schedulers(size_type count);
+
+            // Starts a thread in a free slot (if any).
+            // The mutex must be held.
+            void spawn_thread();
+
+            // Starts a thread if tasks are queued but no thread is idle, and
+            // the number of threads permits it. The mutex must be held.
+            void grow_if_needed();
+
+            // Marks the calling thread of the pool as blocked (or no longer
+            // blocked) in a blocking_region.
+            void enter_blocking();
+            void leave_blocking();
+
+            // The main loop of the thread with the given index.
+            void worker_loop(size_type index);
+
+            // Obtains the next task to be executed by the thread with the
+            // given index, blocking if necessary.
+            // Returns false if the thread pool has been shutdown.
+            bool next_task(size_type index, detail::queued_task& task);
+
+            // Tries to take a task from the local deque of the thread with
+            // the given index or to steal one from another thread.
+            bool try_steal(size_type index, detail::queued_task& task);
+
+            // Tries to steal a task from the deque of any thread other than
+            // the one with index self, starting at a random victim chosen
+            // with seed.
+            bool steal(size_type self, std::uint64_t& seed, detail::queued_task& task);
+
+            // Returns if any thread has a task in its local deque.
+            bool has_stealable_task() const;
+
+            // Wakes up an idle thread (if any) after a task has been pushed
+            // onto a local deque.
+            void wake_idle_thread();
+
+            // Marks a task as finished.
+            void finish_task();
+
             // Size of the thread pool.
             size_type num_threads_;
 
+            // The number of threads that keep running when idle.
+            size_type min_threads_;
+
+            // The time after which idle threads beyond min_threads_ exit.
+            std::chrono::steady_clock::duration idle_timeout_;
+
+            // The number of threads running (protected by the mutex, but
+            // readable at any time).
+            std::atomic<size_type> active_threads_;
+
+            // The number of threads blocked in a blocking_region.
+            size_type blocked_threads_;
+
+            // The number of slots of workers_ that have been used so far.
+            std::atomic<size_type> used_slots_;
+
             // Number of threads are idle.
-            size_type idle_threads_;
+            std::atomic<size_type> idle_threads_;
+
+            // Number of threads spinning while waiting for tasks.
+            std::atomic<size_type> spinning_threads_;
+
+            // Number of tasks that have been scheduled but have not
+            // finished executing yet.
+            std::atomic<size_type> pending_;
+
+            // Whether the thread pool is in work-stealing mode.
+            bool work_stealing_;
+
+            // The per-thread state, one entry per slot. There is a slot for
+            // each thread that may run at once (including compensation
+            // threads), and a slot is reused by the next thread started
+            // after its thread exits.
+            std::vector<std::unique_ptr<worker>> workers_;
 
-            // A queue of tasks.
-            queue<std::function<void()>> tasks_;
+            // The queues of tasks, one per NUMA node.
+            std::vector<std::unique_ptr<task_queue>> queues_;
 
-            // A vector of threads.
+            // The queue that the next task scheduled from outside the pool
+            // without a node goes onto.
+            std::atomic<size_type> next_queue_;
+
+            // The number of queued tasks of high priority or with a
+            // deadline (which take precedence over the local deques).
+            std::atomic<size_type> urgent_;
+
+            // The number of tasks in the queues, readable without the mutex
+            // by spinning threads.
+            std::atomic<size_type> queued_;
+
+            // A vector of threads (one per slot of workers_).
             std::vector<std::thread> threads_;
 
             // A flag indicating whether the thread pool has been shutdown.
             bool shutdown_;
 
+            // Whether the tasks that have not started are discarded (see
+            // shutdown_now).
+            std::atomic<bool> discarding_;
+
             // A mutex used to protect critical sections.
             mutable std::mutex mutex_;
 
@@ -100,7 +543,190 @@ namespace ra::concurrency {
 
             // A condition variable used to signal shutdown of the thread pool.
             mutable std::condition_variable condition_shutdown_;
+#if RA_STATS
+
+            // The statistics counters of the threads outside the pool.
+            std::unique_ptr<stats_counters> outside_stats_;
+
+            // The thread that reports the statistics periodically (if any).
+            std::thread stats_thread_;
+#endif
+    };
+
+    // Prints the statistics s of a thread pool in a human-readable form.
+    std::ostream& operator<<(std::ostream& out, const thread_pool_stats& s);
+
+    // Blocking region class.
+    // A blocking region marks the part of a task that may block for a long
+    // time without using its CPU (e.g., waiting for I/O). While the region
+    // is active, the thread does not count towards the number of threads
+    // of the pool, which may thus start a compensation thread to execute
+    // the queued tasks (see thread_pool_options::max_compensation_threads).
+    // Once the region ends, the pool may temporarily run more threads than
+    // usual; the extra threads exit after the idle timeout.
+    // A blocking region has no effect if it is not created by a thread of
+    // the pool.
+    class blocking_region {
+        public:
+            // Enters a blocking region of the calling thread in pool.
+            explicit blocking_region(thread_pool& pool);
+
+            // A blocking region is not copyable or movable.
+            blocking_region(const blocking_region&) = delete;
+            blocking_region& operator=(const blocking_region&) = delete;
+            blocking_region(blocking_region&&) = delete;
+            blocking_region& operator=(blocking_region&&) = delete;
+
+            // Leaves the blocking region.
+            ~blocking_region();
+
+        private:
+            // The thread pool, or nullptr if the region has no effect.
+            thread_pool* pool_;
+    };
+
+    // Task group class.
+    // A task group tracks a set of tasks scheduled on a thread pool, so
+    // that a thread can wait for exactly those tasks to finish while the
+    // thread pool keeps running.
+    // A task group can also be cancelled, e.g., when the work of its tasks
+    // has become stale, so that its tasks that have not started yet are
+    // discarded.
+    class task_group {
+        public:
+            // An unsigned integral type used to represent sizes.
+            using size_type = std::size_t;
+
+            // Creates an empty task group whose tasks run on pool.
+            explicit task_group(thread_pool& pool);
+
+            // A task group is not copyable or movable.
+            task_group(const task_group&) = delete;
+            task_group& operator=(const task_group&) = delete;
+            task_group(task_group&&) = delete;
+            task_group& operator=(task_group&&) = delete;
+
+            // Destroys the task group after waiting for its tasks to finish.
+            // Any exception thrown by a task and not yet rethrown by wait is
+            // discarded.
+            ~task_group();
+
+            // Schedules the task func on the thread pool as part of the
+            // task group.
+            // Unlike with thread_pool::schedule, the task may exit with an
+            // exception, which is then rethrown by wait.
+            // This function may block in the same way as
+            // thread_pool::schedule.
+            // This function is thread safe.
+            void run(task_function&& func);
+
+            // Schedules the task func as above, preferably on the threads
+            // of the given NUMA node (see thread_pool::schedule).
+            // This function is thread safe.
+            void run(task_function&& func, size_type node);
+
+            // Schedules the task func as above, with the priority, deadline
+            // and NUMA node given by options (see thread_pool::schedule).
+            // This function is thread safe.
+            void run(task_function&& func, const task_options& options);
+
+            // Blocks until all tasks of the group have finished.
+            // While tasks are queued on the thread pool, the calling thread
+            // helps to execute them instead of sleeping, so this function
+            // may also be called from inside a task of the same pool.
+            // If any task of the group exited with an exception, the first
+            // such exception is rethrown (after all tasks have finished).
+            // The task group can be reused after this function returns.
+            // This function is thread safe.
+            void wait();
+
+            // Returns the thread pool that the tasks of the group run on.
+            thread_pool& pool() const;
+
+            // Cancels the task group: the tasks of the group that have not
+            // started yet (and any tasks run on the group later) are
+            // discarded without running, and the running tasks can find
+            // out through is_cancelled or get_stop_token that they should
+            // stop early. A cancelled group stays cancelled.
+            // This function is thread safe.
+            void cancel();
+
+            // Tests if the task group has been cancelled.
+            // This function is thread safe.
+            bool is_cancelled() const;
+
+            // Returns a token that is stopped when the task group is
+            // cancelled, e.g., to pass on to long computations.
+            // This function is thread safe.
+            std::stop_token get_stop_token() const;
+
+        private:
+            // Wraps func so that it counts as a task of the group.
+            task_function wrap(task_function&& func);
+
+            // Marks a task of the group as finished.
+            void finish_task();
+
+            // Records the exception e (if it is the first one).
+            void set_exception(std::exception_ptr e);
+
+            // The thread pool that the tasks run on.
+            thread_pool& pool_;
+
+            // The number of tasks of the group that have not finished yet.
+            std::atomic<size_type> pending_;
+
+            // The first exception thrown by a task (if any).
+            std::exception_ptr exception_;
+
+            // The source of the cancellation of the group.
+            std::stop_source stop_source_;
+
+            // The mutex used to protect exception_ and the completion of
+            // the last task.
+            std::mutex mutex_;
+
+            // A condition variable used to signal that all tasks finished.
+            std::condition_variable condition_;
     };
+
+    // Zeroes the n bytes at data, such that each of their pages is first
+    // touched by a thread of the thread pool: the bytes are split into
+    // pool.num_nodes() consecutive parts, and part k is written by the
+    // threads of NUMA node k. Under the default (first-touch) memory
+    // policy of Linux, each page is thus placed on the node whose threads
+    // write it first. Whole pages that were already touched (e.g., by the
+    // constructor of a boost::multi_array) are released first, so that
+    // they are placed anew.
+    // This matches how compute_julia_set assigns the rows of an image to
+    // the nodes of the pool.
+    // This function may also be called from inside a task of pool.
+    void first_touch(thread_pool& pool, void* data, std::size_t n);
+
+    template <class F, class... Args>
+    auto thread_pool::submit(F&& f, Args&&... args)
+        -> future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> {
+        using result_type = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+
+        auto* state = detail::shared_state<result_type>::make();
+        future<result_type> result(state);
+
+        schedule([p = detail::promise<result_type>(state), func = std::forward<F>(f),
+                  bound = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            try {
+                if constexpr (std::is_void_v<result_type>) {
+                    std::apply(func, std::move(bound));
+                    p.set_value();
+                } else {
+                    p.set_value(std::apply(func, std::move(bound)));
+                }
+            } catch (...) {
+                p.set_exception(std::current_exception());
+            }
+        });
+
+        return result;
+    }
 }  // namespace ra::concurrency
 
 #endif  // THREAD_POOL_HPP
\ No newline at end of file
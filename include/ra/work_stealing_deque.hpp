@@ -0,0 +1,166 @@
+#ifndef WORK_STEALING_DEQUE_HPP
+#define WORK_STEALING_DEQUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace ra::concurrency {
+
+    // Lock-free work-stealing deque class (Chase-Lev).
+    // The deque holds pointers to elements of type T. A single thread (the
+    // owner) pushes and pops elements at the bottom of the deque in LIFO
+    // order, while any number of other threads (thieves) may concurrently
+    // steal elements from the top of the deque in FIFO order.
+    // The deque grows as needed, so push never fails.
+    template <class T>
+    class work_stealing_deque {
+        public:
+            // The type of each of the elements stored in the deque.
+            using value_type = T*;
+
+            // An unsigned integral type used to represent sizes.
+            using size_type = std::size_t;
+
+            // Constructs an empty deque with room for at least capacity
+            // elements before it needs to grow.
+            // Precondition: The quantity capacity must be a power of two.
+            work_stealing_deque(size_type capacity = 256) : top_(0), bottom_(0) {
+                arrays_.push_back(std::make_unique<array>(capacity));
+                array_.store(arrays_.back().get(), std::memory_order_relaxed);
+            }
+
+            // A deque is not movable or copyable.
+            work_stealing_deque(const work_stealing_deque&) = delete;
+            work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+            work_stealing_deque(work_stealing_deque&&) = delete;
+            work_stealing_deque& operator=(work_stealing_deque&&) = delete;
+
+            // Inserts x at the bottom of the deque.
+            // This function may only be called by the owner thread.
+            void push(value_type x) {
+                std::int64_t b = bottom_.load(std::memory_order_relaxed);
+                std::int64_t t = top_.load(std::memory_order_acquire);
+                array* a = array_.load(std::memory_order_relaxed);
+                if (b - t > static_cast<std::int64_t>(a->capacity) - 1) {
+                    a = grow(a, t, b);
+                }
+                a->put(b, x);
+                bottom_.store(b + 1, std::memory_order_release);
+            }
+
+            // Removes and returns the element at the bottom of the deque
+            // (i.e., the most recently pushed element).
+            // Returns nullptr if the deque is empty.
+            // This function may only be called by the owner thread.
+            value_type pop() {
+                std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+                array* a = array_.load(std::memory_order_relaxed);
+                bottom_.store(b, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                std::int64_t t = top_.load(std::memory_order_relaxed);
+
+                if (t > b) {
+                    // The deque was empty.
+                    bottom_.store(b + 1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+
+                value_type x = a->get(b);
+                if (t == b) {
+                    // This is the last element, so race against the thieves
+                    // for it.
+                    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                      std::memory_order_relaxed)) {
+                        x = nullptr;
+                    }
+                    bottom_.store(b + 1, std::memory_order_relaxed);
+                }
+                return x;
+            }
+
+            // Removes and returns the element at the top of the deque
+            // (i.e., the least recently pushed element).
+            // Returns nullptr if the deque is empty or if the element was
+            // taken by another thread first.
+            // This function is thread safe.
+            value_type steal() {
+                std::int64_t t = top_.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                std::int64_t b = bottom_.load(std::memory_order_acquire);
+
+                if (t >= b) {
+                    return nullptr;
+                }
+
+                array* a = array_.load(std::memory_order_acquire);
+                value_type x = a->get(t);
+                if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                  std::memory_order_relaxed)) {
+                    return nullptr;
+                }
+                return x;
+            }
+
+            // Returns if the deque is currently empty.
+            // This function is not thread safe.
+            bool is_empty() const {
+                return bottom_.load(std::memory_order_seq_cst) <= top_.load(std::memory_order_seq_cst);
+            }
+
+        private:
+            // A circular array of element pointers.
+            struct array {
+                array(size_type capacity)
+                    : capacity(capacity), mask(capacity - 1), buffer(new std::atomic<value_type>[capacity]) {}
+
+                value_type get(std::int64_t i) const {
+                    return buffer[i & mask].load(std::memory_order_relaxed);
+                }
+
+                void put(std::int64_t i, value_type x) {
+                    buffer[i & mask].store(x, std::memory_order_relaxed);
+                }
+
+                const size_type capacity;
+                const size_type mask;
+                std::unique_ptr<std::atomic<value_type>[]> buffer;
+            };
+
+            // Replaces the array a by an array of twice the size holding
+            // the elements in positions [t, b).
+            // The old array is kept alive until the deque is destroyed,
+            // since thieves may still be reading from it.
+            array* grow(array* a, std::int64_t t, std::int64_t b) {
+                arrays_.push_back(std::make_unique<array>(2 * a->capacity));
+                array* bigger = arrays_.back().get();
+                for (std::int64_t i = t; i < b; ++i) {
+                    bigger->put(i, a->get(i));
+                }
+                array_.store(bigger, std::memory_order_release);
+                return bigger;
+            }
+
+            // The assumed size of a cache line, used to keep the positions
+            // touched by the owner and by the thieves apart.
+            static constexpr size_type cache_line_size = 64;
+
+            // The position of the next element to be stolen.
+            alignas(cache_line_size) std::atomic<std::int64_t> top_;
+
+            // The position of the next element to be pushed.
+            alignas(cache_line_size) std::atomic<std::int64_t> bottom_;
+
+            // The current array.
+            std::atomic<array*> array_;
+
+            // All of the arrays ever used by the deque (owned by the owner
+            // thread).
+            std::vector<std::unique_ptr<array>> arrays_;
+    };
+
+}  // namespace ra::concurrency
+
+#endif  // WORK_STEALING_DEQUE_HPP
@@ -0,0 +1,142 @@
+#include <ra/numa.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace ra::concurrency {
+
+    numa_topology::numa_topology(std::vector<std::vector<int>> node_cpus) {
+        for (auto& cpus : node_cpus) {
+            if (!cpus.empty()) {
+                std::sort(cpus.begin(), cpus.end());
+                node_cpus_.push_back(std::move(cpus));
+            }
+        }
+        if (node_cpus_.empty()) {
+            node_cpus_.push_back(available_cpus());
+        }
+    }
+
+    const numa_topology& numa_topology::system() {
+        static const numa_topology topology = []() {
+            std::vector<int> allowed = available_cpus();
+            std::vector<std::pair<int, std::vector<int>>> nodes;
+
+            std::error_code error;
+            for (const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+                std::string name = entry.path().filename().string();
+                if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+                    !std::all_of(name.begin() + 4, name.end(), [](char ch) { return ch >= '0' && ch <= '9'; })) {
+                    continue;
+                }
+                std::ifstream in(entry.path() / "cpulist");
+                std::string list;
+                std::getline(in, list);
+
+                std::vector<int> cpus;
+                for (int cpu : parse_cpu_list(list)) {
+                    if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+                        cpus.push_back(cpu);
+                    }
+                }
+                nodes.emplace_back(std::stoi(name.substr(4)), std::move(cpus));
+            }
+
+            // Number the nodes in the order of their system numbers.
+            std::sort(nodes.begin(), nodes.end());
+            std::vector<std::vector<int>> node_cpus;
+            for (auto& node : nodes) {
+                node_cpus.push_back(std::move(node.second));
+            }
+            return numa_topology(std::move(node_cpus));
+        }();
+        return topology;
+    }
+
+    numa_topology::size_type numa_topology::num_nodes() const {
+        return node_cpus_.size();
+    }
+
+    const std::vector<int>& numa_topology::cpus(size_type node) const {
+        return node_cpus_[node];
+    }
+
+    numa_topology::size_type numa_topology::node_of_cpu(int cpu) const {
+        for (size_type node = 0; node < node_cpus_.size(); ++node) {
+            if (std::binary_search(node_cpus_[node].begin(), node_cpus_[node].end(), cpu)) {
+                return node;
+            }
+        }
+        return node_cpus_.size();
+    }
+
+    std::vector<int> available_cpus() {
+        std::vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+#endif
+        if (cpus.empty()) {
+            int n = std::max(1u, std::thread::hardware_concurrency());
+            for (int cpu = 0; cpu < n; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    std::vector<int> parse_cpu_list(const std::string& list) {
+        std::vector<int> cpus;
+        std::istringstream in(list);
+        std::string range;
+        while (std::getline(in, range, ',')) {
+            int first = 0;
+            int last = 0;
+            char dash = 0;
+            std::istringstream range_in(range);
+            if (!(range_in >> first)) {
+                continue;
+            }
+            last = first;
+            if (range_in >> dash && (dash != '-' || !(range_in >> last))) {
+                continue;
+            }
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    bool set_thread_affinity(const std::vector<int>& cpus) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            if (cpu < 0 || cpu >= CPU_SETSIZE) {
+                return false;
+            }
+            CPU_SET(cpu, &set);
+        }
+        return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void) cpus;
+        return false;
+#endif
+    }
+
+}  // namespace ra::concurrency
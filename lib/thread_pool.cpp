@@ -1,75 +1,316 @@
 #include <ra/thread_pool.hpp>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <ra/work_stealing_deque.hpp>
 
-namespace ra::concurrency {
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
-    thread_pool::thread_pool() : threads_(), tasks_(MAX_QUEUE), idle_threads_(0), shutdown_(false) {
-        num_threads_ = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 2;
+namespace ra::concurrency {
 
-        for (size_type i = 0; i < num_threads_; ++i) {
-            threads_.emplace_back([this]() {
-                while (true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(mutex_);
+    namespace detail {
+        // A task, the token that cancels it, and the time at which it was
+        // scheduled (only with statistics).
+        struct queued_task {
+            task_function func;
+            std::stop_token stop;
+#if RA_STATS
+            std::chrono::steady_clock::time_point scheduled;
+#endif
+        };
+    }  // namespace detail
 
-                        ++idle_threads_;
+    namespace {
+        using detail::queued_task;
+        // The thread pool that the calling thread belongs to (if any),
+        // and the index of the calling thread in that pool.
+        thread_local const thread_pool* current_pool = nullptr;
+        thread_local std::size_t current_index = 0;
 
-                        // To notify the shutdown function that the idle thread count has increased.
-                        if (tasks_.is_closed()) {
-                            condition_shutdown_.notify_one();
-                        }
+        // A per-thread cache of task nodes for the local deques, so that
+        // scheduling a task from inside a worker does not allocate in the
+        // steady state. A node is taken from the cache of the thread that
+        // schedules the task and is returned to the cache of the thread
+        // that executes it.
+        struct node_cache {
+            static constexpr std::size_t max_size = 1024;
 
-                        condition_pop_.wait(lock, [this]() {
-                            return !tasks_.is_empty() || shutdown_;
-                        });
+            ~node_cache() {
+                for (queued_task* node : nodes) {
+                    delete node;
+                }
+            }
 
-                        if (shutdown_) {
-                            return;
-                        }
+            queued_task* make(queued_task&& task) {
+                if (nodes.empty()) {
+                    return new queued_task(std::move(task));
+                }
+                queued_task* node = nodes.back();
+                nodes.pop_back();
+                *node = std::move(task);
+                return node;
+            }
 
-                        --idle_threads_;
+            queued_task* make(task_function&& func, std::stop_token stop = {}) {
+#if RA_STATS
+                return make(queued_task{std::move(func), std::move(stop), std::chrono::steady_clock::now()});
+#else
+                return make(queued_task{std::move(func), std::move(stop)});
+#endif
+            }
 
-                        tasks_.pop(task);
-                        condition_push_.notify_one();
-                    }
-                    task();
+            void recycle(queued_task* node) {
+                if (nodes.size() < max_size) {
+                    nodes.push_back(node);
+                } else {
+                    delete node;
                 }
-            });
+            }
+
+            std::vector<queued_task*> nodes;
+        };
+
+        thread_local node_cache nodes;
+
+#if RA_STATS
+        // Adds n to the counter c.
+        void add(std::atomic<std::uint64_t>& c, std::uint64_t n) {
+            c.fetch_add(n, std::memory_order_relaxed);
         }
-    }
+#endif
+    }  // namespace
+
+#if RA_STATS
+    // The counters are atomic, so that stats can read them at any time, but
+    // each set is only updated by its own thread (except for the set of the
+    // threads outside the pool) and lies on cache lines of its own.
+    struct alignas(64) thread_pool::stats_counters {
+        std::atomic<std::uint64_t> tasks_executed{0};
+        std::atomic<std::uint64_t> busy_ns{0};
+        std::atomic<std::uint64_t> idle_ns{0};
+        std::atomic<std::uint64_t> blocked_schedules{0};
+        std::atomic<std::uint64_t> rejected_schedules{0};
+        std::atomic<std::uint64_t> contended_locks{0};
+        std::atomic<std::uint64_t> discarded_tasks{0};
+        std::array<std::atomic<std::uint64_t>, latency_histogram::num_buckets> queue_wait{};
+        std::array<std::atomic<std::uint64_t>, latency_histogram::num_buckets> run_time{};
+    };
+#endif
+
+    struct alignas(64) thread_pool::worker {
+        explicit worker(const wait_strategy& wait) : spinner(wait) {}
+
+        // The local deque of tasks of the thread: the tasks it scheduled
+        // (work-stealing mode only) and the rest of the batches it took
+        // from the shared queue, which the other threads can steal.
+        work_stealing_deque<queued_task> tasks;
+
+        // The buffer that batches are taken from the shared queue into.
+        std::vector<queued_task> batch;
+
+        // The state of the random number generator used to pick victims.
+        std::uint64_t seed;
+
+        // The NUMA node of the thread (the index of its queue).
+        std::size_t node = 0;
+
+        // The CPUs that the thread is pinned to (empty if not pinned).
+        std::vector<int> cpus;
 
-    thread_pool::thread_pool(std::size_t num_threads) : threads_(), num_threads_(num_threads), tasks_(MAX_QUEUE), idle_threads_(0), shutdown_(false) {
-        for (size_type i = 0; i < num_threads_; ++i) {
-            threads_.emplace_back([this]() {
-                while (true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(mutex_);
+        // The spinning phase of the waits for tasks.
+        spin_waiter spinner;
 
-                        ++idle_threads_;
+        // Whether a thread is running in this slot (protected by the
+        // mutex).
+        bool active = false;
+#if RA_STATS
 
-                        // To notify the shutdown function that the idle thread count has increased.
-                        if (tasks_.is_closed()) {
-                            condition_shutdown_.notify_one();
-                        }
+        // The statistics counters of the thread.
+        stats_counters stats;
+#endif
+    };
 
-                        condition_pop_.wait(lock, [this]() {
-                            return !tasks_.is_empty() || shutdown_;
-                        });
+    struct thread_pool::task_queue {
+        using clock = std::chrono::steady_clock;
 
-                        if (shutdown_) {
-                            return;
-                        }
+        // A queued task and its rank (the lower, the more urgent).
+        struct entry {
+            clock::time_point rank;
+            std::uint64_t sequence;
+            queued_task task;
+        };
 
-                        --idle_threads_;
+        // A FIFO queue of entries in a ring buffer, which grows as needed
+        // but never shrinks. Unlike a std::deque, which frees and
+        // allocates blocks as entries pass through it, it thus does not
+        // allocate memory in the steady state.
+        class entry_ring {
+            public:
+                bool empty() const {
+                    return count_ == 0;
+                }
+
+                entry& front() {
+                    return slots_[head_];
+                }
 
-                        tasks_.pop(task);
-                        condition_push_.notify_one();
+                void push_back(entry&& e) {
+                    if (count_ == slots_.size()) {
+                        grow();
                     }
-                    task();
+                    slots_[(head_ + count_) % slots_.size()] = std::move(e);
+                    ++count_;
                 }
-            });
+
+                void pop_front() {
+                    slots_[head_] = entry{};
+                    head_ = (head_ + 1) % slots_.size();
+                    --count_;
+                }
+
+            private:
+                // Doubles the capacity, moving the entries (in order) to
+                // the front of the new buffer.
+                void grow() {
+                    std::vector<entry> slots(std::max<std::size_t>(2 * slots_.size(), 16));
+                    for (std::size_t k = 0; k < count_; ++k) {
+                        slots[k] = std::move(slots_[(head_ + k) % slots_.size()]);
+                    }
+                    slots_ = std::move(slots);
+                    head_ = 0;
+                }
+
+                std::vector<entry> slots_;
+                std::size_t head_ = 0;
+                std::size_t count_ = 0;
+        };
+
+        static constexpr int num_levels = 3;
+
+        task_queue(std::size_t max_size, clock::duration aging_interval)
+            : max_size(max_size), aging_interval(aging_interval) {}
+
+        bool is_empty() const {
+            return size == 0;
+        }
+
+        bool is_full() const {
+            return size >= max_size;
+        }
+
+        // Inserts func, scheduled at time now with options.
+        // Returns whether the task is urgent.
+        bool push(task_function&& func, const task_options& options, clock::time_point now) {
+            int level = static_cast<int>(options.priority);
+            clock::time_point rank = now + (num_levels - 1 - level) * aging_interval;
+            ++size;
+#if RA_STATS
+            queued_task task{std::move(func), options.stop, now};
+#else
+            queued_task task{std::move(func), options.stop};
+#endif
+
+            // Only tasks whose deadline comes first are ordered by it, so
+            // the tasks of each level are ranked in FIFO order.
+            if (options.deadline < rank) {
+                deadlines.push_back(entry{options.deadline, next_sequence++, std::move(task)});
+                std::push_heap(deadlines.begin(), deadlines.end(), later);
+                return true;
+            }
+            levels[level].push_back(entry{rank, 0, std::move(task)});
+            return options.priority == task_priority::high;
+        }
+
+        // Removes the most urgent task and moves it to task.
+        // Returns whether the task was urgent.
+        // Precondition: !is_empty()
+        bool pop(queued_task& task) {
+            // On equal ranks, tasks with deadlines come first, and then
+            // tasks of higher priority.
+            const entry* best = deadlines.empty() ? nullptr : &deadlines.front();
+            int best_level = -1;
+            for (int level = num_levels - 1; level >= 0; --level) {
+                if (!levels[level].empty() && (!best || levels[level].front().rank < best->rank)) {
+                    best = &levels[level].front();
+                    best_level = level;
+                }
+            }
+
+            --size;
+            if (best_level < 0) {
+                std::pop_heap(deadlines.begin(), deadlines.end(), later);
+                task = std::move(deadlines.back().task);
+                deadlines.pop_back();
+                return true;
+            }
+            task = std::move(levels[best_level].front().task);
+            levels[best_level].pop_front();
+            return best_level == static_cast<int>(task_priority::high);
+        }
+
+        // Removes up to max_n of the most urgent tasks and appends them (in
+        // order) to out, adding the number of urgent ones to urgent.
+        // Several tasks are only removed if they are all of the same
+        // priority, so that a task taken later never has to wait for
+        // less urgent ones taken in the same batch.
+        // Returns the number of tasks removed.
+        // Precondition: !is_empty() and max_n > 0
+        std::size_t pop_bulk(std::vector<queued_task>& out, std::size_t max_n, std::size_t& urgent) {
+            int nonempty = 0;
+            for (const auto& level : levels) {
+                nonempty += !level.empty();
+            }
+            std::size_t n = deadlines.empty() && nonempty == 1 ? std::min(max_n, size) : 1;
+            for (std::size_t k = 0; k < n; ++k) {
+                out.emplace_back();
+                urgent += pop(out.back());
+            }
+            return n;
+        }
+
+        // Orders the heap of tasks with deadlines (earliest on top, and
+        // FIFO among equal deadlines).
+        static bool later(const entry& a, const entry& b) {
+            return a.rank > b.rank || (a.rank == b.rank && a.sequence > b.sequence);
         }
+
+        std::size_t max_size;
+        clock::duration aging_interval;
+        std::size_t size = 0;
+        bool closed = false;
+
+        // The tasks ordered by their priority (FIFO per level, since the
+        // ranks of a level grow with the scheduling times) ...
+        std::array<entry_ring, num_levels> levels;
+
+        // ... and the tasks ordered by their deadlines (a heap).
+        std::vector<entry> deadlines;
+        std::uint64_t next_sequence = 0;
+    };
+
+    thread_pool::thread_pool() : thread_pool(thread_pool_options{}) {}
+
+    thread_pool::thread_pool(std::size_t num_threads) : thread_pool([num_threads]() {
+          thread_pool_options options;
+          options.num_threads = num_threads;
+          return options;
+      }()) {}
+
+    thread_pool::thread_pool(const thread_pool_options& options)
+        : num_threads_(options.num_threads), min_threads_(0), idle_timeout_(options.idle_timeout),
+          active_threads_(0), blocked_threads_(0), used_slots_(0), idle_threads_(0), spinning_threads_(0),
+          pending_(0), work_stealing_(options.work_stealing), next_queue_(0), urgent_(0), queued_(0), threads_(),
+          shutdown_(false), discarding_(false) {
+        if (num_threads_ == 0) {
+            num_threads_ = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 2;
+        }
+        min_threads_ = num_threads_;
+        num_threads_ = std::max(num_threads_, options.max_threads);
+        start(options);
     }
 
     thread_pool::~thread_pool() {
@@ -78,28 +319,195 @@ namespace ra::concurrency {
         }
 
         for (auto& thread : threads_) {
-            thread.join();
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+#if RA_STATS
+        if (stats_thread_.joinable()) {
+            stats_thread_.join();
         }
+#endif
     }
 
     thread_pool::size_type thread_pool::size() const {
         return num_threads_;
     }
 
-    void thread_pool::schedule(std::function<void()>&& func) {
-        std::unique_lock<std::mutex> lock(mutex_);
+    thread_pool::size_type thread_pool::active_threads() const {
+        return active_threads_.load(std::memory_order_relaxed);
+    }
+
+    void thread_pool::schedule(task_function&& func) {
+        // In work-stealing mode, a task scheduled by a thread of the pool
+        // goes onto the local deque of that thread without any locking.
+        if (work_stealing_ && current_pool == this) {
+            pending_.fetch_add(1, std::memory_order_relaxed);
+            workers_[current_index]->tasks.push(nodes.make(std::move(func)));
+
+            // Wake up an idle thread (if any) so that it can steal the task.
+            wake_idle_thread();
+            return;
+        }
+
+        enqueue(queue_for(task_options::any_node), std::move(func), task_options{});
+    }
+
+    void thread_pool::schedule(task_function&& func, size_type node) {
+        task_options options;
+        options.node = node;
+        schedule(std::move(func), options);
+    }
+
+    void thread_pool::schedule(task_function&& func, const task_options& options) {
+        // Only plain tasks may go onto a local deque, which is not ordered
+        // by urgency.
+        if (work_stealing_ && current_pool == this && options.priority == task_priority::normal &&
+            options.deadline == std::chrono::steady_clock::time_point::max() &&
+            (options.node == task_options::any_node ||
+             workers_[current_index]->node == options.node % queues_.size())) {
+            pending_.fetch_add(1, std::memory_order_relaxed);
+            workers_[current_index]->tasks.push(nodes.make(std::move(func), options.stop));
+            wake_idle_thread();
+            return;
+        }
+        enqueue(queue_for(options.node), std::move(func), options);
+    }
+
+    thread_pool::size_type thread_pool::queue_for(size_type node) {
+        if (node != task_options::any_node) {
+            return node % queues_.size();
+        }
+
+        // A thread of the pool uses the queue of its node, and other
+        // threads spread their tasks over the queues.
+        if (queues_.size() == 1) {
+            return 0;
+        }
+        return current_pool == this ? workers_[current_index]->node
+                                    : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    }
+
+    void thread_pool::enqueue(size_type index, task_function&& func, const task_options& options) {
+        task_queue& tasks = *queues_[index];
+        auto now = task_queue::clock::now();
+        std::unique_lock<std::mutex> lock = lock_mutex();
 
-        condition_push_.wait(lock, [this]() {
-            return !tasks_.is_full() || shutdown_;
-        });
+#if RA_STATS
+        if (tasks.is_full() && !shutdown_) {
+            add(local_stats().blocked_schedules, 1);
+        }
+#endif
+        while (tasks.is_full() && !shutdown_) {
+            if (current_pool == this) {
+                // A thread of the pool must not sleep until the queue has
+                // room (all of the threads might end up doing so), so it
+                // executes a queued task instead.
+                lock.unlock();
+                run_pending_task();
+                lock.lock();
+            } else {
+                grow_if_needed();
+                condition_push_.wait(lock);
+            }
+        }
 
-        if (shutdown_ || tasks_.is_closed()) {
+        if (shutdown_ || tasks.closed) {
             return;
         }
 
-        tasks_.push(std::move(func));
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        if (tasks.push(std::move(func), options, now)) {
+            urgent_.fetch_add(1, std::memory_order_relaxed);
+        }
+        queued_.fetch_add(1, std::memory_order_relaxed);
+
+        // With several queues, a thread of any node may have to take the
+        // task, so all idle threads are woken up to look.
+        if (queues_.size() > 1) {
+            condition_pop_.notify_all();
+        } else {
+            condition_pop_.notify_one();
+        }
+        grow_if_needed();
+    }
+
+    bool thread_pool::try_schedule(task_function&& func) {
+        if (work_stealing_ && current_pool == this) {
+            schedule(std::move(func));
+            return true;
+        }
+
+        task_queue& tasks = *queues_[queue_for(task_options::any_node)];
+        auto now = task_queue::clock::now();
+
+        std::unique_lock<std::mutex> lock = lock_mutex();
+
+        if (shutdown_ || tasks.closed || tasks.is_full()) {
+#if RA_STATS
+            if (tasks.is_full()) {
+                add(local_stats().rejected_schedules, 1);
+            }
+#endif
+            return false;
+        }
+
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        tasks.push(std::move(func), task_options{}, now);
+        queued_.fetch_add(1, std::memory_order_relaxed);
+
+        if (queues_.size() > 1) {
+            condition_pop_.notify_all();
+        } else {
+            condition_pop_.notify_one();
+        }
+        grow_if_needed();
+        return true;
+    }
+
+    thread_pool::size_type thread_pool::nonempty_queue(size_type node) const {
+        for (size_type i = 0; i < queues_.size(); ++i) {
+            size_type index = (node + i) % queues_.size();
+            if (!queues_[index]->is_empty()) {
+                return index;
+            }
+        }
+        return queues_.size();
+    }
 
-        condition_pop_.notify_one();
+    bool thread_pool::pop_queued(size_type node, queued_task& task) {
+        size_type index = nonempty_queue(node);
+        if (index == queues_.size()) {
+            return false;
+        }
+        if (queues_[index]->pop(task)) {
+            urgent_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        notify_schedulers(1);
+        return true;
+    }
+
+    void thread_pool::notify_schedulers(size_type count) {
+        // With several queues, the thread woken up by notify_one might be
+        // waiting for a different queue than the one that has room.
+        if (count > 1 || queues_.size() > 1) {
+            condition_push_.notify_all();
+        } else {
+            condition_push_.notify_one();
+        }
+    }
+
+    thread_pool::size_type thread_pool::num_nodes() const {
+        return queues_.size();
+    }
+
+    thread_pool::size_type thread_pool::node_of_thread(size_type index) const {
+        return workers_[index]->node;
+    }
+
+    thread_pool::size_type thread_pool::current_node() const {
+        return current_pool == this ? workers_[current_index]->node : queues_.size();
     }
 
     void thread_pool::shutdown() {
@@ -109,18 +517,678 @@ namespace ra::concurrency {
             return;
         }
 
-        tasks_.close();
+        for (auto& tasks : queues_) {
+            tasks->closed = true;
+        }
 
-        // Wait until the tasks queue is empty and all the threads are idle.
-        condition_shutdown_.wait(lock, [this]() { return tasks_.is_empty() && (idle_threads_ == num_threads_); });
+        // Wait until all the scheduled tasks have been executed.
+        condition_shutdown_.wait(lock, [this]() { return pending_.load(std::memory_order_acquire) == 0; });
         shutdown_ = true;
 
         // Notify all threads that the thread pool is shutting down, so that they can exit.
         condition_push_.notify_all();
         condition_pop_.notify_all();
+        condition_shutdown_.notify_all();
+    }
+
+    void thread_pool::shutdown_now() {
+        std::vector<queued_task> discarded;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (shutdown_) {
+                return;
+            }
+            for (auto& tasks : queues_) {
+                tasks->closed = true;
+            }
+
+            // The queued tasks are taken out right away; the tasks on local
+            // deques are discarded by the threads that reach
+            // them (see run_task).
+            discarding_.store(true, std::memory_order_relaxed);
+            for (auto& tasks : queues_) {
+                while (!tasks->is_empty()) {
+                    discarded.emplace_back();
+                    tasks->pop(discarded.back());
+                }
+            }
+            urgent_.store(0, std::memory_order_relaxed);
+            queued_.store(0, std::memory_order_relaxed);
+            condition_push_.notify_all();
+        }
+
+        // The callables are destroyed without the mutex, as their
+        // destructors may, e.g., complete futures.
+        for (queued_task& task : discarded) {
+            run_task(task);
+        }
+        shutdown();
     }
 
     bool thread_pool::is_shutdown() const {
         return shutdown_;
     }
+
+    void thread_pool::wait_idle() {
+        while (pending_.load(std::memory_order_acquire) > 0) {
+            if (!run_pending_task()) {
+                // Nothing left to help with, so sleep until the last
+                // pending task finishes.
+                std::unique_lock<std::mutex> lock(mutex_);
+                condition_shutdown_.wait(lock, [this]() {
+                    return pending_.load(std::memory_order_acquire) == 0;
+                });
+            }
+        }
+    }
+
+    bool thread_pool::run_pending_task() {
+        queued_task task;
+        bool found = false;
+
+        auto steal_task = [this, &task]() {
+            if (current_pool == this) {
+                return try_steal(current_index, task);
+            }
+            thread_local std::uint64_t seed = 0x2545f4914f6cdd1dull;
+            return steal(workers_.size(), seed, task);
+        };
+
+        // Urgent tasks in the queues come before the local deques (which
+        // hold the batches taken from the queues in both modes).
+        bool urgent = urgent_.load(std::memory_order_relaxed) > 0;
+        if (!urgent) {
+            found = steal_task();
+        }
+
+        if (!found) {
+            std::unique_lock<std::mutex> lock = lock_mutex();
+            found = pop_queued(current_pool == this ? workers_[current_index]->node : 0, task);
+        }
+
+        if (!found && urgent) {
+            found = steal_task();
+        }
+
+        if (!found) {
+            return false;
+        }
+
+        run_task(task);
+        return true;
+    }
+
+    std::unique_lock<std::mutex> thread_pool::lock_mutex() {
+#if RA_STATS
+        std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            lock.lock();
+            add(local_stats().contended_locks, 1);
+        }
+        return lock;
+#else
+        return std::unique_lock<std::mutex>(mutex_);
+#endif
+    }
+
+#if RA_STATS
+    thread_pool::stats_counters& thread_pool::local_stats() {
+        return current_pool == this ? workers_[current_index]->stats : *outside_stats_;
+    }
+#endif
+
+    void thread_pool::run_task(queued_task& task) {
+        // A cancelled task is only destroyed.
+        if (discarding_.load(std::memory_order_relaxed) || task.stop.stop_requested()) {
+#if RA_STATS
+            add(local_stats().discarded_tasks, 1);
+#endif
+            task.func = nullptr;
+            task.stop = std::stop_token();
+            finish_task();
+            return;
+        }
+#if RA_STATS
+        auto start = std::chrono::steady_clock::now();
+        task.func();
+        auto end = std::chrono::steady_clock::now();
+
+        stats_counters& stats = local_stats();
+        auto run_time = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+        add(stats.tasks_executed, 1);
+        add(stats.busy_ns, run_time.count());
+        add(stats.run_time[latency_histogram::bucket(run_time)], 1);
+        add(stats.queue_wait[latency_histogram::bucket(start - task.scheduled)], 1);
+#else
+        task.func();
+#endif
+        task.func = nullptr;
+        task.stop = std::stop_token();
+        finish_task();
+    }
+
+    thread_pool_stats thread_pool::stats() const {
+        thread_pool_stats result;
+        size_type used_slots = used_slots_.load(std::memory_order_acquire);
+        result.threads.resize(used_slots);
+#if RA_STATS
+        result.enabled = true;
+        auto collect = [&result](const stats_counters& counters, thread_pool_stats::thread_stats& thread) {
+            auto load = [](const std::atomic<std::uint64_t>& c) { return c.load(std::memory_order_relaxed); };
+            thread.tasks_executed = load(counters.tasks_executed);
+            thread.busy_time = std::chrono::nanoseconds(load(counters.busy_ns));
+            thread.idle_time = std::chrono::nanoseconds(load(counters.idle_ns));
+            result.blocked_schedules += load(counters.blocked_schedules);
+            result.rejected_schedules += load(counters.rejected_schedules);
+            result.contended_locks += load(counters.contended_locks);
+            result.discarded_tasks += load(counters.discarded_tasks);
+            for (std::size_t k = 0; k < latency_histogram::num_buckets; ++k) {
+                result.queue_wait.counts[k] += load(counters.queue_wait[k]);
+                result.run_time.counts[k] += load(counters.run_time[k]);
+            }
+        };
+        for (size_type i = 0; i < used_slots; ++i) {
+            collect(workers_[i]->stats, result.threads[i]);
+        }
+        collect(*outside_stats_, result.outside);
+#endif
+        return result;
+    }
+
+    void thread_pool::start(const thread_pool_options& options) {
+        size_type num_slots = num_threads_ + options.max_compensation_threads;
+        for (size_type i = 0; i < num_slots; ++i) {
+            workers_.push_back(std::make_unique<worker>(options.wait));
+            workers_.back()->seed = 0x9e3779b97f4a7c15ull * (i + 1);
+        }
+
+        // The slots beyond num_threads_ (for compensation threads) are
+        // placed like the first ones.
+        size_type num_queues = 1;
+        if (options.placement == thread_placement::numa_nodes) {
+            // Consecutive threads are grouped on the same node.
+            const numa_topology& topology = options.topology ? *options.topology : numa_topology::system();
+            num_queues = std::min(topology.num_nodes(), num_threads_);
+            for (size_type i = 0; i < num_slots; ++i) {
+                workers_[i]->node = (i % num_threads_) * num_queues / num_threads_;
+                workers_[i]->cpus = topology.cpus(workers_[i]->node);
+            }
+        } else if (options.placement == thread_placement::cores) {
+            std::vector<int> cpus = available_cpus();
+            for (size_type i = 0; i < num_slots; ++i) {
+                workers_[i]->cpus = {cpus[(i % num_threads_) % cpus.size()]};
+            }
+        }
+        if (!options.cpu_sets.empty()) {
+            for (size_type i = 0; i < num_slots; ++i) {
+                workers_[i]->cpus = options.cpu_sets[(i % num_threads_) % options.cpu_sets.size()];
+            }
+        }
+
+        for (size_type i = 0; i < num_queues; ++i) {
+            queues_.push_back(std::make_unique<task_queue>(MAX_QUEUE, options.aging_interval));
+        }
+
+        threads_.resize(num_slots);
+        {
+            std::scoped_lock<std::mutex> lock(mutex_);
+            for (size_type i = 0; i < min_threads_; ++i) {
+                spawn_thread();
+            }
+        }
+
+#if RA_STATS
+        outside_stats_ = std::make_unique<stats_counters>();
+        if (options.stats_interval > std::chrono::steady_clock::duration::zero()) {
+            stats_thread_ = std::thread([this, interval = options.stats_interval, report = options.stats_report]() {
+                auto next = std::chrono::steady_clock::now() + interval;
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (!condition_shutdown_.wait_until(lock, next, [this]() { return shutdown_; })) {
+                    lock.unlock();
+                    thread_pool_stats s = stats();
+                    if (report) {
+                        report(s);
+                    } else {
+                        std::clog << s << std::flush;
+                    }
+                    next += interval;
+                    lock.lock();
+                }
+            });
+        }
+#endif
+    }
+
+    void thread_pool::spawn_thread() {
+        for (size_type i = 0; i < workers_.size(); ++i) {
+            if (!workers_[i]->active) {
+                // The previous thread of the slot (if any) has exited, or
+                // is about to without taking the mutex.
+                if (threads_[i].joinable()) {
+                    threads_[i].join();
+                }
+                workers_[i]->active = true;
+                active_threads_.fetch_add(1, std::memory_order_relaxed);
+                if (used_slots_.load(std::memory_order_relaxed) <= i) {
+                    used_slots_.store(i + 1, std::memory_order_release);
+                }
+                threads_[i] = std::thread([this, i]() { worker_loop(i); });
+                return;
+            }
+        }
+    }
+
+    void thread_pool::grow_if_needed() {
+        if (idle_threads_.load(std::memory_order_relaxed) > 0 ||
+            spinning_threads_.load(std::memory_order_relaxed) > 0) {
+            return;
+        }
+        if (queued_.load(std::memory_order_relaxed) == 0 && !has_stealable_task()) {
+            return;
+        }
+        // Blocked threads do not count, so they are compensated for.
+        size_type active = active_threads_.load(std::memory_order_relaxed);
+        if (active - blocked_threads_ < num_threads_ && active < workers_.size()) {
+            spawn_thread();
+        }
+    }
+
+    void thread_pool::enter_blocking() {
+        // The rest of the thread's batch stays on its local deque, where
+        // the other threads (or a compensation thread) can steal it.
+        std::unique_lock<std::mutex> lock = lock_mutex();
+        ++blocked_threads_;
+        grow_if_needed();
+    }
+
+    void thread_pool::leave_blocking() {
+        std::scoped_lock<std::mutex> lock(mutex_);
+        --blocked_threads_;
+    }
+
+    void thread_pool::worker_loop(size_type index) {
+        current_pool = this;
+        current_index = index;
+
+        // Pinning is best effort: a thread whose CPUs are not available
+        // simply runs unpinned.
+        if (!workers_[index]->cpus.empty()) {
+            set_thread_affinity(workers_[index]->cpus);
+        }
+
+        queued_task task;
+        while (next_task(index, task)) {
+            run_task(task);
+        }
+
+        current_pool = nullptr;
+    }
+
+    bool thread_pool::next_task(size_type index, queued_task& task) {
+        worker& self = *workers_[index];
+
+        while (true) {
+            // Urgent tasks in the queues come before the local deques, so
+            // also before the rest of the batch that the thread took
+            // earlier (in either mode).
+            if (urgent_.load(std::memory_order_relaxed) == 0 && try_steal(index, task)) {
+                return true;
+            }
+
+            std::unique_lock<std::mutex> lock = lock_mutex();
+
+            // The queue of the thread's own node is preferred.
+            size_type queue_index = nonempty_queue(self.node);
+            if (queue_index < queues_.size()) {
+                // Take a fair share of the queued tasks under a single lock
+                // acquisition, and wake up as many blocked schedulers as
+                // slots were freed.
+                task_queue& tasks = *queues_[queue_index];
+                size_type urgent = 0;
+                size_type count =
+                    tasks.pop_bulk(self.batch, (tasks.size + num_threads_ - 1) / num_threads_, urgent);
+                urgent_.fetch_sub(urgent, std::memory_order_relaxed);
+                queued_.fetch_sub(count, std::memory_order_relaxed);
+                notify_schedulers(count);
+                // Tasks left behind may call for another thread.
+                grow_if_needed();
+                lock.unlock();
+
+                task = std::move(self.batch[0]);
+
+                // The rest of the batch goes onto the local deque (in
+                // reverse, so that the thread pops it in FIFO order), where
+                // idle threads can steal it instead of waiting for the
+                // thread to get through it, e.g., behind a long task.
+                if (count > 1) {
+                    for (size_type i = count; i-- > 1;) {
+                        self.tasks.push(nodes.make(std::move(self.batch[i])));
+                    }
+                    wake_idle_thread();
+                }
+                self.batch.clear();
+                return true;
+            }
+
+            if (shutdown_) {
+                return false;
+            }
+
+            // Spin (without the mutex) before parking. A spinning thread
+            // does not count as idle, so no one needs to wake it up.
+            if (self.spinner.enabled()) {
+                spinning_threads_.fetch_add(1, std::memory_order_relaxed);
+                lock.unlock();
+                bool ready = self.spinner.spin([this]() {
+                    return queued_.load(std::memory_order_relaxed) > 0 || has_stealable_task();
+                });
+                lock.lock();
+                spinning_threads_.fetch_sub(1, std::memory_order_relaxed);
+                if (ready) {
+                    continue;
+                }
+                if (nonempty_queue(self.node) < queues_.size() || shutdown_) {
+                    continue;
+                }
+            }
+
+            // The fence pairs with the one in wake_idle_thread, so that either the
+            // idle thread sees a task pushed onto a local deque or the
+            // scheduling thread sees the idle thread (and wakes it up).
+            idle_threads_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+#if RA_STATS
+            auto idle_start = std::chrono::steady_clock::now();
+#endif
+            bool woken = condition_pop_.wait_for(lock, idle_timeout_, [this]() {
+                return nonempty_queue(0) < queues_.size() || shutdown_ || has_stealable_task();
+            });
+#if RA_STATS
+            add(self.stats.idle_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        std::chrono::steady_clock::now() - idle_start)
+                                        .count());
+#endif
+
+            idle_threads_.fetch_sub(1, std::memory_order_relaxed);
+
+            // A thread beyond the minimum (not counting blocked threads)
+            // exits after the idle timeout.
+            if (!woken && active_threads_.load(std::memory_order_relaxed) - blocked_threads_ > min_threads_) {
+                self.active = false;
+                active_threads_.fetch_sub(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+    }
+
+    bool thread_pool::try_steal(size_type index, queued_task& task) {
+        // Local tasks are taken in LIFO order.
+        if (queued_task* local = workers_[index]->tasks.pop()) {
+            task = std::move(*local);
+            nodes.recycle(local);
+            return true;
+        }
+        return steal(index, workers_[index]->seed, task);
+    }
+
+    bool thread_pool::steal(size_type self, std::uint64_t& seed, queued_task& task) {
+        // Other threads' tasks are stolen in FIFO order, starting at a
+        // random victim.
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+
+        // Only the slots that have had a thread can hold tasks.
+        size_type num_slots = used_slots_.load(std::memory_order_acquire);
+        if (num_slots == 0) {
+            return false;
+        }
+        size_type victim = seed % num_slots;
+        for (size_type i = 0; i < num_slots; ++i, victim = (victim + 1) % num_slots) {
+            if (victim == self) {
+                continue;
+            }
+            if (queued_task* stolen = workers_[victim]->tasks.steal()) {
+                task = std::move(*stolen);
+                nodes.recycle(stolen);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool thread_pool::has_stealable_task() const {
+        size_type used_slots = used_slots_.load(std::memory_order_acquire);
+        for (size_type i = 0; i < used_slots; ++i) {
+            if (!workers_[i]->tasks.is_empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void thread_pool::wake_idle_thread() {
+        // The fence pairs with the one in next_task.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idle_threads_.load(std::memory_order_relaxed) > 0) {
+            std::scoped_lock<std::mutex> lock(mutex_);
+            condition_pop_.notify_one();
+        }
+    }
+
+    void thread_pool::finish_task() {
+        // Notify the shutdown function when the last pending task finishes.
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::scoped_lock<std::mutex> lock(mutex_);
+            condition_shutdown_.notify_all();
+        }
+    }
+
+    blocking_region::blocking_region(thread_pool& pool) : pool_(current_pool == &pool ? &pool : nullptr) {
+        if (pool_) {
+            pool_->enter_blocking();
+        }
+    }
+
+    blocking_region::~blocking_region() {
+        if (pool_) {
+            pool_->leave_blocking();
+        }
+    }
+
+    task_group::task_group(thread_pool& pool) : pool_(pool), pending_(0) {}
+
+    void task_group::cancel() {
+        stop_source_.request_stop();
+    }
+
+    bool task_group::is_cancelled() const {
+        return stop_source_.stop_requested();
+    }
+
+    std::stop_token task_group::get_stop_token() const {
+        return stop_source_.get_token();
+    }
+
+    task_group::~task_group() {
+        try {
+            wait();
+        } catch (...) {
+        }
+    }
+
+    void task_group::run(task_function&& func) {
+        pool_.schedule(wrap(std::move(func)));
+    }
+
+    void task_group::run(task_function&& func, size_type node) {
+        pool_.schedule(wrap(std::move(func)), node);
+    }
+
+    void task_group::run(task_function&& func, const task_options& options) {
+        pool_.schedule(wrap(std::move(func)), options);
+    }
+
+    task_function task_group::wrap(task_function&& func) {
+        pending_.fetch_add(1, std::memory_order_relaxed);
+
+        // The task is counted as finished when it is destroyed, so that a
+        // task that is discarded without running does not block wait.
+        struct completion {
+            task_group* group;
+
+            completion(task_group* group) : group(group) {}
+            completion(completion&& other) noexcept : group(std::exchange(other.group, nullptr)) {}
+
+            ~completion() {
+                if (group) {
+                    group->finish_task();
+                }
+            }
+        };
+
+        return [done = completion(this), func = std::move(func)]() mutable {
+            if (done.group->is_cancelled()) {
+                return;
+            }
+            try {
+                func();
+            } catch (...) {
+                done.group->set_exception(std::current_exception());
+            }
+        };
+    }
+
+    void task_group::wait() {
+        while (pending_.load(std::memory_order_acquire) > 0) {
+            if (!pool_.run_pending_task()) {
+                // Nothing left to help with, so sleep until the last task
+                // of the group finishes.
+                std::unique_lock<std::mutex> lock(mutex_);
+                condition_.wait(lock, [this]() { return pending_.load(std::memory_order_acquire) == 0; });
+            }
+        }
+
+        // Acquiring the mutex also guarantees that the thread that finished
+        // the last task no longer accesses the task group.
+        std::exception_ptr e;
+        {
+            std::scoped_lock<std::mutex> lock(mutex_);
+            e = std::exchange(exception_, nullptr);
+        }
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+
+    thread_pool& task_group::pool() const {
+        return pool_;
+    }
+
+    void task_group::finish_task() {
+        // Only the (potentially) last task takes the mutex, so that wait
+        // cannot return while that task still uses the task group.
+        size_type pending = pending_.load(std::memory_order_relaxed);
+        while (pending > 1) {
+            if (pending_.compare_exchange_weak(pending, pending - 1, std::memory_order_acq_rel)) {
+                return;
+            }
+        }
+
+        std::scoped_lock<std::mutex> lock(mutex_);
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            condition_.notify_all();
+        }
+    }
+
+    void task_group::set_exception(std::exception_ptr e) {
+        std::scoped_lock<std::mutex> lock(mutex_);
+        if (!exception_) {
+            exception_ = std::move(e);
+        }
+    }
+
+    namespace {
+        // Prints the duration d with a unit suited to its magnitude.
+        void print_duration(std::ostream& out, std::chrono::nanoseconds d) {
+            auto ns = static_cast<double>(d.count());
+            if (ns < 1e3) {
+                out << ns << " ns";
+            } else if (ns < 1e6) {
+                out << ns / 1e3 << " us";
+            } else if (ns < 1e9) {
+                out << ns / 1e6 << " ms";
+            } else {
+                out << ns / 1e9 << " s";
+            }
+        }
+
+        void print_thread(std::ostream& out, const thread_pool_stats::thread_stats& thread) {
+            out << thread.tasks_executed << " tasks, busy ";
+            print_duration(out, thread.busy_time);
+            out << ", idle ";
+            print_duration(out, thread.idle_time);
+            out << '\n';
+        }
+
+        void print_histogram(std::ostream& out, const latency_histogram& histogram) {
+            out << histogram.total() << " tasks";
+            for (double q : {0.5, 0.9, 0.99, 1.0}) {
+                out << ", p" << q * 100 << " < ";
+                print_duration(out, histogram.quantile(q));
+            }
+            out << '\n';
+        }
+    }  // namespace
+
+    std::ostream& operator<<(std::ostream& out, const thread_pool_stats& s) {
+        if (!s.enabled) {
+            return out << "thread pool statistics disabled (RA_STATS is 0)\n";
+        }
+        out << "thread pool: " << s.threads.size() << " threads, " << s.blocked_schedules
+            << " blocked schedules, " << s.rejected_schedules << " rejected schedules, " << s.contended_locks
+            << " contended locks, " << s.discarded_tasks << " discarded tasks\n";
+        for (std::size_t i = 0; i < s.threads.size(); ++i) {
+            out << "  thread " << i << ": ";
+            print_thread(out, s.threads[i]);
+        }
+        out << "  outside: ";
+        print_thread(out, s.outside);
+        out << "  queue wait: ";
+        print_histogram(out, s.queue_wait);
+        out << "  run time: ";
+        print_histogram(out, s.run_time);
+        return out;
+    }
+
+    void first_touch(thread_pool& pool, void* data, std::size_t n) {
+        char* bytes = static_cast<char*>(data);
+#ifdef __linux__
+        // Released pages read as zeros (or as the file contents) when
+        // touched again, and are then allocated on the node of the
+        // touching thread. Everything is zeroed below anyway.
+        std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        std::uintptr_t begin = (reinterpret_cast<std::uintptr_t>(bytes) + page - 1) / page * page;
+        std::uintptr_t end = (reinterpret_cast<std::uintptr_t>(bytes) + n) / page * page;
+        if (begin < end) {
+            madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+        }
+#endif
+
+        // Each part is written in chunks, so that all threads of a node
+        // take part.
+        const std::size_t chunk = std::size_t(1) << 20;
+        std::size_t num_nodes = pool.num_nodes();
+        task_group group(pool);
+        for (std::size_t node = 0; node < num_nodes; ++node) {
+            std::size_t part_begin = n * node / num_nodes;
+            std::size_t part_end = n * (node + 1) / num_nodes;
+            for (std::size_t offset = part_begin; offset < part_end; offset += chunk) {
+                std::size_t size = std::min(chunk, part_end - offset);
+                group.run([bytes, offset, size]() { std::memset(bytes + offset, 0, size); }, node);
+            }
+        }
+        group.wait();
+    }
 }  // namespace ra::concurrency